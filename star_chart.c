@@ -1,24 +1,68 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "star_chart_utils.h"
+#include "star_chart_snapshot.h"
+#include "star_chart_server.h"
 
-int main(void) {
+static void ReleaseCatalog(StarSnapshot *snapshot, StarArray *star_array, KDTree *kd_tree, HashMap *star_hash_map) {
+    if (snapshot) {
+        CloseSnapshot(snapshot); // Owns the array, tree and hash map
+        return;
+    }
 
-    StarArray *star_array = ParseFile();
-    KDNode *kd_tree = CreateBalancedKDTree(star_array->stars, 0, star_array->size - 1, 0);
-    HashMap *star_hash_map = CreateHashMap(star_array, star_array->size);
+    DeallocHashMap(star_hash_map); 
+    DeallocKDTree(kd_tree);
+
+    /* -- WARNING -- */
+    // ENSURE THIS IS CALLED LAST!!!
+    // Star Array is the source of data for secondary data structures!
+    DeallocMainStarArray(star_array);
+}
+
+// usage: star_chart [--serve [socket] [workers]]
+int main(int argc, char **argv) {
+
+    // Use the prebuilt snapshot when there is one (see star_chart_pack.c), else parse the csv
+    StarSnapshot *snapshot = OpenSnapshot("stars.snap");
+    StarArray *star_array;
+    KDTree *kd_tree;
+    HashMap *star_hash_map;
+    if (snapshot) {
+        star_array = snapshot->array;
+        kd_tree = snapshot->tree;
+        star_hash_map = snapshot->map;
+    } else {
+        star_array = LoadStarCatalog("stars.csv", KD_DEFAULT_LEAF_SIZE, &kd_tree, &star_hash_map);
+    }
 
-    Star* closest_star = NearestNeighbor(kd_tree, player_position);
+    // The KD-tree itself, or a grid when built with -DSTAR_CHART_GRID_INDEX
+    SpatialIndex *spatial_index = CreateSpatialIndexForTree(star_array, kd_tree, DEFAULT_JUMP_RANGE);
+
+    // Stay resident and answer queries over a Unix socket (see star_chart_client.c)
+    if (argc > 1 && strcmp(argv[1], "--serve") == 0) {
+        ServerOptions options = {(argc > 2) ? argv[2] : SERVER_DEFAULT_SOCKET, (argc > 3) ? atoi(argv[3]) : 0, spatial_index};
+        int status = RunQueryServer(kd_tree, star_hash_map, &options);
+        DeallocSpatialIndexForTree(spatial_index, kd_tree);
+        ReleaseCatalog(snapshot, star_array, kd_tree, star_hash_map);
+        return status;
+    }
+
+    Star* closest_star = SpatialNearest(spatial_index, player_position);
     // printf("Closest star: %s\n", closest_star->name);   
     
     // StarArray *star_range = StarSearchRange(kd_tree, 10.0);
 
-    // StarArray *star_path = StarPath("Sirius", kd_tree, star_hash_map);
-    // StarArray *star_path = StarPath("BY Draconis", kd_tree, star_hash_map);
-    // StarArray *star_path = StarPath("Tau Ceti", kd_tree, star_hash_map);
-    // StarArray *star_path = StarPath("Epsilon Eridani", kd_tree, star_hash_map);
-    StarArray *star_path = StarPath("Groombridge 34", kd_tree, star_hash_map);
+    // StarArray *star_path = StarPath("Sirius", kd_tree, star_hash_map, DEFAULT_JUMP_RANGE);
+    // StarArray *star_path = StarPath("BY Draconis", kd_tree, star_hash_map, DEFAULT_JUMP_RANGE);
+    // StarArray *star_path = StarPath("Tau Ceti", kd_tree, star_hash_map, DEFAULT_JUMP_RANGE);
+    // StarArray *star_path = StarPath("Epsilon Eridani", kd_tree, star_hash_map, DEFAULT_JUMP_RANGE);
+    StarArray *star_path = StarPath("Groombridge 34", kd_tree, star_hash_map, DEFAULT_JUMP_RANGE);
     
     printf("-----------------------\n");
+    // QueryStats stats;
+    // GetAggregateStats(&stats);
+    // DumpQueryStats(stdout, "All queries", &stats); // Build with -DSTAR_CHART_STATS for counters
     // PrintStarValues(star_array);
     // PrintKDTree(kd_tree);
     // PrintStarValues(star_range);
@@ -27,11 +71,7 @@ int main(void) {
 
     DeallocSubStarArray(star_path);
     // DeallocSubStarArray(star_range);
-    DeallocHashMap(star_hash_map); 
-    DeallocKDTree(kd_tree);
-
-    /* -- WARNING -- */
-    // ENSURE THIS IS CALLED LAST!!!
-    // Star Array is the source of data for secondary data structures!
-    DeallocMainStarArray(star_array);
+    DeallocSpatialIndexForTree(spatial_index, kd_tree);
+    ReleaseCatalog(snapshot, star_array, kd_tree, star_hash_map);
+    return 0;
 }
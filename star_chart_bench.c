@@ -0,0 +1,578 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "star_chart_utils.h"
+
+// Synthetic catalog generator and benchmark harness. Generates a catalog (or takes an existing
+// one), times every hot path on it and prints one JSON document to stdout; progress goes to
+// stderr. See usage() for the options.
+
+// Roughly the stellar density of the solar neighbourhood (stars per cubic light year)
+#define BENCH_STAR_DENSITY 0.004
+#define BENCH_BLOCK_ROWS 65536
+#define BENCH_ROW_BYTES 96
+
+typedef struct BenchOptions {
+  long stars;
+  int clustered;
+  unsigned long seed;
+  int queries;
+  int range_queries;
+  int routes;
+  double jump_range;
+  const char *input_path;  // Existing catalog; skips generation
+  const char *output_path; // Where the generated catalog is written
+  int keep_catalog;
+  double epsilon;          // Approximate nearest-neighbour error bound
+} BenchOptions;
+
+typedef struct BenchResult {
+  const char *name;
+  long ops;
+  double total_s;
+  double p50_us;
+  double p99_us;
+  long peak_rss_kb;
+  long extra; // Operation-specific count (hits, routes found, ...); -1 when unused
+  const char *extra_name;
+} BenchResult;
+
+static double Now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static long PeakRssKb(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss; // Kilobytes on Linux
+}
+
+// splitmix64: tiny, seedable per block, good enough for synthetic positions
+static unsigned long NextRandom(unsigned long *state) {
+  unsigned long z = (*state += 0x9e3779b97f4a7c15UL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+  return z ^ (z >> 31);
+}
+
+static double RandomUnit(unsigned long *state) {
+  return (NextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double RandomGaussian(unsigned long *state) {
+  double u = RandomUnit(state);
+  double v = RandomUnit(state);
+  return sqrt(-2.0 * log(u > 0.0 ? u : 1e-300)) * cos(2.0 * PI * v);
+}
+
+static Position RandomInBall(unsigned long *state, double radius) {
+  Position p;
+  do {
+    p.x = RandomUnit(state) * 2.0 - 1.0;
+    p.y = RandomUnit(state) * 2.0 - 1.0;
+    p.z = RandomUnit(state) * 2.0 - 1.0;
+  } while (p.x * p.x + p.y * p.y + p.z * p.z > 1.0);
+
+  p.x *= radius;
+  p.y *= radius;
+  p.z *= radius;
+  return p;
+}
+
+static int CompareDoubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// CATALOG GENERATION
+// Uniform: stars spread evenly through a ball sized for the target density. Clustered: 70% of
+// the stars sit in Gaussian clusters (2-20 ly across) scattered through the same ball, the
+// rest are uniform background. Rows are formatted in parallel, one block per task, and
+// written in block order so a given seed always produces the same file.
+typedef struct Cluster {
+  Position center;
+  double sigma;
+} Cluster;
+
+typedef struct GeneratorContext {
+  const BenchOptions *options;
+  double radius;
+  const Cluster *clusters;
+  int cluster_count;
+  long first_block;
+  char **buffers;
+  size_t *lengths;
+} GeneratorContext;
+
+static int FormatStarRow(char *out, long id, Position p) {
+  double distance = sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+  if (distance < 1e-9) {
+    distance = 1e-9;
+  }
+
+  double ra = atan2(p.y, p.x) * (180.0 / PI);
+  if (ra < 0.0) {
+    ra += 360.0;
+  }
+  double dec = asin(p.z / distance) * (180.0 / PI);
+
+  // RA in hours/minutes/seconds, Dec in degrees/arcminutes/arcseconds (sign kept on degrees)
+  double ra_hours = ra / 15.0;
+  int ra_h = (int)ra_hours;
+  int ra_m = (int)((ra_hours - ra_h) * 60.0);
+  double ra_s = ((ra_hours - ra_h) * 60.0 - ra_m) * 60.0;
+
+  double dec_abs = fabs(dec);
+  int dec_d = (int)dec_abs;
+  int dec_m = (int)((dec_abs - dec_d) * 60.0);
+  double dec_s = ((dec_abs - dec_d) * 60.0 - dec_m) * 60.0;
+
+  return snprintf(out, BENCH_ROW_BYTES, "Star %ld,%d,%d,%.4f,%s%d,%d,%.4f,%.4f\n", id, ra_h, ra_m, ra_s,
+                  dec < 0.0 ? "-" : "", dec_d, dec_m, dec_s, distance);
+}
+
+static void GenerateBlockTask(void *user_data, int begin, int end) {
+  GeneratorContext *ctx = user_data;
+  const BenchOptions *options = ctx->options;
+
+  for (int slot = begin; slot < end; slot++) {
+    long block = ctx->first_block + slot;
+    long first = block * BENCH_BLOCK_ROWS;
+    long last = first + BENCH_BLOCK_ROWS;
+    if (last > options->stars) {
+      last = options->stars;
+    }
+
+    unsigned long state = options->seed ^ (0x5851f42d4c957f2dUL * (block + 1));
+    char *out = ctx->buffers[slot];
+    size_t length = 0;
+
+    for (long id = first; id < last; id++) {
+      Position p;
+      if (options->clustered && ctx->cluster_count > 0 && RandomUnit(&state) < 0.7) {
+        const Cluster *cluster = &ctx->clusters[NextRandom(&state) % ctx->cluster_count];
+        p.x = cluster->center.x + RandomGaussian(&state) * cluster->sigma;
+        p.y = cluster->center.y + RandomGaussian(&state) * cluster->sigma;
+        p.z = cluster->center.z + RandomGaussian(&state) * cluster->sigma;
+      } else {
+        p = RandomInBall(&state, ctx->radius);
+      }
+      length += FormatStarRow(out + length, id, p);
+    }
+    ctx->lengths[slot] = length;
+  }
+}
+
+static int GenerateCatalog(const BenchOptions *options) {
+  FILE *file = fopen(options->output_path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "ERROR [GenerateCatalog()]: FILE FAILED TO OPEN!\n");
+    return 0;
+  }
+
+  GeneratorContext ctx = {0};
+  ctx.options = options;
+  ctx.radius = cbrt(3.0 * options->stars / (4.0 * PI * BENCH_STAR_DENSITY));
+
+  Cluster *clusters = NULL;
+  if (options->clustered) {
+    ctx.cluster_count = (int)(options->stars / 2000) + 1;
+    clusters = malloc(ctx.cluster_count * sizeof(Cluster));
+    if (clusters == NULL) {
+      fprintf(stderr, "ERROR [GenerateCatalog()]: MEMORY ALLOCATION FAILED FOR CLUSTERS!\n");
+      fclose(file);
+      return 0;
+    }
+    unsigned long state = options->seed;
+    for (int i = 0; i < ctx.cluster_count; i++) {
+      clusters[i].center = RandomInBall(&state, ctx.radius);
+      clusters[i].sigma = 1.0 + RandomUnit(&state) * 9.0;
+    }
+    ctx.clusters = clusters;
+  }
+
+  long blocks = (options->stars + BENCH_BLOCK_ROWS - 1) / BENCH_BLOCK_ROWS;
+  int round_blocks = GetThreadCount() * 2;
+  ctx.buffers = calloc(round_blocks, sizeof(char *));
+  ctx.lengths = calloc(round_blocks, sizeof(size_t));
+  int ok = ctx.buffers != NULL && ctx.lengths != NULL;
+  for (int i = 0; ok && i < round_blocks; i++) {
+    ctx.buffers[i] = malloc((size_t)BENCH_BLOCK_ROWS * BENCH_ROW_BYTES);
+    ok = ctx.buffers[i] != NULL;
+  }
+  if (!ok) {
+    fprintf(stderr, "ERROR [GenerateCatalog()]: MEMORY ALLOCATION FAILED FOR ROW BUFFERS!\n");
+  }
+
+  fputs("Sol,0,0,0,0,0,0,0\n", file);
+  for (long first = 0; ok && first < blocks; first += round_blocks) {
+    int count = (blocks - first < round_blocks) ? (int)(blocks - first) : round_blocks;
+    ctx.first_block = first;
+    ParallelFor(count, 1, GenerateBlockTask, &ctx);
+    for (int i = 0; ok && i < count; i++) {
+      ok = fwrite(ctx.buffers[i], 1, ctx.lengths[i], file) == ctx.lengths[i];
+    }
+  }
+
+  if (fclose(file) != 0) {
+    ok = 0;
+  }
+  if (!ok) {
+    fprintf(stderr, "ERROR [GenerateCatalog()]: FAILED TO WRITE CATALOG!\n");
+  }
+
+  for (int i = 0; ctx.buffers && i < round_blocks; i++) {
+    free(ctx.buffers[i]);
+  }
+  free(ctx.buffers);
+  free(ctx.lengths);
+  free(clusters);
+  return ok;
+}
+
+// BENCHMARKS
+// One-shot phases (parse, builds) report their single run; query benchmarks time every call
+// and report percentiles over all of them.
+static void FinishLatencies(BenchResult *result, double *samples, long count) {
+  result->ops = count;
+  result->total_s = 0.0;
+  for (long i = 0; i < count; i++) {
+    result->total_s += samples[i];
+  }
+
+  if (count > 0) {
+    qsort(samples, count, sizeof(double), CompareDoubles);
+    result->p50_us = samples[count / 2] * 1e6;
+    result->p99_us = samples[(long)(count * 0.99)] * 1e6;
+  }
+  result->peak_rss_kb = PeakRssKb();
+}
+
+static void FinishOneShot(BenchResult *result, double seconds, long items) {
+  result->ops = items;
+  result->total_s = seconds;
+  result->p50_us = seconds * 1e6;
+  result->p99_us = seconds * 1e6;
+  result->peak_rss_kb = PeakRssKb();
+}
+
+static void PrintResult(const BenchResult *result, int last) {
+  double throughput = result->total_s > 0.0 ? result->ops / result->total_s : 0.0;
+  printf("    {\"name\": \"%s\", \"ops\": %ld, \"total_s\": %.6f, \"throughput_per_s\": %.1f, "
+         "\"p50_us\": %.3f, \"p99_us\": %.3f, \"peak_rss_kb\": %ld",
+         result->name, result->ops, result->total_s, throughput, result->p50_us, result->p99_us,
+         result->peak_rss_kb);
+  if (result->extra_name != NULL) {
+    printf(", \"%s\": %ld", result->extra_name, result->extra);
+  }
+  printf("}%s\n", last ? "" : ",");
+}
+
+static Position RandomQueryPosition(unsigned long *state, const StarArray *array) {
+  // Jitter around a random star, so queries land where the catalog actually is
+  const Position *star = array->stars[NextRandom(state) % array->size].position;
+  Position p = {star->x + RandomGaussian(state) * 5.0, star->y + RandomGaussian(state) * 5.0,
+                star->z + RandomGaussian(state) * 5.0};
+  return p;
+}
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [-n stars] [-c] [-s seed] [-q queries] [-r range queries] [-p routes]\n"
+          "          [-j jump range] [-i existing.csv] [-o generated.csv] [-k] [-e epsilon]\n"
+          "  -n  stars to generate (default 1000000)\n"
+          "  -c  clustered distribution instead of uniform\n"
+          "  -i  benchmark an existing catalog instead of generating one\n"
+          "  -k  keep the generated catalog\n"
+          "  -e  error bound for approximate nearest-neighbour queries (default 0.5)\n",
+          program);
+}
+
+int main(int argc, char **argv) {
+  BenchOptions options = {1000000, 0, 42, 100000, 10000, 100, DEFAULT_JUMP_RANGE, NULL, "bench_stars.csv", 0, 0.5};
+
+  int option;
+  while ((option = getopt(argc, argv, "n:cs:q:r:p:j:i:o:ke:h")) != -1) {
+    switch (option) {
+      case 'n': options.stars = atol(optarg); break;
+      case 'c': options.clustered = 1; break;
+      case 's': options.seed = strtoul(optarg, NULL, 10); break;
+      case 'q': options.queries = atoi(optarg); break;
+      case 'r': options.range_queries = atoi(optarg); break;
+      case 'p': options.routes = atoi(optarg); break;
+      case 'j': options.jump_range = atof(optarg); break;
+      case 'i': options.input_path = optarg; break;
+      case 'o': options.output_path = optarg; break;
+      case 'k': options.keep_catalog = 1; break;
+      case 'e': options.epsilon = atof(optarg); break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+  if (options.stars < 1 || options.stars > 2000000000L || options.queries < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  double generate_s = 0.0;
+  const char *catalog_path = options.input_path;
+  if (catalog_path == NULL) {
+    fprintf(stderr, "Generating %ld %s stars into %s\n", options.stars, options.clustered ? "clustered" : "uniform",
+            options.output_path);
+    double start = Now();
+    if (!GenerateCatalog(&options)) {
+      return 1;
+    }
+    generate_s = Now() - start;
+    catalog_path = options.output_path;
+  }
+
+  BenchResult results[16];
+  int result_count = 0;
+  memset(results, 0, sizeof(results));
+  for (int i = 0; i < 16; i++) {
+    results[i].extra = -1;
+  }
+
+  // Build phases
+  fprintf(stderr, "Parsing %s\n", catalog_path);
+  double start = Now();
+  StarArray *array = ParseFile(catalog_path);
+  double elapsed = Now() - start;
+  if (array == NULL || array->size == 0) {
+    fprintf(stderr, "ERROR [main()]: CATALOG IS EMPTY OR UNREADABLE!\n");
+    return 1;
+  }
+  results[result_count].name = "ParseFile";
+  FinishOneShot(&results[result_count++], elapsed, array->size);
+
+  start = Now();
+  KDTree *tree = CreateBalancedKDTree(array, KD_DEFAULT_LEAF_SIZE);
+  elapsed = Now() - start;
+  results[result_count].name = "CreateBalancedKDTree";
+  FinishOneShot(&results[result_count++], elapsed, array->size);
+
+  start = Now();
+  HashMap *map = CreateHashMap(array, array->size);
+  elapsed = Now() - start;
+  results[result_count].name = "CreateHashMap";
+  FinishOneShot(&results[result_count++], elapsed, array->size);
+
+  // The three stages above, overlapped
+  KDTree *loaded_tree;
+  HashMap *loaded_map;
+  start = Now();
+  StarArray *loaded = LoadStarCatalog(catalog_path, KD_DEFAULT_LEAF_SIZE, &loaded_tree, &loaded_map);
+  elapsed = Now() - start;
+  results[result_count].name = "LoadStarCatalog";
+  FinishOneShot(&results[result_count++], elapsed, loaded ? loaded->size : 0);
+  DeallocHashMap(loaded_map);
+  DeallocKDTree(loaded_tree);
+  DeallocMainStarArray(loaded);
+
+  // Radius sized for about 50 hits at the generator's background density; the grid's cells match it
+  float radius = (float)cbrt(3.0 * 50.0 / (4.0 * PI * BENCH_STAR_DENSITY));
+  start = Now();
+  StarGrid *grid = CreateStarGrid(array, radius);
+  elapsed = Now() - start;
+  results[result_count].name = "CreateStarGrid";
+  results[result_count].extra = grid ? grid->cell_count : 0;
+  results[result_count].extra_name = "cells";
+  FinishOneShot(&results[result_count++], elapsed, array->size);
+
+  if (tree == NULL || map == NULL || grid == NULL) {
+    return 1;
+  }
+
+  long sample_count = options.queries;
+  if (options.range_queries > sample_count) {
+    sample_count = options.range_queries;
+  }
+  if (options.routes > sample_count) {
+    sample_count = options.routes;
+  }
+  double *samples = malloc(sample_count * sizeof(double));
+  Position *queries = malloc(options.queries * sizeof(Position));
+  int *centers = malloc((options.range_queries > 0 ? options.range_queries : 1) * sizeof(int));
+  if (samples == NULL || queries == NULL || centers == NULL) {
+    fprintf(stderr, "ERROR [main()]: MEMORY ALLOCATION FAILED FOR SAMPLES!\n");
+    return 1;
+  }
+
+  // Both spatial backends answer the same queries
+  unsigned long state = options.seed * 31 + 7;
+  for (int i = 0; i < options.queries; i++) {
+    queries[i] = RandomQueryPosition(&state, array);
+  }
+  for (int i = 0; i < options.range_queries; i++) {
+    centers[i] = NextRandom(&state) % array->size;
+  }
+
+  // Query phases
+  fprintf(stderr, "Running queries\n");
+  long checksum = 0;
+  for (int i = 0; i < options.queries; i++) {
+    double t = Now();
+    Star *nearest = NearestNeighbor(tree, queries[i]);
+    samples[i] = Now() - t;
+    checksum += nearest - array->stars;
+  }
+  results[result_count].name = "NearestNeighbor";
+  FinishLatencies(&results[result_count++], samples, options.queries);
+
+  long exact = 0;
+  for (int i = 0; i < options.queries; i++) {
+    double t = Now();
+    Star *nearest = ApproxNearestNeighbor(tree, queries[i], options.epsilon, 0);
+    samples[i] = Now() - t;
+    exact += CalculateDistance(nearest, queries[i]) <= CalculateDistance(NearestNeighbor(tree, queries[i]), queries[i]);
+  }
+  results[result_count].name = "ApproxNearestNeighbor";
+  results[result_count].extra = exact;
+  results[result_count].extra_name = "exact";
+  FinishLatencies(&results[result_count++], samples, options.queries);
+
+  for (int i = 0; i < options.queries; i++) {
+    double t = Now();
+    Star *nearest = GridNearestNeighbor(grid, queries[i]);
+    samples[i] = Now() - t;
+    checksum += nearest - array->stars;
+  }
+  results[result_count].name = "GridNearestNeighbor";
+  FinishLatencies(&results[result_count++], samples, options.queries);
+
+  long hits = 0;
+  for (int i = 0; i < options.range_queries; i++) {
+    Star *center = &array->stars[centers[i]];
+    double t = Now();
+    StarArray *range = StarSearchRange(tree, center, radius);
+    samples[i] = Now() - t;
+    hits += range ? range->size : 0;
+    DeallocSubStarArray(range);
+  }
+  results[result_count].name = "StarSearchRange";
+  results[result_count].extra = hits;
+  results[result_count].extra_name = "hits";
+  FinishLatencies(&results[result_count++], samples, options.range_queries);
+
+  // The same counts without building the result arrays
+  hits = 0;
+  for (int i = 0; i < options.range_queries; i++) {
+    double t = Now();
+    hits += CountStarsInRadius(tree, *array->stars[centers[i]].position, radius);
+    samples[i] = Now() - t;
+  }
+  results[result_count].name = "CountStarsInRadius";
+  results[result_count].extra = hits;
+  results[result_count].extra_name = "hits";
+  FinishLatencies(&results[result_count++], samples, options.range_queries);
+
+  hits = 0;
+  for (int i = 0; i < options.range_queries; i++) {
+    Star *center = &array->stars[centers[i]];
+    double t = Now();
+    StarArray *range = GridSearchRange(grid, center, radius);
+    samples[i] = Now() - t;
+    hits += range ? range->size : 0;
+    DeallocSubStarArray(range);
+  }
+  results[result_count].name = "GridSearchRange";
+  results[result_count].extra = hits;
+  results[result_count].extra_name = "hits";
+  FinishLatencies(&results[result_count++], samples, options.range_queries);
+
+  // The same queries answered out of a query context's arena
+  QueryContext *context = CreateQueryContext(tree, map, *array->stars[0].position);
+  hits = 0;
+  for (int i = 0; context != NULL && i < options.range_queries; i++) {
+    SetQueryOrigin(context, *array->stars[centers[i]].position);
+    double t = Now();
+    StarArray *range = QueryRangeStars(context, radius);
+    samples[i] = Now() - t;
+    hits += range ? range->size : 0;
+  }
+  results[result_count].name = "QueryRangeStars";
+  results[result_count].extra = hits;
+  results[result_count].extra_name = "hits";
+  FinishLatencies(&results[result_count++], samples, options.range_queries);
+
+  // Half hits, half misses
+  char missing[32];
+  for (int i = 0; i < options.queries; i++) {
+    const char *key = missing;
+    if (i & 1) {
+      snprintf(missing, sizeof(missing), "No Star %d", i);
+    } else {
+      key = array->stars[NextRandom(&state) % array->size].name;
+    }
+    double t = Now();
+    Star *found = GetFromHashMap(map, key);
+    samples[i] = Now() - t;
+    checksum += found != NULL;
+  }
+  results[result_count].name = "GetFromHashMap";
+  FinishLatencies(&results[result_count++], samples, options.queries);
+
+  // Routes to a star a few hundred neighbours away, so every query is local but non-trivial
+  int neighbor_ids[256];
+  long routes_found = 0;
+  for (int i = 0; context != NULL && i < options.routes; i++) {
+    Star *origin = &array->stars[NextRandom(&state) % array->size];
+    int found = KNearestNeighborIds(tree, *origin->position, 256, neighbor_ids, NULL);
+    const char *destination = array->stars[neighbor_ids[found - 1]].name;
+    SetQueryOrigin(context, *origin->position);
+    double t = Now();
+    routes_found += QueryRoute(context, destination, options.jump_range);
+    samples[i] = Now() - t;
+  }
+  results[result_count].name = "QueryRoute";
+  results[result_count].extra = routes_found;
+  results[result_count].extra_name = "routes_found";
+  FinishLatencies(&results[result_count++], samples, options.routes);
+
+  // Every pair of stars one jump apart
+  StarPairBuffer pairs;
+  InitStarPairBuffer(&pairs);
+  start = Now();
+  long pair_count = SelfJoinPairs(tree, options.jump_range, &pairs);
+  elapsed = Now() - start;
+  results[result_count].name = "SelfJoinPairs";
+  results[result_count].extra = pair_count;
+  results[result_count].extra_name = "pairs";
+  FinishOneShot(&results[result_count++], elapsed, array->size);
+  DeallocStarPairBuffer(&pairs);
+
+  printf("{\n");
+  printf("  \"catalog\": {\"path\": \"%s\", \"stars\": %d, \"generated\": %s, \"distribution\": \"%s\", "
+         "\"seed\": %lu, \"generate_s\": %.3f},\n",
+         catalog_path, array->size, options.input_path ? "false" : "true",
+         options.input_path ? "file" : (options.clustered ? "clustered" : "uniform"), options.seed, generate_s);
+  printf("  \"threads\": %d,\n", GetThreadCount());
+  printf("  \"jump_range\": %.3f,\n", options.jump_range);
+  printf("  \"checksum\": %ld,\n", checksum);
+  printf("  \"results\": [\n");
+  for (int i = 0; i < result_count; i++) {
+    PrintResult(&results[i], i == result_count - 1);
+  }
+  printf("  ]\n}\n");
+
+  free(samples);
+  free(queries);
+  free(centers);
+  DeallocQueryContext(context);
+  DeallocStarGrid(grid);
+  DeallocHashMap(map);
+  DeallocKDTree(tree);
+  DeallocMainStarArray(array);
+  if (options.input_path == NULL && !options.keep_catalog) {
+    remove(options.output_path);
+  }
+
+  return 0;
+}
@@ -0,0 +1,520 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "star_chart_utils.h"
+#include "star_chart_server.h"
+
+// Client for the resident query server (star_chart --serve). Sends one query and prints the
+// answer, or with 'load' drives the server from several connections with pipelined requests
+// and reports throughput and latency. See usage() for the commands.
+
+#define LOAD_MAX_SAMPLE 65536 // Catalog stars the load generator draws positions and names from
+
+typedef struct LoadOptions {
+  const char *socket_path;
+  int connections;
+  long requests;         // Across all connections
+  int depth;             // Requests in flight per connection
+  const char *input_path;
+  unsigned long seed;
+} LoadOptions;
+
+// Positions and names sampled from the catalog, shared read-only by the load threads
+typedef struct LoadSample {
+  Position *positions;
+  char **names;
+  int count;
+} LoadSample;
+
+#define LOAD_TYPES 4 // nearest, radius, lookup, route
+
+typedef struct LoadThread {
+  const LoadOptions *options;
+  const LoadSample *sample;
+  pthread_t thread;
+  long requests;
+  unsigned long seed;
+  // Filled in by the thread
+  double *latency_us[LOAD_TYPES];  // End to end
+  double *server_us[LOAD_TYPES];   // As reported by the server
+  long answered[LOAD_TYPES];
+  long not_found;
+  long failed;
+  double batch_size_total;
+} LoadThread;
+
+static double Now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// splitmix64, as in star_chart_bench.c
+static unsigned long NextRandom(unsigned long *state) {
+  unsigned long z = (*state += 0x9e3779b97f4a7c15UL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+  return z ^ (z >> 31);
+}
+
+static double RandomUnit(unsigned long *state) {
+  return (NextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static const char *QueryTypeName(int type) {
+  switch (type) {
+    case QUERY_NEAREST: return "nearest";
+    case QUERY_RADIUS: return "radius";
+    case QUERY_LOOKUP: return "lookup";
+    case QUERY_ROUTE: return "route";
+    case QUERY_SHUTDOWN: return "shutdown";
+    default: return "unknown";
+  }
+}
+
+static const char *QueryStatusName(int status) {
+  switch (status) {
+    case QUERY_OK: return "ok";
+    case QUERY_NOT_FOUND: return "not found";
+    case QUERY_BAD_REQUEST: return "bad request";
+    case QUERY_FAILED: return "failed";
+    default: return "unknown";
+  }
+}
+
+static int ConnectToServer(const char *path) {
+  struct sockaddr_un address = {0};
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "ERROR [ConnectToServer()]: SOCKET PATH TOO LONG!\n");
+    return -1;
+  }
+  strcpy(address.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+    fprintf(stderr, "ERROR [ConnectToServer()]: COULD NOT CONNECT TO %s!\n", path);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+  return fd;
+}
+
+static QueryRequest MakeRequest(uint32_t id, QueryType type, const Position *position, double radius, const char *name) {
+  QueryRequest request = {0};
+  request.id = id;
+  request.type = (uint16_t)type;
+  request.name_length = name ? (uint16_t)strlen(name) : 0;
+  request.version = SERVER_PROTOCOL_VERSION;
+  if (position != NULL) {
+    request.position[0] = position->x;
+    request.position[1] = position->y;
+    request.position[2] = position->z;
+  }
+  request.radius = radius;
+  return request;
+}
+
+// Appends a request frame (header plus name) to buffer at *size; buffer must have room
+static void EncodeRequest(char *buffer, size_t *size, const QueryRequest *request, const char *name) {
+  memcpy(buffer + *size, request, sizeof(QueryRequest));
+  *size += sizeof(QueryRequest);
+  if (request->name_length > 0) {
+    memcpy(buffer + *size, name, request->name_length);
+    *size += request->name_length;
+  }
+}
+
+// Reads one response; the records and names land in *body (grown as needed). Returns 0 when
+// the connection fails.
+static int ReadResponse(int fd, QueryResponse *response, char **body, size_t *body_capacity) {
+  if (!ReceiveAll(fd, response, sizeof(QueryResponse))) {
+    return 0;
+  }
+  size_t bytes = response->count * sizeof(QueryResultStar) + response->names_bytes;
+  if (bytes > *body_capacity) {
+    char *grown = realloc(*body, bytes);
+    if (grown == NULL) {
+      fprintf(stderr, "ERROR [ReadResponse()]: MEMORY ALLOCATION FAILED FOR RESPONSE!\n");
+      return 0;
+    }
+    *body = grown;
+    *body_capacity = bytes;
+  }
+  return bytes == 0 || ReceiveAll(fd, *body, bytes);
+}
+
+static void PrintResponse(const QueryResponse *response, const char *body) {
+  printf("%s: %s, %u of %u results, %.1f us on the server\n", QueryTypeName(response->type),
+         QueryStatusName(response->status), response->count, response->total, response->latency_ns / 1000.0);
+
+  const char *names = body + response->count * sizeof(QueryResultStar);
+  for (uint32_t i = 0; i < response->count; i++) {
+    QueryResultStar record;
+    memcpy(&record, body + i * sizeof(QueryResultStar), sizeof(record));
+    printf("  %-24s (%.2f, %.2f, %.2f)  %.2f ly\n", names + record.name_offset, record.position[0],
+           record.position[1], record.position[2], record.distance);
+  }
+}
+
+// Sends a single request and prints its response; returns 0 on success
+static int RunSingleQuery(const char *socket_path, const QueryRequest *request, const char *name) {
+  int fd = ConnectToServer(socket_path);
+  if (fd < 0) {
+    return 1;
+  }
+
+  char *frame = malloc(sizeof(QueryRequest) + request->name_length);
+  size_t size = 0;
+  char *body = NULL;
+  size_t body_capacity = 0;
+  QueryResponse response;
+  int status = 1;
+  if (frame != NULL) {
+    EncodeRequest(frame, &size, request, name);
+    if (SendAll(fd, frame, size) && ReadResponse(fd, &response, &body, &body_capacity)) {
+      PrintResponse(&response, body);
+      status = (response.status == QUERY_OK) ? 0 : 1;
+    } else {
+      fprintf(stderr, "ERROR [RunSingleQuery()]: NO RESPONSE FROM SERVER!\n");
+    }
+  }
+
+  free(frame);
+  free(body);
+  close(fd);
+  return status;
+}
+
+// LOAD GENERATOR
+// Every connection keeps up to 'depth' requests in flight: it tops the window up with one
+// write, then reads one response at a time. The mix is about half nearest-star queries, 30%
+// radius queries, 15% name lookups and 5% short routes, all around sampled catalog stars.
+static int LoadSampleCatalog(const char *path, unsigned long seed, LoadSample *sample) {
+  StarArray *array = ParseFile(path);
+  if (array == NULL || array->size == 0) {
+    fprintf(stderr, "ERROR [LoadSampleCatalog()]: NO STARS IN %s!\n", path);
+    DeallocMainStarArray(array);
+    return 0;
+  }
+
+  int count = (array->size < LOAD_MAX_SAMPLE) ? array->size : LOAD_MAX_SAMPLE;
+  sample->positions = malloc(count * sizeof(Position));
+  sample->names = calloc(count, sizeof(char *));
+  sample->count = count;
+  if (sample->positions == NULL || sample->names == NULL) {
+    fprintf(stderr, "ERROR [LoadSampleCatalog()]: MEMORY ALLOCATION FAILED FOR SAMPLE!\n");
+    DeallocMainStarArray(array);
+    return 0;
+  }
+
+  for (int i = 0; i < count; i++) {
+    Star *star = &array->stars[NextRandom(&seed) % array->size];
+    sample->positions[i] = *star->position;
+    sample->names[i] = strdup(star->name);
+    if (sample->names[i] == NULL || strlen(star->name) > SERVER_MAX_NAME) {
+      fprintf(stderr, "ERROR [LoadSampleCatalog()]: COULD NOT COPY STAR NAME!\n");
+      DeallocMainStarArray(array);
+      return 0;
+    }
+  }
+
+  DeallocMainStarArray(array);
+  return 1;
+}
+
+static void DeallocLoadSample(LoadSample *sample) {
+  for (int i = 0; sample->names != NULL && i < sample->count; i++) {
+    free(sample->names[i]);
+  }
+  free(sample->names);
+  free(sample->positions);
+}
+
+static QueryType RandomQueryType(unsigned long *state) {
+  double pick = RandomUnit(state);
+  if (pick < 0.50) {
+    return QUERY_NEAREST;
+  }
+  if (pick < 0.80) {
+    return QUERY_RADIUS;
+  }
+  return (pick < 0.95) ? QUERY_LOOKUP : QUERY_ROUTE;
+}
+
+static void *LoadWorker(void *arg) {
+  LoadThread *thread = arg;
+  const LoadSample *sample = thread->sample;
+  int depth = thread->options->depth;
+  unsigned long seed = thread->seed;
+
+  int fd = ConnectToServer(thread->options->socket_path);
+  double *sent_at = malloc(depth * sizeof(double));
+  char *frames = malloc(depth * (sizeof(QueryRequest) + SERVER_MAX_NAME));
+  for (int type = 0; type < LOAD_TYPES; type++) {
+    thread->latency_us[type] = malloc(thread->requests * sizeof(double));
+    thread->server_us[type] = malloc(thread->requests * sizeof(double));
+  }
+  char *body = NULL;
+  size_t body_capacity = 0;
+
+  int ready = fd >= 0 && sent_at != NULL && frames != NULL;
+  for (int type = 0; type < LOAD_TYPES; type++) {
+    ready = ready && thread->latency_us[type] != NULL && thread->server_us[type] != NULL;
+  }
+
+  // Request ids are sequence numbers, so id % depth is the request's slot in the window
+  long sent = 0;
+  long received = 0;
+  while (ready && received < thread->requests) {
+    size_t size = 0;
+    while (sent < thread->requests && sent - received < depth) {
+      int index = (int)(NextRandom(&seed) % sample->count);
+      Position position = sample->positions[index];
+      QueryType type = RandomQueryType(&seed);
+      QueryRequest request;
+      const char *name = NULL;
+
+      if (type == QUERY_NEAREST || type == QUERY_ROUTE) {
+        // Near a catalog star, not on it; routes start up to ~30 ly from their destination
+        double spread = (type == QUERY_NEAREST) ? 5.0 : 30.0;
+        position.x += (RandomUnit(&seed) * 2.0 - 1.0) * spread;
+        position.y += (RandomUnit(&seed) * 2.0 - 1.0) * spread;
+        position.z += (RandomUnit(&seed) * 2.0 - 1.0) * spread;
+      }
+      if (type == QUERY_LOOKUP || type == QUERY_ROUTE) {
+        name = sample->names[index];
+      }
+
+      double radius = (type == QUERY_RADIUS) ? 5.0 + RandomUnit(&seed) * 15.0 : 0.0;
+      request = MakeRequest((uint32_t)sent, type, &position, radius, name);
+      EncodeRequest(frames, &size, &request, name);
+      sent_at[sent % depth] = Now();
+      sent++;
+    }
+    if (size > 0 && !SendAll(fd, frames, size)) {
+      fprintf(stderr, "ERROR [LoadWorker()]: SEND FAILED!\n");
+      break;
+    }
+
+    QueryResponse response;
+    if (!ReadResponse(fd, &response, &body, &body_capacity)) {
+      fprintf(stderr, "ERROR [LoadWorker()]: CONNECTION LOST!\n");
+      break;
+    }
+    int type = response.type - QUERY_NEAREST;
+    if (type >= 0 && type < LOAD_TYPES) {
+      long slot = thread->answered[type]++;
+      thread->latency_us[type][slot] = (Now() - sent_at[response.id % depth]) * 1e6;
+      thread->server_us[type][slot] = response.latency_ns / 1000.0;
+    }
+    thread->not_found += (response.status == QUERY_NOT_FOUND);
+    thread->failed += (response.status == QUERY_BAD_REQUEST || response.status == QUERY_FAILED);
+    thread->batch_size_total += response.batch_size;
+    received++;
+  }
+
+  if (fd >= 0) {
+    close(fd);
+  }
+  free(body);
+  free(frames);
+  free(sent_at);
+  return NULL;
+}
+
+static int CompareDoubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static double Percentile(const double *sorted, long count, double fraction) {
+  if (count == 0) {
+    return 0.0;
+  }
+  long index = (long)(fraction * (count - 1) + 0.5);
+  return sorted[index];
+}
+
+// Gathers one query type's latencies from every thread into a sorted array
+static long CollectLatencies(LoadThread *threads, int thread_count, int type, int server_side, double *out) {
+  long count = 0;
+  for (int i = 0; i < thread_count; i++) {
+    const double *values = server_side ? threads[i].server_us[type] : threads[i].latency_us[type];
+    if (values != NULL && threads[i].answered[type] > 0) {
+      memcpy(out + count, values, threads[i].answered[type] * sizeof(double));
+      count += threads[i].answered[type];
+    }
+  }
+  qsort(out, count, sizeof(double), CompareDoubles);
+  return count;
+}
+
+static int RunLoad(const LoadOptions *options) {
+  LoadSample sample = {0};
+  if (!LoadSampleCatalog(options->input_path, options->seed, &sample)) {
+    DeallocLoadSample(&sample);
+    return 1;
+  }
+
+  LoadThread *threads = calloc(options->connections, sizeof(LoadThread));
+  double *latencies = malloc((options->requests + 1) * sizeof(double));
+  if (threads == NULL || latencies == NULL) {
+    fprintf(stderr, "ERROR [RunLoad()]: MEMORY ALLOCATION FAILED FOR LOAD THREADS!\n");
+    free(threads);
+    free(latencies);
+    DeallocLoadSample(&sample);
+    return 1;
+  }
+
+  double start = Now();
+  int started = 0;
+  for (int i = 0; i < options->connections; i++) {
+    threads[i].options = options;
+    threads[i].sample = &sample;
+    threads[i].requests = options->requests / options->connections + (i < options->requests % options->connections);
+    threads[i].seed = options->seed + 0x632be59bd9b4e019UL * (i + 1);
+    if (pthread_create(&threads[i].thread, NULL, LoadWorker, &threads[i]) != 0) {
+      break;
+    }
+    started++;
+  }
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i].thread, NULL);
+  }
+  double elapsed = Now() - start;
+
+  long answered = 0;
+  long not_found = 0;
+  long failed = 0;
+  double batch_size_total = 0.0;
+  for (int i = 0; i < started; i++) {
+    for (int type = 0; type < LOAD_TYPES; type++) {
+      answered += threads[i].answered[type];
+    }
+    not_found += threads[i].not_found;
+    failed += threads[i].failed;
+    batch_size_total += threads[i].batch_size_total;
+  }
+
+  printf("%ld of %ld requests answered over %d connections (depth %d) in %.2f s: %.0f requests/s\n", answered,
+         options->requests, started, options->depth, elapsed, answered / elapsed);
+  printf("%ld not found, %ld failed, mean server batch %.1f requests\n", not_found, failed,
+         answered ? batch_size_total / answered : 0.0);
+  printf("%-8s %9s %12s %12s %12s %12s\n", "type", "count", "p50 us", "p99 us", "server p50", "server p99");
+  for (int type = 0; type < LOAD_TYPES; type++) {
+    long count = CollectLatencies(threads, started, type, 0, latencies);
+    double p50 = Percentile(latencies, count, 0.50);
+    double p99 = Percentile(latencies, count, 0.99);
+    CollectLatencies(threads, started, type, 1, latencies);
+    printf("%-8s %9ld %12.1f %12.1f %12.1f %12.1f\n", QueryTypeName(type + QUERY_NEAREST), count, p50, p99,
+           Percentile(latencies, count, 0.50), Percentile(latencies, count, 0.99));
+  }
+
+  for (int i = 0; i < options->connections; i++) {
+    for (int type = 0; type < LOAD_TYPES; type++) {
+      free(threads[i].latency_us[type]);
+      free(threads[i].server_us[type]);
+    }
+  }
+  free(threads);
+  free(latencies);
+  DeallocLoadSample(&sample);
+  return (answered == options->requests) ? 0 : 1;
+}
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [-s socket] command\n"
+          "  nearest X Y Z             Nearest star to a position\n"
+          "  radius X Y Z R [LIMIT]    Stars within R light years, nearest first\n"
+          "  lookup NAME               Star by name\n"
+          "  route X Y Z NAME [JUMP]   Route from the star nearest X Y Z to NAME\n"
+          "  shutdown                  Stop the server\n"
+          "  load [options]            Drive the server and report latency:\n"
+          "    -c CONNECTIONS  Concurrent connections (default 4)\n"
+          "    -n REQUESTS     Requests across all connections (default 100000)\n"
+          "    -d DEPTH        Requests in flight per connection (default 32)\n"
+          "    -i PATH         Catalog to sample positions and names from (default stars.csv)\n"
+          "    -s SEED         Random seed (default 1)\n",
+          program);
+}
+
+int main(int argc, char **argv) {
+  const char *socket_path = SERVER_DEFAULT_SOCKET;
+  int option;
+  while ((option = getopt(argc, argv, "+s:h")) != -1) {
+    switch (option) {
+      case 's': socket_path = optarg; break;
+      default: usage(argv[0]); return (option == 'h') ? 0 : 1;
+    }
+  }
+  if (optind >= argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  const char *command = argv[optind];
+  char **args = argv + optind + 1;
+  int arg_count = argc - optind - 1;
+  Position position = {0.0, 0.0, 0.0};
+  if (arg_count >= 3) {
+    position.x = atof(args[0]);
+    position.y = atof(args[1]);
+    position.z = atof(args[2]);
+  }
+
+  if (strcmp(command, "nearest") == 0 && arg_count == 3) {
+    QueryRequest request = MakeRequest(1, QUERY_NEAREST, &position, 0.0, NULL);
+    return RunSingleQuery(socket_path, &request, NULL);
+  }
+  if (strcmp(command, "radius") == 0 && (arg_count == 4 || arg_count == 5)) {
+    QueryRequest request = MakeRequest(1, QUERY_RADIUS, &position, atof(args[3]), NULL);
+    request.limit = (arg_count == 5) ? (uint32_t)atol(args[4]) : 0;
+    return RunSingleQuery(socket_path, &request, NULL);
+  }
+  if (strcmp(command, "lookup") == 0 && arg_count == 1 && strlen(args[0]) <= SERVER_MAX_NAME) {
+    QueryRequest request = MakeRequest(1, QUERY_LOOKUP, NULL, 0.0, args[0]);
+    return RunSingleQuery(socket_path, &request, args[0]);
+  }
+  if (strcmp(command, "route") == 0 && (arg_count == 4 || arg_count == 5) && strlen(args[3]) <= SERVER_MAX_NAME) {
+    double jump = (arg_count == 5) ? atof(args[4]) : 0.0;
+    QueryRequest request = MakeRequest(1, QUERY_ROUTE, &position, jump, args[3]);
+    return RunSingleQuery(socket_path, &request, args[3]);
+  }
+  if (strcmp(command, "shutdown") == 0 && arg_count == 0) {
+    QueryRequest request = MakeRequest(1, QUERY_SHUTDOWN, NULL, 0.0, NULL);
+    return RunSingleQuery(socket_path, &request, NULL);
+  }
+  if (strcmp(command, "load") == 0) {
+    LoadOptions options = {socket_path, 4, 100000, 32, "stars.csv", 1};
+    optind = 1; // The command itself stands in for argv[0]
+    while ((option = getopt(arg_count + 1, args - 1, "c:n:d:i:s:")) != -1) {
+      switch (option) {
+        case 'c': options.connections = atoi(optarg); break;
+        case 'n': options.requests = atol(optarg); break;
+        case 'd': options.depth = atoi(optarg); break;
+        case 'i': options.input_path = optarg; break;
+        case 's': options.seed = strtoul(optarg, NULL, 10); break;
+        default: usage(argv[0]); return 1;
+      }
+    }
+    if (options.connections < 1 || options.requests < 1 || options.depth < 1) {
+      usage(argv[0]);
+      return 1;
+    }
+    return RunLoad(&options);
+  }
+
+  usage(argv[0]);
+  return 1;
+}
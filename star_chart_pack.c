@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "star_chart_utils.h"
+#include "star_chart_snapshot.h"
+
+// Converts a star catalog .csv into a binary snapshot that star_chart can mmap at startup
+// usage: star_chart_pack [stars.csv] [stars.snap] [leaf size]
+int main(int argc, char **argv) {
+    const char *csv_path = (argc > 1) ? argv[1] : "stars.csv";
+    const char *snapshot_path = (argc > 2) ? argv[2] : "stars.snap";
+    int leaf_size = (argc > 3) ? atoi(argv[3]) : KD_DEFAULT_LEAF_SIZE;
+
+    KDTree *kd_tree;
+    HashMap *star_hash_map;
+    StarArray *star_array = LoadStarCatalog(csv_path, leaf_size, &kd_tree, &star_hash_map);
+    if (star_array == NULL) {
+        return 1;
+    }
+
+    int written = WriteSnapshot(snapshot_path, star_array, kd_tree, star_hash_map);
+    if (written) {
+        printf("Wrote %d stars to %s\n", star_array->size, snapshot_path);
+    }
+
+    DeallocHashMap(star_hash_map);
+    DeallocKDTree(kd_tree);
+    DeallocMainStarArray(star_array);
+
+    return written ? 0 : 1;
+}
@@ -0,0 +1,783 @@
+#include "star_chart_server.h"
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SERVER_JOB_SIZE 32         // Requests per worker job; small enough that NearestNeighborBatch() stays on one thread
+#define SERVER_POLL_MS 200         // How often idle threads look for a shutdown
+#define SERVER_READ_SIZE 65536
+#define SERVER_LATENCY_STEPS 8     // Histogram buckets per doubling of latency
+#define SERVER_LATENCY_BUCKETS (64 * SERVER_LATENCY_STEPS)
+
+static volatile sig_atomic_t stop_signal = 0;
+
+static void HandleStopSignal(int signal_number) {
+  (void)signal_number;
+  stop_signal = 1;
+}
+
+static uint64_t NowNanoseconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+int SendAll(int fd, const void *data, size_t bytes) {
+  const char *cursor = data;
+  while (bytes > 0) {
+    ssize_t sent = send(fd, cursor, bytes, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      return 0;
+    }
+    cursor += sent;
+    bytes -= (size_t)sent;
+  }
+  return 1;
+}
+
+int ReceiveAll(int fd, void *data, size_t bytes) {
+  char *cursor = data;
+  while (bytes > 0) {
+    ssize_t received = recv(fd, cursor, bytes, 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      return 0;
+    }
+    cursor += received;
+    bytes -= (size_t)received;
+  }
+  return 1;
+}
+
+// BYTE BUFFERS
+// Growable byte arrays for socket input and encoded responses; kept per connection and per
+// job between batches so a warmed-up server does not allocate per request.
+typedef struct ByteBuffer {
+  char *data;
+  size_t size;
+  size_t capacity;
+} ByteBuffer;
+
+static int ReserveBytes(ByteBuffer *buffer, size_t extra) {
+  if (buffer->size + extra <= buffer->capacity) {
+    return 1;
+  }
+
+  size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+  while (capacity < buffer->size + extra) {
+    capacity *= 2;
+  }
+
+  char *data = realloc(buffer->data, capacity);
+  if (data == NULL) {
+    fprintf(stderr, "ERROR [ReserveBytes()]: MEMORY ALLOCATION FAILED FOR SERVER BUFFER!\n");
+    return 0;
+  }
+  buffer->data = data;
+  buffer->capacity = capacity;
+  return 1;
+}
+
+// SERVER STATE
+// A batch is every complete request one read of a connection produced. It is cut into jobs of
+// SERVER_JOB_SIZE requests; the connection thread answers the first job itself and the worker
+// pool takes the rest. Each job encodes its responses into its own buffer, so writing the job
+// buffers back in order gives the responses in request order.
+typedef struct PendingRequest {
+  QueryRequest request;
+  const char *name; // Into the connection's input buffer; not NUL-terminated
+} PendingRequest;
+
+struct ServerBatch;
+
+typedef struct ServerJob {
+  struct ServerBatch *batch;
+  int begin;
+  int end;
+  ByteBuffer output;
+} ServerJob;
+
+typedef struct ServerBatch {
+  PendingRequest *requests;
+  int count;
+  int capacity;
+  ServerJob *jobs;
+  int job_count;
+  int job_capacity;
+  uint64_t start_ns;      // When the batch was read
+  int remaining_jobs;
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+} ServerBatch;
+
+typedef struct QueryServer {
+  KDTree *tree;
+  SpatialIndex *index;    // May be NULL
+  HashMap *names;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  ServerJob **queue;      // Jobs waiting for a worker, oldest at queue_head
+  int queue_head;
+  int queue_size;
+  int queue_capacity;
+  int stopping;           // Workers exit once the queue drains
+  int shutdown;           // Set by QUERY_SHUTDOWN; read atomically
+  int worker_count;       // Started workers; with none, connections answer whole batches alone
+  // Latency of every answered request, for the summary printed at shutdown
+  unsigned long latency_counts[SERVER_LATENCY_BUCKETS];
+  unsigned long requests;
+  unsigned long batches;
+  uint64_t latency_total_ns;
+  uint64_t latency_max_ns;
+} QueryServer;
+
+typedef struct ServerConnection {
+  QueryServer *server;
+  int fd;
+  pthread_t thread;
+  int finished;           // Set by the connection thread before it exits; read atomically
+} ServerConnection;
+
+static int ServerStopping(QueryServer *server) {
+  return stop_signal || __atomic_load_n(&server->shutdown, __ATOMIC_RELAXED);
+}
+
+static int LatencyBucket(uint64_t latency_ns) {
+  if (latency_ns < 1) {
+    return 0;
+  }
+  int bucket = (int)(log2((double)latency_ns) * SERVER_LATENCY_STEPS);
+  return (bucket < SERVER_LATENCY_BUCKETS) ? bucket : SERVER_LATENCY_BUCKETS - 1;
+}
+
+// Upper edge of the histogram bucket holding the given fraction of requests
+static double LatencyPercentile(const QueryServer *server, double fraction) {
+  unsigned long target = (unsigned long)ceil(server->requests * fraction);
+  unsigned long seen = 0;
+  for (int bucket = 0; bucket < SERVER_LATENCY_BUCKETS; bucket++) {
+    seen += server->latency_counts[bucket];
+    if (seen >= target && seen > 0) {
+      return exp2((bucket + 1) / (double)SERVER_LATENCY_STEPS);
+    }
+  }
+  return 0.0;
+}
+
+// REQUEST HANDLING
+// Appends one response frame: header, result records, then the names they point into
+static int AppendResponse(ByteBuffer *output, const QueryRequest *request, QueryStatus status, int total,
+                          const Star *const *stars, const double *distances, int count, KDTree *tree,
+                          uint64_t start_ns, int batch_size) {
+  size_t names_bytes = 0;
+  for (int i = 0; i < count; i++) {
+    names_bytes += strlen(stars[i]->name) + 1;
+  }
+
+  size_t frame_bytes = sizeof(QueryResponse) + count * sizeof(QueryResultStar) + names_bytes;
+  if (!ReserveBytes(output, frame_bytes)) {
+    return 0;
+  }
+
+  // Frames follow each other unpadded, so everything is copied in rather than written in place
+  char *frame = output->data + output->size;
+  char *records = frame + sizeof(QueryResponse);
+  char *names = records + count * sizeof(QueryResultStar);
+
+  uint32_t name_offset = 0;
+  for (int i = 0; i < count; i++) {
+    const Star *star = stars[i];
+    size_t length = strlen(star->name) + 1;
+    QueryResultStar record = {0};
+    record.star_id = (int32_t)(star - tree->stars);
+    record.lightyears = star->lightyears;
+    record.position[0] = star->position->x;
+    record.position[1] = star->position->y;
+    record.position[2] = star->position->z;
+    record.distance = distances[i];
+    record.name_offset = name_offset;
+    memcpy(records + i * sizeof(record), &record, sizeof(record));
+    memcpy(names + name_offset, star->name, length);
+    name_offset += (uint32_t)length;
+  }
+
+  QueryResponse header = {0};
+  header.id = request->id;
+  header.status = (uint16_t)status;
+  header.type = request->type;
+  header.count = (uint32_t)count;
+  header.total = (uint32_t)total;
+  header.names_bytes = (uint32_t)names_bytes;
+  header.batch_size = (uint32_t)batch_size;
+  header.latency_ns = NowNanoseconds() - start_ns;
+  memcpy(frame, &header, sizeof(header));
+
+  output->size += frame_bytes;
+  return 1;
+}
+
+static double PositionDistance(const Position *a, const Position *b) {
+  double dx = a->x - b->x;
+  double dy = a->y - b->y;
+  double dz = a->z - b->z;
+  return sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+static int RequestValid(const QueryRequest *request) {
+  return request->version == SERVER_PROTOCOL_VERSION && request->name_length <= SERVER_MAX_NAME;
+}
+
+// Answers requests [job->begin, job->end) of the job's batch into job->output. A NULL context
+// (the thread could not create one) answers every request with QUERY_FAILED.
+static void AnswerJob(QueryServer *server, QueryContext *context, ServerJob *job) {
+  ServerBatch *batch = job->batch;
+  KDTree *tree = server->tree;
+  int batch_size = batch->count;
+  job->output.size = 0;
+
+  // Nearest-star requests of the job go through the batched, Morton-ordered search together
+  Position nearest_positions[SERVER_JOB_SIZE];
+  int nearest_ids[SERVER_JOB_SIZE];
+  int nearest_count = 0;
+  for (int i = job->begin; i < job->end; i++) {
+    const QueryRequest *request = &batch->requests[i].request;
+    if (request->type == QUERY_NEAREST && RequestValid(request)) {
+      Position position = {request->position[0], request->position[1], request->position[2]};
+      nearest_positions[nearest_count++] = position;
+    }
+  }
+  int nearest_ok = (context != NULL) &&
+                   ((server->index != NULL) ? SpatialNearestBatch(server->index, nearest_positions, nearest_count, nearest_ids)
+                                            : NearestNeighborBatch(tree, nearest_positions, nearest_count, nearest_ids));
+  int nearest_next = 0;
+
+  char name[SERVER_MAX_NAME + 1];
+  for (int i = job->begin; i < job->end; i++) {
+    const PendingRequest *pending = &batch->requests[i];
+    const QueryRequest *request = &pending->request;
+    Position position = {request->position[0], request->position[1], request->position[2]};
+    QueryStatus status = QUERY_OK;
+    const Star *stars[1];
+    double distances[1];
+    int written = 1;
+
+    int valid = RequestValid(request);
+    if (valid && request->name_length > 0) {
+      memcpy(name, pending->name, request->name_length);
+    }
+    name[valid ? request->name_length : 0] = '\0';
+
+    if (!valid) {
+      status = QUERY_BAD_REQUEST;
+    } else if (context == NULL && request->type != QUERY_SHUTDOWN) {
+      status = QUERY_FAILED;
+    }
+
+    if (status != QUERY_OK) {
+      written = AppendResponse(&job->output, request, status, 0, NULL, NULL, 0, tree, batch->start_ns, batch_size);
+    } else if (request->type == QUERY_NEAREST) {
+      int id = nearest_ok ? nearest_ids[nearest_next] : -1;
+      nearest_next++;
+      if (!nearest_ok) {
+        status = QUERY_FAILED;
+      } else if (id < 0) {
+        status = QUERY_NOT_FOUND;
+      }
+      int count = (status == QUERY_OK) ? 1 : 0;
+      if (count) {
+        stars[0] = &tree->stars[id];
+        distances[0] = PositionDistance(stars[0]->position, &position);
+      }
+      written = AppendResponse(&job->output, request, status, count, stars, distances, count, tree, batch->start_ns, batch_size);
+    } else if (request->type == QUERY_RADIUS) {
+      if (!(request->radius >= 0.0)) {
+        written = AppendResponse(&job->output, request, QUERY_BAD_REQUEST, 0, NULL, NULL, 0, tree, batch->start_ns, batch_size);
+      } else {
+        int limit = request->limit ? (int)request->limit : SERVER_DEFAULT_LIMIT;
+        limit = (limit < SERVER_MAX_LIMIT) ? limit : SERVER_MAX_LIMIT;
+        SetQueryOrigin(context, position);
+        int total = QueryRangeNearest(context, request->radius, limit);
+        int count = context->results.size;
+
+        // The hits are written through a Star* array kept in the context's arena
+        const Star **hits = count ? ArenaAlloc(&context->arena, count * sizeof(Star *)) : NULL;
+        if (count && hits == NULL) {
+          written = AppendResponse(&job->output, request, QUERY_FAILED, total, NULL, NULL, 0, tree, batch->start_ns, batch_size);
+        } else {
+          for (int hit = 0; hit < count; hit++) {
+            hits[hit] = &tree->stars[context->results.ids[hit]];
+          }
+          written = AppendResponse(&job->output, request, QUERY_OK, total, hits, context->results.distances, count, tree, batch->start_ns, batch_size);
+        }
+      }
+    } else if (request->type == QUERY_LOOKUP) {
+      Star *star = GetFromHashMap(server->names, name);
+      int count = (star != NULL) ? 1 : 0;
+      if (count) {
+        stars[0] = star;
+        distances[0] = PositionDistance(star->position, &position);
+      }
+      written = AppendResponse(&job->output, request, count ? QUERY_OK : QUERY_NOT_FOUND, count, stars, distances, count, tree, batch->start_ns, batch_size);
+    } else if (request->type == QUERY_ROUTE) {
+      double max_jump = (request->radius > 0.0) ? request->radius : DEFAULT_JUMP_RANGE;
+      SetQueryOrigin(context, position);
+      int found = QueryRoute(context, name, max_jump);
+      int count = found ? context->route.size : 0;
+
+      // Route stars and their jump lengths share one arena block
+      const Star **hops = count ? ArenaAlloc(&context->arena, count * (sizeof(Star *) + sizeof(double))) : NULL;
+      if (count && hops == NULL) {
+        written = AppendResponse(&job->output, request, QUERY_FAILED, count, NULL, NULL, 0, tree, batch->start_ns, batch_size);
+      } else {
+        double *jumps = (double *)(hops + count);
+        for (int hop = 0; hop < count; hop++) {
+          hops[hop] = &tree->stars[context->route.ids[hop]];
+          jumps[hop] = hop ? PositionDistance(hops[hop]->position, hops[hop - 1]->position) : 0.0;
+        }
+        written = AppendResponse(&job->output, request, found ? QUERY_OK : QUERY_NOT_FOUND, count, hops, jumps, count, tree, batch->start_ns, batch_size);
+      }
+    } else if (request->type == QUERY_SHUTDOWN) {
+      __atomic_store_n(&server->shutdown, 1, __ATOMIC_RELAXED);
+      written = AppendResponse(&job->output, request, QUERY_OK, 0, NULL, NULL, 0, tree, batch->start_ns, batch_size);
+    } else {
+      written = AppendResponse(&job->output, request, QUERY_BAD_REQUEST, 0, NULL, NULL, 0, tree, batch->start_ns, batch_size);
+    }
+
+    if (!written) {
+      // Out of memory for this response's results; still answer so the client is not left waiting
+      job->output.size = 0;
+      written = AppendResponse(&job->output, request, QUERY_FAILED, 0, NULL, NULL, 0, tree, batch->start_ns, batch_size);
+    }
+  }
+}
+
+// Marks a job of its batch as answered; the last one wakes the connection thread
+static void FinishJob(ServerJob *job) {
+  ServerBatch *batch = job->batch;
+  pthread_mutex_lock(&batch->lock);
+  batch->remaining_jobs--;
+  if (batch->remaining_jobs == 0) {
+    pthread_cond_signal(&batch->done);
+  }
+  pthread_mutex_unlock(&batch->lock);
+}
+
+static void *ServerWorker(void *arg) {
+  QueryServer *server = arg;
+  Position sol = {0.0, 0.0, 0.0};
+  QueryContext *context = CreateQueryContext(server->tree, server->names, sol);
+  if (context != NULL) {
+    SetQueryIndex(context, server->index);
+  }
+
+  while (1) {
+    pthread_mutex_lock(&server->lock);
+    while (server->queue_size == 0 && !server->stopping) {
+      pthread_cond_wait(&server->ready, &server->lock);
+    }
+    if (server->queue_size == 0) {
+      pthread_mutex_unlock(&server->lock);
+      break;
+    }
+    ServerJob *job = server->queue[server->queue_head];
+    server->queue_head = (server->queue_head + 1) % server->queue_capacity;
+    server->queue_size--;
+    pthread_mutex_unlock(&server->lock);
+
+    AnswerJob(server, context, job);
+    FinishJob(job);
+  }
+
+  DeallocQueryContext(context);
+  return NULL;
+}
+
+// Adds jobs to the worker queue (a ring buffer grown as needed); returns 0 on allocation failure
+static int QueueJobs(QueryServer *server, ServerJob *jobs, int count) {
+  pthread_mutex_lock(&server->lock);
+  if (server->queue_size + count > server->queue_capacity) {
+    int capacity = server->queue_capacity ? server->queue_capacity : 64;
+    while (capacity < server->queue_size + count) {
+      capacity *= 2;
+    }
+    ServerJob **queue = malloc(capacity * sizeof(ServerJob *));
+    if (queue == NULL) {
+      pthread_mutex_unlock(&server->lock);
+      fprintf(stderr, "ERROR [QueueJobs()]: MEMORY ALLOCATION FAILED FOR JOB QUEUE!\n");
+      return 0;
+    }
+    for (int i = 0; i < server->queue_size; i++) {
+      queue[i] = server->queue[(server->queue_head + i) % server->queue_capacity];
+    }
+    free(server->queue);
+    server->queue = queue;
+    server->queue_head = 0;
+    server->queue_capacity = capacity;
+  }
+
+  for (int i = 0; i < count; i++) {
+    server->queue[(server->queue_head + server->queue_size) % server->queue_capacity] = &jobs[i];
+    server->queue_size++;
+  }
+  pthread_cond_broadcast(&server->ready);
+  pthread_mutex_unlock(&server->lock);
+  return 1;
+}
+
+// Pulls every complete request frame out of input into the batch; returns the bytes consumed
+static size_t ParseRequests(ServerBatch *batch, const ByteBuffer *input) {
+  size_t offset = 0;
+  batch->count = 0;
+
+  while (input->size - offset >= sizeof(QueryRequest)) {
+    QueryRequest request;
+    memcpy(&request, input->data + offset, sizeof(request));
+    size_t frame_bytes = sizeof(QueryRequest) + request.name_length;
+    if (input->size - offset < frame_bytes) {
+      break;
+    }
+
+    if (batch->count == batch->capacity) {
+      int capacity = batch->capacity ? batch->capacity * 2 : 64;
+      PendingRequest *requests = realloc(batch->requests, capacity * sizeof(PendingRequest));
+      if (requests == NULL) {
+        fprintf(stderr, "ERROR [ParseRequests()]: MEMORY ALLOCATION FAILED FOR REQUEST BATCH!\n");
+        break;
+      }
+      batch->requests = requests;
+      batch->capacity = capacity;
+    }
+
+    batch->requests[batch->count].request = request;
+    batch->requests[batch->count].name = input->data + offset + sizeof(QueryRequest);
+    batch->count++;
+    offset += frame_bytes;
+  }
+
+  return offset;
+}
+
+// Splits the parsed batch into jobs; returns 0 on allocation failure
+static int PrepareJobs(ServerBatch *batch) {
+  int job_count = (batch->count + SERVER_JOB_SIZE - 1) / SERVER_JOB_SIZE;
+  if (job_count > batch->job_capacity) {
+    ServerJob *jobs = realloc(batch->jobs, job_count * sizeof(ServerJob));
+    if (jobs == NULL) {
+      fprintf(stderr, "ERROR [PrepareJobs()]: MEMORY ALLOCATION FAILED FOR SERVER JOBS!\n");
+      return 0;
+    }
+    memset(jobs + batch->job_capacity, 0, (job_count - batch->job_capacity) * sizeof(ServerJob));
+    batch->jobs = jobs;
+    batch->job_capacity = job_count;
+  }
+
+  for (int i = 0; i < job_count; i++) {
+    batch->jobs[i].batch = batch;
+    batch->jobs[i].begin = i * SERVER_JOB_SIZE;
+    batch->jobs[i].end = (i + 1 < job_count) ? (i + 1) * SERVER_JOB_SIZE : batch->count;
+  }
+  batch->job_count = job_count;
+  return 1;
+}
+
+static void RecordBatchLatency(QueryServer *server, const ServerBatch *batch) {
+  pthread_mutex_lock(&server->lock);
+  for (int job = 0; job < batch->job_count; job++) {
+    const ByteBuffer *output = &batch->jobs[job].output;
+    size_t offset = 0;
+    while (offset < output->size) {
+      QueryResponse response;
+      memcpy(&response, output->data + offset, sizeof(response));
+      server->latency_counts[LatencyBucket(response.latency_ns)]++;
+      server->latency_total_ns += response.latency_ns;
+      server->latency_max_ns = (response.latency_ns > server->latency_max_ns) ? response.latency_ns : server->latency_max_ns;
+      server->requests++;
+      offset += sizeof(QueryResponse) + response.count * sizeof(QueryResultStar) + response.names_bytes;
+    }
+  }
+  server->batches++;
+  pthread_mutex_unlock(&server->lock);
+}
+
+// Reads whatever the client has sent, answers every complete request in it as one batch and
+// writes the responses back, until the client hangs up or the server stops
+static void *ServeConnection(void *arg) {
+  ServerConnection *connection = arg;
+  QueryServer *server = connection->server;
+  Position sol = {0.0, 0.0, 0.0};
+  QueryContext *context = CreateQueryContext(server->tree, server->names, sol);
+  if (context != NULL) {
+    SetQueryIndex(context, server->index);
+  }
+
+  ByteBuffer input = {0};
+  ServerBatch batch = {0};
+  pthread_mutex_init(&batch.lock, NULL);
+  pthread_cond_init(&batch.done, NULL);
+
+  while (!ServerStopping(server)) {
+    struct pollfd poll_fd = {connection->fd, POLLIN, 0};
+    int ready = poll(&poll_fd, 1, SERVER_POLL_MS);
+    if (ready < 0 && errno != EINTR) {
+      break;
+    }
+    if (ready <= 0) {
+      continue;
+    }
+
+    if (!ReserveBytes(&input, SERVER_READ_SIZE)) {
+      break;
+    }
+    ssize_t received = recv(connection->fd, input.data + input.size, input.capacity - input.size, 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      break;
+    }
+    input.size += (size_t)received;
+
+    batch.start_ns = NowNanoseconds();
+    size_t consumed = ParseRequests(&batch, &input);
+    if (batch.count == 0) {
+      continue;
+    }
+    if (!PrepareJobs(&batch)) {
+      break;
+    }
+
+    // The first job is answered here while the workers take the rest
+    int queued = (server->worker_count > 0) ? batch.job_count - 1 : 0;
+    batch.remaining_jobs = queued;
+    if (queued > 0 && !QueueJobs(server, batch.jobs + 1, queued)) {
+      break;
+    }
+    for (int job = 0; job < batch.job_count - queued; job++) {
+      AnswerJob(server, context, &batch.jobs[job]);
+    }
+    pthread_mutex_lock(&batch.lock);
+    while (batch.remaining_jobs > 0) {
+      pthread_cond_wait(&batch.done, &batch.lock);
+    }
+    pthread_mutex_unlock(&batch.lock);
+
+    int sent = 1;
+    for (int job = 0; job < batch.job_count && sent; job++) {
+      sent = SendAll(connection->fd, batch.jobs[job].output.data, batch.jobs[job].output.size);
+    }
+    RecordBatchLatency(server, &batch);
+
+    // Keep any partial request for the next read
+    memmove(input.data, input.data + consumed, input.size - consumed);
+    input.size -= consumed;
+    if (!sent) {
+      break;
+    }
+  }
+
+  close(connection->fd);
+  for (int job = 0; job < batch.job_capacity; job++) {
+    free(batch.jobs[job].output.data);
+  }
+  free(batch.jobs);
+  free(batch.requests);
+  free(input.data);
+  pthread_mutex_destroy(&batch.lock);
+  pthread_cond_destroy(&batch.done);
+  DeallocQueryContext(context);
+  __atomic_store_n(&connection->finished, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+// SERVER LIFECYCLE
+static int OpenServerSocket(const char *path) {
+  struct sockaddr_un address = {0};
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "ERROR [OpenServerSocket()]: SOCKET PATH TOO LONG!\n");
+    return -1;
+  }
+  strcpy(address.sun_path, path);
+
+  // Only a stale socket left by an earlier server is replaced, never any other file
+  struct stat status;
+  if (lstat(path, &status) == 0) {
+    if (!S_ISSOCK(status.st_mode)) {
+      fprintf(stderr, "ERROR [OpenServerSocket()]: SOCKET PATH EXISTS AND IS NOT A SOCKET!\n");
+      return -1;
+    }
+    unlink(path);
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    fprintf(stderr, "ERROR [OpenServerSocket()]: COULD NOT CREATE SOCKET!\n");
+    return -1;
+  }
+  if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, 64) != 0) {
+    fprintf(stderr, "ERROR [OpenServerSocket()]: COULD NOT LISTEN ON SOCKET!\n");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Joins connection threads that have exited and compacts the list; returns the new count
+static int ReapConnections(ServerConnection **connections, int count, int wait_all) {
+  int kept = 0;
+  for (int i = 0; i < count; i++) {
+    if (wait_all || __atomic_load_n(&connections[i]->finished, __ATOMIC_ACQUIRE)) {
+      pthread_join(connections[i]->thread, NULL);
+      free(connections[i]);
+    } else {
+      connections[kept++] = connections[i];
+    }
+  }
+  return kept;
+}
+
+static void PrintServerSummary(const QueryServer *server) {
+  if (server->requests == 0) {
+    fprintf(stderr, "Query server answered no requests\n");
+    return;
+  }
+  fprintf(stderr, "Query server answered %lu requests in %lu batches (%.1f per batch)\n", server->requests,
+          server->batches, (double)server->requests / server->batches);
+  fprintf(stderr, "Latency: mean %.1f us, p50 <= %.1f us, p99 <= %.1f us, max %.1f us\n",
+          server->latency_total_ns / 1000.0 / server->requests, LatencyPercentile(server, 0.50) / 1000.0,
+          LatencyPercentile(server, 0.99) / 1000.0, server->latency_max_ns / 1000.0);
+}
+
+int RunQueryServer(KDTree *tree, HashMap *names, const ServerOptions *options) {
+  const char *path = (options && options->socket_path) ? options->socket_path : SERVER_DEFAULT_SOCKET;
+  int worker_count = (options && options->workers > 0) ? options->workers : GetThreadCount();
+
+  QueryServer *server = calloc(1, sizeof(QueryServer));
+  pthread_t *workers = malloc(worker_count * sizeof(pthread_t));
+  if (server == NULL || workers == NULL) {
+    fprintf(stderr, "ERROR [RunQueryServer()]: MEMORY ALLOCATION FAILED FOR SERVER!\n");
+    free(server);
+    free(workers);
+    return 1;
+  }
+  server->tree = tree;
+  server->names = names;
+  server->index = options ? options->index : NULL;
+  pthread_mutex_init(&server->lock, NULL);
+  pthread_cond_init(&server->ready, NULL);
+
+  int listen_fd = OpenServerSocket(path);
+  if (listen_fd < 0) {
+    free(server);
+    free(workers);
+    return 1;
+  }
+
+  // No SA_RESTART, so a signal also wakes the acceptor out of poll()
+  struct sigaction action = {0};
+  action.sa_handler = HandleStopSignal;
+  sigemptyset(&action.sa_mask);
+  struct sigaction old_int, old_term;
+  stop_signal = 0;
+  sigaction(SIGINT, &action, &old_int);
+  sigaction(SIGTERM, &action, &old_term);
+
+  int started = 0;
+  while (started < worker_count && pthread_create(&workers[started], NULL, ServerWorker, server) == 0) {
+    started++;
+  }
+  server->worker_count = started;
+  if (started == 0) {
+    fprintf(stderr, "WARNING [RunQueryServer()]: NO WORKER THREADS; CONNECTIONS ANSWER ALONE\n");
+  }
+  fprintf(stderr, "Query server listening on %s with %d workers\n", path, started);
+
+  ServerConnection **connections = NULL;
+  int connection_count = 0;
+  int connection_capacity = 0;
+  int status = 0;
+
+  while (!ServerStopping(server)) {
+    struct pollfd poll_fd = {listen_fd, POLLIN, 0};
+    int ready = poll(&poll_fd, 1, SERVER_POLL_MS);
+    connection_count = ReapConnections(connections, connection_count, 0);
+    if (ready < 0 && errno != EINTR) {
+      status = 1;
+      break;
+    }
+    if (ready <= 0) {
+      continue;
+    }
+
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+      continue;
+    }
+
+    if (connection_count == connection_capacity) {
+      int capacity = connection_capacity ? connection_capacity * 2 : 16;
+      ServerConnection **grown = realloc(connections, capacity * sizeof(ServerConnection *));
+      if (grown == NULL) {
+        fprintf(stderr, "ERROR [RunQueryServer()]: MEMORY ALLOCATION FAILED FOR CONNECTIONS!\n");
+        close(fd);
+        continue;
+      }
+      connections = grown;
+      connection_capacity = capacity;
+    }
+
+    ServerConnection *connection = calloc(1, sizeof(ServerConnection));
+    if (connection == NULL) {
+      close(fd);
+      continue;
+    }
+    connection->server = server;
+    connection->fd = fd;
+    if (pthread_create(&connection->thread, NULL, ServeConnection, connection) != 0) {
+      fprintf(stderr, "ERROR [RunQueryServer()]: COULD NOT START CONNECTION THREAD!\n");
+      close(fd);
+      free(connection);
+      continue;
+    }
+    connections[connection_count++] = connection;
+  }
+
+  // Connections notice the stop within SERVER_POLL_MS and finish their current batch first
+  close(listen_fd);
+  unlink(path);
+  ReapConnections(connections, connection_count, 1);
+  free(connections);
+
+  pthread_mutex_lock(&server->lock);
+  server->stopping = 1;
+  pthread_cond_broadcast(&server->ready);
+  pthread_mutex_unlock(&server->lock);
+  for (int i = 0; i < started; i++) {
+    pthread_join(workers[i], NULL);
+  }
+
+  sigaction(SIGINT, &old_int, NULL);
+  sigaction(SIGTERM, &old_term, NULL);
+
+  PrintServerSummary(server);
+  pthread_mutex_destroy(&server->lock);
+  pthread_cond_destroy(&server->ready);
+  free(server->queue);
+  free(server);
+  free(workers);
+  return status;
+}
@@ -0,0 +1,78 @@
+#ifndef STAR_CHART_SERVER_H
+#define STAR_CHART_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "star_chart_utils.h"
+
+// Resident query server: the catalog is loaded once and queries arrive over a local Unix
+// socket. Every frame is a fixed-size struct in host byte order (both ends share a machine),
+// optionally followed by a variable-length tail. A client may pipeline any number of requests;
+// whatever has arrived when the server reads is answered as one batch, in order.
+#define SERVER_DEFAULT_SOCKET "star_chart.sock"
+#define SERVER_PROTOCOL_VERSION 1
+#define SERVER_MAX_NAME 1024     // Longest name a request may carry
+#define SERVER_DEFAULT_LIMIT 256 // Radius hits returned when a request leaves 'limit' at 0
+#define SERVER_MAX_LIMIT 65536
+
+typedef enum QueryType {
+	QUERY_NEAREST = 1, // position
+	QUERY_RADIUS,      // position, radius, limit
+	QUERY_LOOKUP,      // name
+	QUERY_ROUTE,       // position (origin), name (destination), radius (max jump; 0 for default)
+	QUERY_SHUTDOWN,    // Stops the server once this connection's batch is answered
+} QueryType;
+
+typedef enum QueryStatus {
+	QUERY_OK = 0,
+	QUERY_NOT_FOUND,   // No such star, or no route
+	QUERY_BAD_REQUEST,
+	QUERY_FAILED,      // Out of memory or similar on the server
+} QueryStatus;
+
+typedef struct QueryRequest {
+	uint32_t id;          // Echoed in the response
+	uint16_t type;        // QueryType
+	uint16_t name_length; // Bytes of name following the request (no NUL)
+	uint32_t limit;       // Most results to return (QUERY_RADIUS)
+	uint32_t version;     // SERVER_PROTOCOL_VERSION
+	double position[3];
+	double radius;
+} QueryRequest;
+
+// Followed by 'count' QueryResultStar records, then 'names_bytes' of NUL-terminated names
+typedef struct QueryResponse {
+	uint32_t id;
+	uint16_t status;      // QueryStatus
+	uint16_t type;
+	uint32_t count;
+	uint32_t total;       // Hits before 'limit' was applied
+	uint32_t names_bytes;
+	uint32_t batch_size;  // Requests answered in the same batch as this one
+	uint64_t latency_ns;  // From the batch being read to this response being ready
+} QueryResponse;
+
+typedef struct QueryResultStar {
+	int32_t star_id;
+	float lightyears;
+	double position[3];
+	double distance;      // From the query position (nearest, radius, lookup) or jump length (route)
+	uint32_t name_offset; // Into the names that follow the records
+	uint32_t reserved;
+} QueryResultStar;
+
+typedef struct ServerOptions {
+	const char* socket_path;
+	int workers;          // Query threads; 0 for one per core
+	SpatialIndex* index;  // Answers nearest and radius requests; NULL to use the tree
+} ServerOptions;
+
+// Answers queries against tree/names until a QUERY_SHUTDOWN request, SIGINT or SIGTERM, then
+// prints a latency summary to stderr. Returns 0 on a clean shutdown.
+int RunQueryServer(KDTree* tree, HashMap* names, const ServerOptions* options);
+
+// Blocking send/receive of exactly 'bytes' bytes; return 0 on error or end of stream
+int SendAll(int fd, const void* data, size_t bytes);
+int ReceiveAll(int fd, void* data, size_t bytes);
+
+#endif
@@ -0,0 +1,418 @@
+#include "star_chart_snapshot.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// SNAPSHOT WRITING
+// Sections are written in the order they appear in the file, so the writer only ever needs
+// to pad forward to the next aligned offset.
+typedef struct SnapshotWriter {
+  FILE *file;
+  uint64_t offset;
+  int failed;
+} SnapshotWriter;
+
+static uint64_t AlignSnapshotOffset(uint64_t offset) {
+  return (offset + SNAPSHOT_ALIGNMENT - 1) & ~(uint64_t)(SNAPSHOT_ALIGNMENT - 1);
+}
+
+static void WriteBytes(SnapshotWriter *writer, const void *data, size_t bytes) {
+  if (writer->failed || bytes == 0) {
+    return;
+  }
+  if (fwrite(data, 1, bytes, writer->file) != bytes) {
+    writer->failed = 1;
+  }
+  writer->offset += bytes;
+}
+
+static void WritePadding(SnapshotWriter *writer, uint64_t target) {
+  static const char zeros[SNAPSHOT_ALIGNMENT] = {0};
+
+  while (writer->offset < target) {
+    uint64_t gap = target - writer->offset;
+    WriteBytes(writer, zeros, gap < sizeof(zeros) ? (size_t)gap : sizeof(zeros));
+  }
+}
+
+// Starts a new aligned section and returns its offset
+static uint64_t BeginSection(SnapshotWriter *writer) {
+  WritePadding(writer, AlignSnapshotOffset(writer->offset));
+  return writer->offset;
+}
+
+// Writes 'count' doubles followed by zeros up to 'capacity' entries
+static uint64_t WriteCoordSection(SnapshotWriter *writer, const double *values, int count, int capacity) {
+  uint64_t offset = BeginSection(writer);
+  WriteBytes(writer, values, (size_t)count * sizeof(double));
+  WritePadding(writer, offset + (uint64_t)capacity * sizeof(double));
+  return offset;
+}
+
+// The file is written next to 'path' and renamed over it once complete, so a reader never
+// maps a half-written snapshot. Returns 1 on success.
+int WriteSnapshot(const char *path, const StarArray *array, const KDTree *tree, const HashMap *map) {
+  if (tree->stars != array->stars || map->stars != array->stars || tree->size != array->size) {
+    fprintf(stderr, "ERROR [WriteSnapshot()]: TREE AND HASH MAP MUST BE BUILT OVER THE SAME STAR ARRAY!\n");
+    return 0;
+  }
+
+  size_t path_length = strlen(path);
+  char *temp_path = malloc(path_length + 5);
+  if (temp_path == NULL) {
+    fprintf(stderr, "ERROR [WriteSnapshot()]: MEMORY ALLOCATION FAILED FOR FILE NAME!\n");
+    return 0;
+  }
+  memcpy(temp_path, path, path_length);
+  memcpy(temp_path + path_length, ".tmp", 5);
+
+  SnapshotWriter writer = {fopen(temp_path, "wb"), 0, 0};
+  if (writer.file == NULL) {
+    fprintf(stderr, "ERROR [WriteSnapshot()]: FILE FAILED TO OPEN!\n");
+    free(temp_path);
+    return 0;
+  }
+
+  int size = array->size;
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.byte_order = SNAPSHOT_BYTE_ORDER;
+  header.header_bytes = sizeof(SnapshotHeader);
+  header.node_bytes = sizeof(KDTreeNode);
+  header.star_count = size;
+  header.leaf_size = tree->leaf_size;
+  header.depth = tree->depth;
+  header.node_count = tree->node_count;
+  header.tree_capacity = (size + 7) & ~7;
+  header.hash_size = map->size;
+  header.hash_count = map->count;
+
+  // Placeholder; rewritten with the final offsets at the end
+  WriteBytes(&writer, &header, sizeof(header));
+
+  uint64_t *name_offsets = malloc((size > 0 ? size : 1) * sizeof(uint64_t));
+  float *lightyears = malloc((size > 0 ? size : 1) * sizeof(float));
+  Position *positions = malloc((size > 0 ? size : 1) * sizeof(Position));
+  if (name_offsets == NULL || lightyears == NULL || positions == NULL) {
+    fprintf(stderr, "ERROR [WriteSnapshot()]: MEMORY ALLOCATION FAILED FOR SNAPSHOT SECTIONS!\n");
+    writer.failed = 1;
+    goto done;
+  }
+
+  header.names_offset = BeginSection(&writer);
+  for (int i = 0; i < size; i++) {
+    const Star *star = &array->stars[i];
+    name_offsets[i] = writer.offset - header.names_offset;
+    WriteBytes(&writer, star->name, strlen(star->name) + 1);
+    lightyears[i] = star->lightyears;
+    positions[i] = *star->position;
+  }
+  header.names_bytes = writer.offset - header.names_offset;
+
+  header.name_offsets_offset = BeginSection(&writer);
+  WriteBytes(&writer, name_offsets, (size_t)size * sizeof(uint64_t));
+  header.lightyears_offset = BeginSection(&writer);
+  WriteBytes(&writer, lightyears, (size_t)size * sizeof(float));
+  header.positions_offset = BeginSection(&writer);
+  WriteBytes(&writer, positions, (size_t)size * sizeof(Position));
+
+  header.nodes_offset = BeginSection(&writer);
+  WriteBytes(&writer, tree->nodes, (size_t)tree->node_count * sizeof(KDTreeNode));
+  header.boxes_offset = BeginSection(&writer);
+  WriteBytes(&writer, tree->boxes, (size_t)tree->node_count * sizeof(KDTreeBox));
+  header.sums_offset = BeginSection(&writer);
+  WriteBytes(&writer, tree->sums, (size_t)tree->node_count * sizeof(Position));
+  header.ids_offset = BeginSection(&writer);
+  WriteBytes(&writer, tree->ids, (size_t)size * sizeof(int));
+  header.tree_coords_offset[0] = WriteCoordSection(&writer, tree->x, size, header.tree_capacity);
+  header.tree_coords_offset[1] = WriteCoordSection(&writer, tree->y, size, header.tree_capacity);
+  header.tree_coords_offset[2] = WriteCoordSection(&writer, tree->z, size, header.tree_capacity);
+
+  header.slots_offset = BeginSection(&writer);
+  WriteBytes(&writer, map->slots, (size_t)map->size * sizeof(HashEntry));
+  header.file_bytes = writer.offset;
+
+  if (!writer.failed && fseek(writer.file, 0, SEEK_SET) == 0) {
+    writer.offset = 0;
+    WriteBytes(&writer, &header, sizeof(header));
+  } else {
+    writer.failed = 1;
+  }
+
+done:
+  free(name_offsets);
+  free(lightyears);
+  free(positions);
+  if (fclose(writer.file) != 0) {
+    writer.failed = 1;
+  }
+
+  if (writer.failed || rename(temp_path, path) != 0) {
+    fprintf(stderr, "ERROR [WriteSnapshot()]: FAILED TO WRITE SNAPSHOT FILE!\n");
+    remove(temp_path);
+    free(temp_path);
+    return 0;
+  }
+
+  free(temp_path);
+  return 1;
+}
+
+// SNAPSHOT LOADING
+// Nothing is parsed, converted, sorted or hashed: the coordinate, tree and hash sections are
+// used where they sit in the mapping. The only per-star work is filling in the Star records
+// (name and position pointers into the mapping), which is a single parallel pass. The same
+// pass range-checks every tree node, tree id and hash slot, since queries index memory with
+// them unchecked; a file that fails any check is rejected.
+typedef struct SnapshotLoad {
+  Star *stars;
+  int size;
+  const char *names;
+  uint64_t names_bytes;
+  const uint64_t *name_offsets;
+  const float *lightyears;
+  Position *positions;
+  const KDTreeNode *nodes;
+  int node_count;
+  const int *ids;
+  const HashEntry *slots;
+  int hash_size;
+  int bad_entries;   // Names, nodes, ids or slots out of range
+  int used_slots;
+} SnapshotLoad;
+
+static int NodeValid(const SnapshotLoad *load, int index) {
+  const KDTreeNode *node = &load->nodes[index];
+  if (node->begin < 0 || node->count < 0 || node->begin > load->size - node->count) {
+    return 0;
+  }
+  if (node->axis < 0) {
+    return node->axis == -1 && node->count <= KD_MAX_LEAF_SIZE;
+  }
+  // Inner nodes need both children inside the node array
+  return node->axis < 3 && index < (load->node_count - 1) / 2;
+}
+
+static void LoadSnapshotTask(void *user_data, int begin, int end) {
+  SnapshotLoad *load = user_data;
+  int bad_entries = 0;
+  int used_slots = 0;
+
+  for (int i = begin; i < end; i++) {
+    if (i < load->size) {
+      uint64_t offset = load->name_offsets[i];
+      if (offset >= load->names_bytes) {
+        bad_entries++;
+        offset = 0;
+      }
+      load->stars[i].name = (char *)load->names + offset;
+      load->stars[i].position = &load->positions[i];
+      load->stars[i].lightyears = load->lightyears[i];
+      if (load->ids[i] < 0 || load->ids[i] >= load->size) {
+        bad_entries++;
+      }
+    }
+    if (i < load->node_count && !NodeValid(load, i)) {
+      bad_entries++;
+    }
+    if (i < load->hash_size && load->slots[i].hash != 0) {
+      used_slots++;
+      if (load->slots[i].id < 0 || load->slots[i].id >= load->size) {
+        bad_entries++;
+      }
+    }
+  }
+
+  if (bad_entries) {
+    __atomic_fetch_add(&load->bad_entries, bad_entries, __ATOMIC_RELAXED);
+  }
+  __atomic_fetch_add(&load->used_slots, used_slots, __ATOMIC_RELAXED);
+}
+
+// Section [offset, offset + bytes) must be aligned and inside the file
+static int SectionFits(const SnapshotHeader *header, uint64_t offset, uint64_t bytes) {
+  return offset % SNAPSHOT_ALIGNMENT == 0 && offset >= sizeof(SnapshotHeader) &&
+         offset <= header->file_bytes && bytes <= header->file_bytes - offset;
+}
+
+static int ValidateSnapshotHeader(const SnapshotHeader *header, uint64_t file_bytes) {
+  if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != SNAPSHOT_VERSION || header->byte_order != SNAPSHOT_BYTE_ORDER ||
+      header->header_bytes != sizeof(SnapshotHeader) || header->node_bytes != sizeof(KDTreeNode) ||
+      header->file_bytes != file_bytes) {
+    return 0;
+  }
+
+  uint64_t stars = (uint64_t)header->star_count;
+  if (header->star_count < 0 || header->tree_capacity < header->star_count || header->depth < 0 || header->depth > 30 ||
+      header->node_count != (int32_t)((2UL << header->depth) - 1) || header->hash_size < 16 ||
+      (header->hash_size & (header->hash_size - 1)) != 0 || header->hash_count > header->star_count) {
+    return 0;
+  }
+
+  // Lookups stop at an empty slot, so a full table would never terminate
+  if (header->leaf_size < 1 || header->leaf_size > KD_MAX_LEAF_SIZE || header->hash_count >= header->hash_size) {
+    return 0;
+  }
+
+  if (header->names_bytes == 0 && stars > 0) {
+    return 0;
+  }
+
+  int fits = SectionFits(header, header->names_offset, header->names_bytes) &&
+             SectionFits(header, header->name_offsets_offset, stars * sizeof(uint64_t)) &&
+             SectionFits(header, header->lightyears_offset, stars * sizeof(float)) &&
+             SectionFits(header, header->positions_offset, stars * sizeof(Position)) &&
+             SectionFits(header, header->nodes_offset, (uint64_t)header->node_count * sizeof(KDTreeNode)) &&
+             SectionFits(header, header->boxes_offset, (uint64_t)header->node_count * sizeof(KDTreeBox)) &&
+             SectionFits(header, header->sums_offset, (uint64_t)header->node_count * sizeof(Position)) &&
+             SectionFits(header, header->ids_offset, stars * sizeof(int)) &&
+             SectionFits(header, header->slots_offset, (uint64_t)header->hash_size * sizeof(HashEntry));
+  for (int axis = 0; axis < 3; axis++) {
+    fits = fits && SectionFits(header, header->tree_coords_offset[axis], (uint64_t)header->tree_capacity * sizeof(double));
+  }
+
+  return fits;
+}
+
+// Returns NULL quietly if the file does not exist, so callers can fall back to ParseFile()
+StarSnapshot *OpenSnapshot(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    if (errno != ENOENT) {
+      fprintf(stderr, "ERROR [OpenSnapshot()]: FILE FAILED TO OPEN!\n");
+    }
+    return NULL;
+  }
+
+  struct stat file_info;
+  if (fstat(fd, &file_info) != 0 || (size_t)file_info.st_size < sizeof(SnapshotHeader)) {
+    fprintf(stderr, "ERROR [OpenSnapshot()]: FILE IS NOT A STAR SNAPSHOT!\n");
+    close(fd);
+    return NULL;
+  }
+
+  size_t file_size = (size_t)file_info.st_size;
+  char *base = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    fprintf(stderr, "ERROR [OpenSnapshot()]: FAILED TO MAP FILE!\n");
+    return NULL;
+  }
+
+  const SnapshotHeader *header = (const SnapshotHeader *)base;
+  if (!ValidateSnapshotHeader(header, file_size)) {
+    fprintf(stderr, "ERROR [OpenSnapshot()]: SNAPSHOT HEADER IS INVALID OR FROM ANOTHER VERSION!\n");
+    munmap(base, file_size);
+    return NULL;
+  }
+
+  int size = header->star_count;
+  StarSnapshot *snapshot = calloc(1, sizeof(StarSnapshot));
+  StarArray *array = calloc(1, sizeof(StarArray));
+  KDTree *tree = calloc(1, sizeof(KDTree));
+  HashMap *map = calloc(1, sizeof(HashMap));
+  Star *stars = malloc((size > 0 ? size : 1) * sizeof(Star));
+  if (snapshot == NULL || array == NULL || tree == NULL || map == NULL || stars == NULL) {
+    fprintf(stderr, "ERROR [OpenSnapshot()]: MEMORY ALLOCATION FAILED FOR SNAPSHOT!\n");
+    free(snapshot);
+    free(array);
+    free(tree);
+    free(map);
+    free(stars);
+    munmap(base, file_size);
+    return NULL;
+  }
+
+  // Every name ends at a NUL inside the section as long as the section itself ends in one
+  const char *names = base + header->names_offset;
+  int names_terminated = header->names_bytes == 0 || names[header->names_bytes - 1] == '\0';
+
+  SnapshotLoad load = {
+    stars,
+    size,
+    names,
+    header->names_bytes,
+    (const uint64_t *)(base + header->name_offsets_offset),
+    (const float *)(base + header->lightyears_offset),
+    (Position *)(base + header->positions_offset),
+    (const KDTreeNode *)(base + header->nodes_offset),
+    header->node_count,
+    (const int *)(base + header->ids_offset),
+    (const HashEntry *)(base + header->slots_offset),
+    header->hash_size,
+    0,
+    0,
+  };
+  int entries = size;
+  entries = (header->node_count > entries) ? header->node_count : entries;
+  entries = (header->hash_size > entries) ? header->hash_size : entries;
+  if (names_terminated) {
+    ParallelFor(entries, 16384, LoadSnapshotTask, &load);
+  }
+  if (!names_terminated || load.bad_entries || load.used_slots != header->hash_count) {
+    fprintf(stderr, "ERROR [OpenSnapshot()]: SNAPSHOT CONTENTS ARE CORRUPT!\n");
+    free(snapshot);
+    free(array);
+    free(tree);
+    free(map);
+    free(stars);
+    munmap(base, file_size);
+    return NULL;
+  }
+
+  array->stars = stars;
+  array->size = size;
+  array->capacity = size;
+  array->name_pool = (char *)load.names;
+  array->name_pool_size = header->names_bytes;
+  array->position_pool = load.positions;
+  array->position_pool_size = size;
+
+  tree->nodes = (KDTreeNode *)(base + header->nodes_offset);
+  tree->boxes = (KDTreeBox *)(base + header->boxes_offset);
+  tree->sums = (Position *)(base + header->sums_offset);
+  tree->node_count = header->node_count;
+  tree->depth = header->depth;
+  tree->leaf_size = header->leaf_size;
+  tree->size = size;
+  tree->ids = (int *)(base + header->ids_offset);
+  tree->x = (double *)(base + header->tree_coords_offset[0]);
+  tree->y = (double *)(base + header->tree_coords_offset[1]);
+  tree->z = (double *)(base + header->tree_coords_offset[2]);
+  tree->stars = stars;
+  tree->bytes = sizeof(KDTree);
+
+  map->slots = (HashEntry *)(base + header->slots_offset);
+  map->stars = stars;
+  map->size = header->hash_size;
+  map->count = header->hash_count;
+
+  snapshot->array = array;
+  snapshot->tree = tree;
+  snapshot->map = map;
+  snapshot->base = base;
+  snapshot->bytes = file_size;
+
+  return snapshot;
+}
+
+void CloseSnapshot(StarSnapshot *snapshot) {
+  if (snapshot == NULL) {
+    return;
+  }
+
+  free(snapshot->array->stars);
+  free(snapshot->array);
+  free(snapshot->tree);
+  free(snapshot->map);
+  munmap(snapshot->base, snapshot->bytes);
+  free(snapshot);
+}
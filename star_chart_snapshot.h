@@ -0,0 +1,63 @@
+#ifndef STAR_CHART_SNAPSHOT_H
+#define STAR_CHART_SNAPSHOT_H
+
+#include <stdint.h>
+#include "star_chart_utils.h"
+
+// Binary catalog snapshot: converted coordinates, the name pool, the built KD-tree and the
+// name index, laid out so a process can mmap the file and query it in place. Written by
+// WriteSnapshot() (see star_chart_pack.c), opened with OpenSnapshot().
+#define SNAPSHOT_MAGIC "STARSNAP"
+#define SNAPSHOT_VERSION 4
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+#define SNAPSHOT_ALIGNMENT 64
+
+// Every section starts on a SNAPSHOT_ALIGNMENT boundary; offsets are from the start of the file.
+// Tree coordinate sections hold 'tree_capacity' doubles (zero padded).
+typedef struct SnapshotHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;   // SNAPSHOT_BYTE_ORDER as seen by the writer
+	uint32_t header_bytes; // sizeof(SnapshotHeader)
+	uint32_t node_bytes;   // sizeof(KDTreeNode)
+	uint64_t file_bytes;
+
+	int32_t star_count;
+	int32_t leaf_size;
+	int32_t depth;
+	int32_t node_count;
+	int32_t tree_capacity;
+	int32_t hash_size;
+	int32_t hash_count;
+	int32_t reserved;      // Zero; keeps the offsets below 8-byte aligned
+
+	uint64_t names_offset;        // NUL-terminated names, back to back
+	uint64_t names_bytes;
+	uint64_t name_offsets_offset; // uint64_t per star, into the name section
+	uint64_t lightyears_offset;   // float per star
+	uint64_t positions_offset;    // Position per star
+	uint64_t nodes_offset;        // KDTree.nodes
+	uint64_t boxes_offset;        // KDTree.boxes
+	uint64_t sums_offset;         // KDTree.sums
+	uint64_t ids_offset;          // KDTree.ids
+	uint64_t tree_coords_offset[3];
+	uint64_t slots_offset;        // HashMap.slots
+} SnapshotHeader;
+
+// An opened snapshot. Everything except the Star records (and the small structs below) points
+// straight into the read-only mapping, so none of these may be modified, grown or passed to the
+// Dealloc*() functions; release them all with CloseSnapshot().
+typedef struct StarSnapshot {
+	StarArray* array;
+	KDTree* tree;
+	HashMap* map;
+	void* base;
+	size_t bytes;
+} StarSnapshot;
+
+// tree and map must have been built over array
+int WriteSnapshot(const char* path, const StarArray* array, const KDTree* tree, const HashMap* map);
+StarSnapshot* OpenSnapshot(const char* path);
+void CloseSnapshot(StarSnapshot* snapshot);
+
+#endif
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "star_chart_utils.h"
+
+// Regression tests for the star_chart library; exits non-zero if any check fails
+// usage: star_chart_test
+
+static int failures = 0;
+
+#define CHECK(condition)                                                          \
+    do {                                                                          \
+        if (!(condition)) {                                                       \
+            fprintf(stderr, "FAILED %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                           \
+        }                                                                         \
+    } while (0)
+
+static void AddTestStar(StarArray *array, const char *name, double x, double y, double z) {
+    Star star = {0};
+    star.name = malloc(strlen(name) + 1);
+    star.position = malloc(sizeof(Position));
+    strcpy(star.name, name);
+    star.position->x = x;
+    star.position->y = y;
+    star.position->z = z;
+    AddStarToArray(array, &star);
+}
+
+static int LookupId(StarIndex *index, const char *name) {
+    Star *star = GetFromHashMap(index->names, name);
+    return (star != NULL) ? (int)(star - index->array->stars) : -1;
+}
+
+// Deleting the star a duplicated name resolves to must hand the name back to the most recent
+// older star that is still live, both for stars present when the index was built and for
+// stars inserted later
+static void TestStarIndexDuplicateNames(void) {
+    StarArray *array = CreateStarArray();
+    AddTestStar(array, "Dup", 1, 0, 0);   // 0
+    AddTestStar(array, "Other", 2, 0, 0); // 1
+    AddTestStar(array, "Dup", 3, 0, 0);   // 2
+
+    HashMap *names = CreateHashMap(array, 0);
+    StarIndex *index = CreateStarIndex(array, names, 0);
+    CHECK(index != NULL);
+    if (index == NULL) {
+        DeallocHashMap(names);
+        DeallocMainStarArray(array);
+        return;
+    }
+    CHECK(LookupId(index, "Dup") == 2);
+
+    int inserted = StarIndexInsert(index, "Dup", (Position){4, 0, 0}, 0); // 3
+    CHECK(inserted == 3);
+    CHECK(LookupId(index, "Dup") == 3);
+
+    // Deleting a shadowed star leaves the name where it is
+    CHECK(StarIndexDelete(index, 2));
+    CHECK(LookupId(index, "Dup") == 3);
+
+    // Deleting the visible one skips the deleted star 2 and falls back to star 0
+    CHECK(StarIndexDelete(index, 3));
+    CHECK(LookupId(index, "Dup") == 0);
+
+    CHECK(StarIndexDelete(index, 0));
+    CHECK(LookupId(index, "Dup") == -1);
+    CHECK(LookupId(index, "Other") == 1);
+
+    // A name that was fully deleted can be inserted again
+    inserted = StarIndexInsert(index, "Dup", (Position){5, 0, 0}, 0);
+    CHECK(inserted == 4);
+    CHECK(LookupId(index, "Dup") == 4);
+    CHECK(StarIndexDelete(index, 4));
+    CHECK(LookupId(index, "Dup") == -1);
+
+    CHECK(names->count == 1);
+
+    DeallocStarIndex(index);
+    DeallocHashMap(names);
+    DeallocMainStarArray(array);
+}
+
+// Jump graphs are indexed by catalog id, so a tree over part of the catalog must be refused
+// rather than producing edges for the wrong stars
+static void TestJumpGraphNeedsWholeCatalog(void) {
+    StarArray *array = CreateStarArray();
+    AddTestStar(array, "A", 0, 0, 0);
+    AddTestStar(array, "B", 1, 0, 0);
+    AddTestStar(array, "C", 2, 0, 0);
+    AddTestStar(array, "D", 10, 0, 0);
+
+    KDTree *tree = CreateBalancedKDTree(array, 0);
+    JumpGraph *graph = CreateJumpGraph(tree, 1.5);
+    CHECK(graph != NULL);
+    if (graph != NULL) {
+        CHECK(graph->node_count == 4);
+        CHECK(graph->offsets[2] - graph->offsets[1] == 2); // B reaches A and C
+        CHECK(graph->offsets[4] - graph->offsets[3] == 0); // D is isolated
+    }
+    DeallocJumpGraph(graph);
+
+    int subset_ids[] = {2, 3};
+    KDTree *subset = CreateKDTreeFromIds(array, subset_ids, 2, 0);
+    CHECK(CreateJumpGraph(subset, 20.0) == NULL);
+    CHECK(CreateRoutePlanner(subset) == NULL);
+
+    DeallocKDTree(subset);
+    DeallocKDTree(tree);
+    DeallocMainStarArray(array);
+}
+
+static double RandomCoordinate(void) {
+    return (double)rand() / RAND_MAX * 2000.0 - 1000.0;
+}
+
+// ApproxNearestNeighbor() must stay within (1 + epsilon) of the exact nearest distance, and
+// max_nodes counts from the first leaf: budgets smaller than the tree depth must not all
+// collapse to the same answers, and a larger budget never does worse on any query
+static void TestApproxNearestNeighbor(void) {
+    StarArray *array = CreateStarArray();
+    srand(42);
+    for (int i = 0; i < 20000; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "S%d", i);
+        AddTestStar(array, name, RandomCoordinate(), RandomCoordinate(), RandomCoordinate());
+    }
+    KDTree *tree = CreateBalancedKDTree(array, 0);
+    CHECK(tree != NULL && tree->depth > 4);
+    if (tree == NULL) {
+        DeallocMainStarArray(array);
+        return;
+    }
+
+    const double epsilons[] = {0.0, 0.1, 0.5, 2.0};
+    const long small_budget = 1;
+    const long large_budget = tree->depth - 1;
+    int bound_failures = 0;
+    int budget_regressions = 0;
+    int budget_improvements = 0;
+
+    for (int i = 0; i < 500; i++) {
+        Position query = {RandomCoordinate(), RandomCoordinate(), RandomCoordinate()};
+        double exact = CalculateDistance(NearestNeighbor(tree, query), query);
+
+        for (int e = 0; e < 4; e++) {
+            Star *approx = ApproxNearestNeighbor(tree, query, epsilons[e], 0);
+            if (approx == NULL || CalculateDistance(approx, query) > (1.0 + epsilons[e]) * exact + 1e-9) {
+                bound_failures++;
+            }
+        }
+
+        double small = CalculateDistance(ApproxNearestNeighbor(tree, query, 0.0, small_budget), query);
+        double large = CalculateDistance(ApproxNearestNeighbor(tree, query, 0.0, large_budget), query);
+        budget_regressions += (large > small);
+        budget_improvements += (large < small);
+    }
+
+    CHECK(bound_failures == 0);
+    CHECK(budget_regressions == 0);
+    CHECK(budget_improvements > 0);
+
+    DeallocKDTree(tree);
+    DeallocMainStarArray(array);
+}
+
+int main(void) {
+    TestStarIndexDuplicateNames();
+    TestJumpGraphNeedsWholeCatalog();
+    TestApproxNearestNeighbor();
+
+    if (failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All tests passed\n");
+    return 0;
+}
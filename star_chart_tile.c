@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "star_chart_utils.h"
+#include "star_chart_tiles.h"
+
+// Splits a star catalog .csv into a tiled on-disk catalog, then answers a sample query near
+// Sol under a small memory budget to show how little of the catalog it has to map.
+// usage: star_chart_tile [stars.csv] [stars.tiles] [tile size] [leaf size]
+int main(int argc, char **argv) {
+    const char *csv_path = (argc > 1) ? argv[1] : "stars.csv";
+    const char *directory = (argc > 2) ? argv[2] : "stars.tiles";
+    double tile_size = (argc > 3) ? atof(argv[3]) : TILES_DEFAULT_SIZE;
+    int leaf_size = (argc > 4) ? atoi(argv[4]) : KD_DEFAULT_LEAF_SIZE;
+
+    if (!BuildTiledCatalog(csv_path, directory, tile_size, leaf_size)) {
+        return 1;
+    }
+
+    TiledCatalog *catalog = OpenTiledCatalog(directory, 64UL << 20);
+    if (catalog == NULL) {
+        return 1;
+    }
+    printf("Wrote %ld stars in %d tiles to %s\n", catalog->star_count, catalog->tile_count, directory);
+
+    Position sol = {0.0, 0.0, 0.0};
+    StarArray *nearest = TiledNearestNeighbor(catalog, sol);
+    StarArray *nearby = TiledSearchRange(catalog, sol, DEFAULT_JUMP_RANGE);
+    if (nearest != NULL && nearest->size > 0) {
+        printf("Nearest star to Sol: %s\n", nearest->stars[0].name);
+    }
+    if (nearby != NULL) {
+        printf("%d stars within %.1f light years of Sol\n", nearby->size, DEFAULT_JUMP_RANGE);
+    }
+    printf("Mapped %lu of %d tiles (%.1f MB)\n", catalog->tile_loads, catalog->tile_count,
+           catalog->mapped_bytes / (1024.0 * 1024.0));
+
+    DeallocMainStarArray(nearest);
+    DeallocMainStarArray(nearby);
+    CloseTiledCatalog(catalog);
+
+    return 0;
+}
@@ -0,0 +1,929 @@
+#include "star_chart_tiles.h"
+#include <errno.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Joins a directory and a file name; the caller frees the result
+static char *TilePath(const char *directory, const char *file) {
+  size_t length = strlen(directory) + strlen(file) + 2;
+  char *path = malloc(length);
+  if (path != NULL) {
+    snprintf(path, length, "%s/%s", directory, file);
+  }
+  return path;
+}
+
+static char *TileFilePath(const char *directory, int tile) {
+  char file[32];
+  snprintf(file, sizeof(file), "tile_%d.snap", tile);
+  return TilePath(directory, file);
+}
+
+// TILED CATALOG BUILDING
+// The csv is read twice straight from its mapping: once to count the stars in every tile, once
+// to scatter each star's record into its tile's slice of an on-disk spill file. Tiles are then
+// built and written one at a time from their slice, so memory use follows the largest tile
+// rather than the whole catalog.
+typedef struct TileSpillRecord {
+  Position position;
+  uint64_t name_offset; // Where the star's name starts in the csv
+  float lightyears;
+  uint32_t name_length;
+} TileSpillRecord;
+
+// Open-addressing map from tile key to index in 'tiles'
+typedef struct TileTable {
+  int *slots; // Tile index + 1; 0 is empty
+  int slot_count;
+  TileEntry *tiles;
+  int tile_count;
+  int tile_capacity;
+} TileTable;
+
+static unsigned long TileKeyHash(const int32_t key[3]) {
+  unsigned long hash = ((unsigned long)(uint32_t)key[0] * 0x9e3779b97f4a7c15UL) ^
+                       ((unsigned long)(uint32_t)key[1] * 0xc2b2ae3d27d4eb4fUL) ^
+                       ((unsigned long)(uint32_t)key[2] * 0x165667b19e3779f9UL);
+  return hash ^ (hash >> 29);
+}
+
+// Slot table (tile index + 1; 0 is empty) over the first 'count' tiles; NULL if memory ran out
+static int *BuildTileSlots(const TileEntry *tiles, int count, int slot_count) {
+  int *slots = calloc(slot_count, sizeof(int));
+  if (slots == NULL) {
+    return NULL;
+  }
+
+  for (int i = 0; i < count; i++) {
+    unsigned long index = TileKeyHash(tiles[i].key) & (slot_count - 1);
+    while (slots[index] != 0) {
+      index = (index + 1) & (slot_count - 1);
+    }
+    slots[index] = i + 1;
+  }
+
+  return slots;
+}
+
+// Slot holding the tile with this key, or the empty slot where it would go
+static unsigned long ProbeTileSlot(const int *slots, int slot_count, const TileEntry *tiles, const int32_t key[3]) {
+  unsigned long index = TileKeyHash(key) & (slot_count - 1);
+  while (slots[index] != 0) {
+    const TileEntry *tile = &tiles[slots[index] - 1];
+    if (tile->key[0] == key[0] && tile->key[1] == key[1] && tile->key[2] == key[2]) {
+      break;
+    }
+    index = (index + 1) & (slot_count - 1);
+  }
+  return index;
+}
+
+static int GrowTileTable(TileTable *table) {
+  int slot_count = table->slot_count ? table->slot_count * 2 : 1024;
+  int *slots = BuildTileSlots(table->tiles, table->tile_count, slot_count);
+  if (slots == NULL) {
+    return 0;
+  }
+
+  free(table->slots);
+  table->slots = slots;
+  table->slot_count = slot_count;
+  return 1;
+}
+
+// Index of the tile with this key, added (empty) if new; -1 if memory ran out
+static int FindOrAddTile(TileTable *table, const int32_t key[3]) {
+  if (2 * (table->tile_count + 1) > table->slot_count && !GrowTileTable(table)) {
+    return -1;
+  }
+
+  unsigned long index = ProbeTileSlot(table->slots, table->slot_count, table->tiles, key);
+  if (table->slots[index] != 0) {
+    return table->slots[index] - 1;
+  }
+
+  if (table->tile_count == table->tile_capacity) {
+    int capacity = table->tile_capacity ? table->tile_capacity * 2 : 256;
+    TileEntry *tiles = realloc(table->tiles, capacity * sizeof(TileEntry));
+    if (tiles == NULL) {
+      return -1;
+    }
+    table->tiles = tiles;
+    table->tile_capacity = capacity;
+  }
+
+  TileEntry *tile = &table->tiles[table->tile_count];
+  memset(tile, 0, sizeof(TileEntry));
+  memcpy(tile->key, key, sizeof(tile->key));
+  for (int axis = 0; axis < 3; axis++) {
+    tile->low[axis] = DBL_MAX;
+    tile->high[axis] = -DBL_MAX;
+  }
+  table->slots[index] = ++table->tile_count;
+  return table->tile_count - 1;
+}
+
+static void TileKeyFor(const Position *position, double tile_size, int32_t key[3]) {
+  const double values[3] = {position->x, position->y, position->z};
+  for (int axis = 0; axis < 3; axis++) {
+    double cell = floor(values[axis] / tile_size);
+    key[axis] = (cell < INT32_MIN) ? INT32_MIN : (cell > INT32_MAX) ? INT32_MAX : (int32_t)cell;
+  }
+}
+
+// Advances *cursor past the next valid row and parses it; returns 0 at the end of the file
+static int NextCatalogRow(const char **cursor, const char *base, const char *end, TileSpillRecord *record) {
+  char line[1024];
+
+  while (*cursor < end) {
+    const char *row = *cursor;
+    const char *newline = memchr(row, '\n', end - row);
+    const char *line_end = newline ? newline : end;
+    size_t length = line_end - row;
+    if (length >= sizeof(line)) {
+      length = sizeof(line) - 1;
+    }
+    *cursor = line_end + 1;
+
+    memcpy(line, row, length);
+    line[length] = 0;
+
+    char *name;
+    if (ParseStarLine(line, &name, &record->position, &record->lightyears)) {
+      record->name_offset = (uint64_t)(row - base) + (uint64_t)(name - line);
+      record->name_length = (uint32_t)strlen(name);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// Builds one tile's StarArray, KD-tree and name index from its spill records and writes it
+// as a snapshot. Returns the file size, or 0 on failure.
+static uint64_t WriteTile(const char *path, const char *csv, const TileSpillRecord *records, int count, int leaf_size) {
+  size_t name_bytes = 0;
+  for (int i = 0; i < count; i++) {
+    name_bytes += records[i].name_length + 1;
+  }
+
+  uint64_t bytes = 0;
+  KDTree *tree = NULL;
+  HashMap *map = NULL;
+  StarArray *array = calloc(1, sizeof(StarArray));
+  if (array == NULL) {
+    fprintf(stderr, "ERROR [WriteTile()]: MEMORY ALLOCATION FAILED FOR STAR ARRAY!\n");
+    return 0;
+  }
+  array->stars = malloc(count * sizeof(Star));
+  array->position_pool = malloc(count * sizeof(Position));
+  array->name_pool = malloc(name_bytes);
+  if (array->stars == NULL || array->position_pool == NULL || array->name_pool == NULL) {
+    fprintf(stderr, "ERROR [WriteTile()]: MEMORY ALLOCATION FAILED FOR TILE STORAGE!\n");
+    goto done;
+  }
+  array->size = count;
+  array->capacity = count;
+  array->name_pool_size = name_bytes;
+  array->position_pool_size = count;
+
+  char *name = array->name_pool;
+  for (int i = 0; i < count; i++) {
+    memcpy(name, csv + records[i].name_offset, records[i].name_length);
+    name[records[i].name_length] = '\0';
+    array->position_pool[i] = records[i].position;
+    array->stars[i].name = name;
+    array->stars[i].position = &array->position_pool[i];
+    array->stars[i].lightyears = records[i].lightyears;
+    name += records[i].name_length + 1;
+  }
+
+  tree = CreateBalancedKDTree(array, leaf_size);
+  map = CreateHashMap(array, count);
+  struct stat file_info;
+  if (tree != NULL && map != NULL && WriteSnapshot(path, array, tree, map) && stat(path, &file_info) == 0) {
+    bytes = (uint64_t)file_info.st_size;
+  }
+
+done:
+  DeallocHashMap(map);
+  DeallocKDTree(tree);
+  DeallocMainStarArray(array);
+  return bytes;
+}
+
+static int WriteTileIndex(const char *directory, const TileIndexHeader *header, const TileEntry *tiles) {
+  char *path = TilePath(directory, TILES_INDEX_NAME);
+  char *temp_path = TilePath(directory, TILES_INDEX_NAME ".tmp");
+  if (path == NULL || temp_path == NULL) {
+    free(path);
+    free(temp_path);
+    return 0;
+  }
+
+  FILE *file = fopen(temp_path, "wb");
+  int written = file != NULL && fwrite(header, sizeof(TileIndexHeader), 1, file) == 1 &&
+                fwrite(tiles, sizeof(TileEntry), header->tile_count, file) == (size_t)header->tile_count;
+  if (file != NULL && fclose(file) != 0) {
+    written = 0;
+  }
+  if (!written || rename(temp_path, path) != 0) {
+    remove(temp_path);
+    written = 0;
+  }
+
+  free(path);
+  free(temp_path);
+  return written;
+}
+
+// Splits csv_path into tiles of tile_size light years under directory (created if needed).
+// Returns 1 on success.
+int BuildTiledCatalog(const char *csv_path, const char *directory, double tile_size, int leaf_size) {
+  if (!(tile_size > 0.0)) {
+    fprintf(stderr, "ERROR [BuildTiledCatalog()]: TILE SIZE MUST BE POSITIVE!\n");
+    return 0;
+  }
+  struct stat file_info;
+  if ((mkdir(directory, 0755) != 0 && errno != EEXIST) || stat(directory, &file_info) != 0 ||
+      !S_ISDIR(file_info.st_mode)) {
+    fprintf(stderr, "ERROR [BuildTiledCatalog()]: FAILED TO CREATE CATALOG DIRECTORY!\n");
+    return 0;
+  }
+
+  int fd = open(csv_path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "ERROR [BuildTiledCatalog()]: FILE FAILED TO OPEN!\n");
+    return 0;
+  }
+  if (fstat(fd, &file_info) != 0 || file_info.st_size == 0) {
+    fprintf(stderr, "ERROR [BuildTiledCatalog()]: CATALOG FILE IS EMPTY OR UNREADABLE!\n");
+    close(fd);
+    return 0;
+  }
+  size_t csv_bytes = (size_t)file_info.st_size;
+  const char *csv = mmap(NULL, csv_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (csv == MAP_FAILED) {
+    fprintf(stderr, "ERROR [BuildTiledCatalog()]: FAILED TO MAP FILE!\n");
+    return 0;
+  }
+  madvise((void *)csv, csv_bytes, MADV_SEQUENTIAL);
+
+  int built = 0;
+  TileTable table = {NULL, 0, NULL, 0, 0};
+  long *cursors = NULL;
+  char *spill_path = TilePath(directory, "tiles.spill");
+  TileSpillRecord *spill = MAP_FAILED;
+  size_t spill_bytes = 0;
+  TileSpillRecord record;
+  if (spill_path == NULL) {
+    fprintf(stderr, "ERROR [BuildTiledCatalog()]: MEMORY ALLOCATION FAILED FOR FILE NAME!\n");
+    goto done;
+  }
+
+  // Pass 1: count and bound every tile
+  long star_count = 0;
+  const char *cursor = csv;
+  while (NextCatalogRow(&cursor, csv, csv + csv_bytes, &record)) {
+    int32_t key[3];
+    TileKeyFor(&record.position, tile_size, key);
+    int tile_index = FindOrAddTile(&table, key);
+    if (tile_index < 0) {
+      fprintf(stderr, "ERROR [BuildTiledCatalog()]: MEMORY ALLOCATION FAILED FOR TILE TABLE!\n");
+      goto done;
+    }
+
+    TileEntry *tile = &table.tiles[tile_index];
+    if (tile->star_count == INT32_MAX) {
+      fprintf(stderr, "ERROR [BuildTiledCatalog()]: TOO MANY STARS IN ONE TILE, USE A SMALLER TILE SIZE!\n");
+      goto done;
+    }
+    tile->star_count++;
+    const double values[3] = {record.position.x, record.position.y, record.position.z};
+    for (int axis = 0; axis < 3; axis++) {
+      tile->low[axis] = (values[axis] < tile->low[axis]) ? values[axis] : tile->low[axis];
+      tile->high[axis] = (values[axis] > tile->high[axis]) ? values[axis] : tile->high[axis];
+    }
+    star_count++;
+  }
+
+  // Pass 2: scatter records into per-tile slices of the spill file
+  cursors = malloc((table.tile_count > 0 ? table.tile_count : 1) * sizeof(long));
+  if (cursors == NULL) {
+    fprintf(stderr, "ERROR [BuildTiledCatalog()]: MEMORY ALLOCATION FAILED FOR TILE CURSORS!\n");
+    goto done;
+  }
+  long offset = 0;
+  for (int i = 0; i < table.tile_count; i++) {
+    cursors[i] = offset;
+    offset += table.tiles[i].star_count;
+  }
+
+  if (star_count > 0) {
+    spill_bytes = (size_t)star_count * sizeof(TileSpillRecord);
+    fd = open(spill_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)spill_bytes) != 0) {
+      fprintf(stderr, "ERROR [BuildTiledCatalog()]: FAILED TO CREATE SPILL FILE!\n");
+      if (fd >= 0) {
+        close(fd);
+      }
+      goto done;
+    }
+    spill = mmap(NULL, spill_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (spill == MAP_FAILED) {
+      fprintf(stderr, "ERROR [BuildTiledCatalog()]: FAILED TO MAP SPILL FILE!\n");
+      goto done;
+    }
+  }
+
+  cursor = csv;
+  while (NextCatalogRow(&cursor, csv, csv + csv_bytes, &record)) {
+    int32_t key[3];
+    TileKeyFor(&record.position, tile_size, key);
+    spill[cursors[FindOrAddTile(&table, key)]++] = record;
+  }
+
+  // Pass 3: one snapshot per tile
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  size_t released = 0; // Spill bytes already unmapped; always whole pages
+  const TileSpillRecord *records = spill;
+  for (int i = 0; i < table.tile_count; i++) {
+    char *path = TileFilePath(directory, i);
+    table.tiles[i].bytes = path ? WriteTile(path, csv, records, table.tiles[i].star_count, leaf_size) : 0;
+    free(path);
+    if (table.tiles[i].bytes == 0) {
+      fprintf(stderr, "ERROR [BuildTiledCatalog()]: FAILED TO WRITE TILE %d!\n", i);
+      goto done;
+    }
+    records += table.tiles[i].star_count;
+
+    // Records of written tiles are not read again. Unmap every whole page before the next tile
+    // so the spill's resident set stays small; madvise() needs page-aligned ranges.
+    size_t written = (size_t)((const char *)records - (const char *)spill) / page_size * page_size;
+    if (written > released) {
+      madvise((char *)spill + released, written - released, MADV_DONTNEED);
+      released = written;
+    }
+  }
+
+  TileIndexHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TILES_MAGIC, sizeof(header.magic));
+  header.version = TILES_VERSION;
+  header.byte_order = SNAPSHOT_BYTE_ORDER;
+  header.entry_bytes = sizeof(TileEntry);
+  header.tile_count = table.tile_count;
+  header.star_count = star_count;
+  header.tile_size = tile_size;
+  built = WriteTileIndex(directory, &header, table.tiles);
+  if (!built) {
+    fprintf(stderr, "ERROR [BuildTiledCatalog()]: FAILED TO WRITE TILE INDEX!\n");
+  }
+
+done:
+  if (spill != MAP_FAILED) {
+    munmap(spill, spill_bytes);
+  }
+  if (spill_path != NULL) {
+    remove(spill_path);
+  }
+  free(spill_path);
+  free(cursors);
+  free(table.slots);
+  free(table.tiles);
+  munmap((void *)csv, csv_bytes);
+  return built;
+}
+
+// TILED CATALOG LOADING
+// Only the tile index is read up front; a tile is mapped (OpenSnapshot()) the first time a
+// query's region overlaps its bounding box.
+TiledCatalog *OpenTiledCatalog(const char *directory, size_t memory_budget) {
+  char *path = TilePath(directory, TILES_INDEX_NAME);
+  FILE *file = path ? fopen(path, "rb") : NULL;
+  free(path);
+  if (file == NULL) {
+    fprintf(stderr, "ERROR [OpenTiledCatalog()]: TILE INDEX FAILED TO OPEN!\n");
+    return NULL;
+  }
+
+  TileIndexHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TILES_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != TILES_VERSION || header.byte_order != SNAPSHOT_BYTE_ORDER ||
+      header.entry_bytes != sizeof(TileEntry) || header.tile_count < 0 || !(header.tile_size > 0.0)) {
+    fprintf(stderr, "ERROR [OpenTiledCatalog()]: TILE INDEX IS INVALID OR FROM ANOTHER VERSION!\n");
+    fclose(file);
+    return NULL;
+  }
+
+  int count = header.tile_count;
+  TiledCatalog *catalog = calloc(1, sizeof(TiledCatalog));
+  if (catalog == NULL) {
+    fprintf(stderr, "ERROR [OpenTiledCatalog()]: MEMORY ALLOCATION FAILED FOR CATALOG!\n");
+    fclose(file);
+    return NULL;
+  }
+  pthread_mutex_init(&catalog->lock, NULL);
+  catalog->directory = strdup(directory);
+  catalog->tiles = malloc((count > 0 ? count : 1) * sizeof(TileEntry));
+  catalog->open = calloc(count > 0 ? count : 1, sizeof(StarSnapshot *));
+  catalog->pins = calloc(count > 0 ? count : 1, sizeof(int));
+  catalog->lru_prev = malloc((count > 0 ? count : 1) * sizeof(int));
+  catalog->lru_next = malloc((count > 0 ? count : 1) * sizeof(int));
+  catalog->lru_head = -1;
+  catalog->lru_tail = -1;
+  if (catalog->directory == NULL || catalog->tiles == NULL || catalog->open == NULL ||
+      catalog->pins == NULL || catalog->lru_prev == NULL || catalog->lru_next == NULL) {
+    fprintf(stderr, "ERROR [OpenTiledCatalog()]: MEMORY ALLOCATION FAILED FOR TILE TABLE!\n");
+    fclose(file);
+    CloseTiledCatalog(catalog);
+    return NULL;
+  }
+  if (fread(catalog->tiles, sizeof(TileEntry), count, file) != (size_t)count) {
+    fprintf(stderr, "ERROR [OpenTiledCatalog()]: TILE INDEX IS TRUNCATED!\n");
+    fclose(file);
+    CloseTiledCatalog(catalog);
+    return NULL;
+  }
+  fclose(file);
+
+  catalog->key_slot_count = 16;
+  while (catalog->key_slot_count < 2 * count) {
+    catalog->key_slot_count *= 2;
+  }
+  catalog->key_slots = BuildTileSlots(catalog->tiles, count, catalog->key_slot_count);
+  if (catalog->key_slots == NULL) {
+    fprintf(stderr, "ERROR [OpenTiledCatalog()]: MEMORY ALLOCATION FAILED FOR TILE KEYS!\n");
+    CloseTiledCatalog(catalog);
+    return NULL;
+  }
+  for (int axis = 0; axis < 3; axis++) {
+    catalog->key_low[axis] = INT32_MAX;
+    catalog->key_high[axis] = INT32_MIN;
+  }
+  for (int tile = 0; tile < count; tile++) {
+    for (int axis = 0; axis < 3; axis++) {
+      int32_t key = catalog->tiles[tile].key[axis];
+      catalog->key_low[axis] = (key < catalog->key_low[axis]) ? key : catalog->key_low[axis];
+      catalog->key_high[axis] = (key > catalog->key_high[axis]) ? key : catalog->key_high[axis];
+    }
+  }
+
+  catalog->tile_count = count;
+  catalog->star_count = header.star_count;
+  catalog->tile_size = header.tile_size;
+  catalog->budget = memory_budget;
+  return catalog;
+}
+
+static size_t TileMappedBytes(const StarSnapshot *snapshot) {
+  return snapshot->bytes + snapshot->array->size * sizeof(Star);
+}
+
+// Index of the tile with this key, or -1 if that region holds no stars
+static int FindTile(const TiledCatalog *catalog, const int32_t key[3]) {
+  unsigned long index = ProbeTileSlot(catalog->key_slots, catalog->key_slot_count, catalog->tiles, key);
+  return catalog->key_slots[index] - 1;
+}
+
+// The LRU list holds exactly the mapped tiles with no pins, so eviction takes its tail
+static void UnlinkLruTile(TiledCatalog *catalog, int tile) {
+  int prev = catalog->lru_prev[tile];
+  int next = catalog->lru_next[tile];
+  if (prev >= 0) {
+    catalog->lru_next[prev] = next;
+  } else {
+    catalog->lru_head = next;
+  }
+  if (next >= 0) {
+    catalog->lru_prev[next] = prev;
+  } else {
+    catalog->lru_tail = prev;
+  }
+}
+
+static void PushLruTile(TiledCatalog *catalog, int tile) {
+  catalog->lru_prev[tile] = -1;
+  catalog->lru_next[tile] = catalog->lru_head;
+  if (catalog->lru_head >= 0) {
+    catalog->lru_prev[catalog->lru_head] = tile;
+  } else {
+    catalog->lru_tail = tile;
+  }
+  catalog->lru_head = tile;
+}
+
+// Maps the tile if needed (evicting unpinned tiles, least recently used first, to stay within
+// the budget) and pins it. Returns NULL if the tile could not be opened.
+static StarSnapshot *AcquireTile(TiledCatalog *catalog, int tile) {
+  pthread_mutex_lock(&catalog->lock);
+
+  if (catalog->open[tile] == NULL) {
+    size_t needed = catalog->tiles[tile].bytes + catalog->tiles[tile].star_count * sizeof(Star);
+    while (catalog->mapped_bytes + needed > catalog->budget && catalog->lru_tail >= 0) {
+      int victim = catalog->lru_tail;
+      UnlinkLruTile(catalog, victim);
+      catalog->mapped_bytes -= TileMappedBytes(catalog->open[victim]);
+      CloseSnapshot(catalog->open[victim]);
+      catalog->open[victim] = NULL;
+      catalog->tile_evictions++;
+    }
+
+    char *path = TileFilePath(catalog->directory, tile);
+    catalog->open[tile] = path ? OpenSnapshot(path) : NULL;
+    free(path);
+    if (catalog->open[tile] == NULL) {
+      fprintf(stderr, "ERROR [AcquireTile()]: FAILED TO OPEN TILE %d!\n", tile);
+      pthread_mutex_unlock(&catalog->lock);
+      return NULL;
+    }
+    catalog->mapped_bytes += TileMappedBytes(catalog->open[tile]);
+    catalog->tile_loads++;
+  } else if (catalog->pins[tile] == 0) {
+    UnlinkLruTile(catalog, tile);
+  }
+
+  catalog->pins[tile]++;
+  StarSnapshot *snapshot = catalog->open[tile];
+  pthread_mutex_unlock(&catalog->lock);
+  return snapshot;
+}
+
+static void ReleaseTile(TiledCatalog *catalog, int tile) {
+  pthread_mutex_lock(&catalog->lock);
+  if (--catalog->pins[tile] == 0) {
+    PushLruTile(catalog, tile);
+  }
+  pthread_mutex_unlock(&catalog->lock);
+}
+
+// Squared distance from reference to the tile's bounding box
+static double TileBoxDistance(const TileEntry *tile, const Position reference) {
+  const double values[3] = {reference.x, reference.y, reference.z};
+  double distance = 0.0;
+  for (int axis = 0; axis < 3; axis++) {
+    double gap = (values[axis] < tile->low[axis]) ? tile->low[axis] - values[axis]
+               : (values[axis] > tile->high[axis]) ? values[axis] - tile->high[axis] : 0.0;
+    distance += gap * gap;
+  }
+  return distance;
+}
+
+// TILED CATALOG QUERIES
+typedef struct TileVisit {
+  const Star *stars;
+  TiledStarVisitor visitor;
+  void *user_data;
+  int stopped;
+} TileVisit;
+
+static int VisitTileStar(void *user_data, int id, double distance_sq) {
+  TileVisit *visit = user_data;
+  if (!visit->visitor(visit->user_data, &visit->stars[id], distance_sq)) {
+    visit->stopped = 1;
+    return 0;
+  }
+  return 1;
+}
+
+// Searches one tile; returns 0 if the visitor asked to stop
+static int VisitRadiusTile(TiledCatalog *catalog, int tile, const Position center, double radius,
+                           TiledStarVisitor visitor, void *user_data) {
+  if (TileBoxDistance(&catalog->tiles[tile], center) > radius * radius) {
+    return 1;
+  }
+  StarSnapshot *snapshot = AcquireTile(catalog, tile);
+  if (snapshot == NULL) {
+    return 1;
+  }
+
+  TileVisit visit = {snapshot->array->stars, visitor, user_data, 0};
+  RadiusSearchVisit(snapshot->tree, center, radius, VisitTileStar, &visit);
+  ReleaseTile(catalog, tile);
+  return !visit.stopped;
+}
+
+// Calls visitor for every star within radius of center, tile by tile (unordered). The tile keys
+// the sphere can reach are looked up directly, unless there are more of them than tiles, in
+// which case every tile's bounding box is tested instead.
+void TiledRadiusVisit(TiledCatalog *catalog, const Position center, double radius, TiledStarVisitor visitor, void *user_data) {
+  if (catalog == NULL || radius < 0.0 || catalog->tile_count == 0) {
+    return;
+  }
+
+  const double values[3] = {center.x, center.y, center.z};
+  long low[3];
+  long high[3];
+  double key_count = 1.0;
+  for (int axis = 0; axis < 3; axis++) {
+    double first = floor((values[axis] - radius) / catalog->tile_size);
+    double last = floor((values[axis] + radius) / catalog->tile_size);
+    first = (first > catalog->key_low[axis]) ? first : catalog->key_low[axis];
+    last = (last < catalog->key_high[axis]) ? last : catalog->key_high[axis];
+    if (!(first <= last)) {
+      return; // The sphere misses every tile on this axis
+    }
+    low[axis] = (long)first;
+    high[axis] = (long)last;
+    key_count *= last - first + 1.0;
+  }
+
+  if (key_count > catalog->tile_count) {
+    for (int tile = 0; tile < catalog->tile_count; tile++) {
+      if (!VisitRadiusTile(catalog, tile, center, radius, visitor, user_data)) {
+        return;
+      }
+    }
+    return;
+  }
+
+  for (long x = low[0]; x <= high[0]; x++) {
+    for (long y = low[1]; y <= high[1]; y++) {
+      for (long z = low[2]; z <= high[2]; z++) {
+        const int32_t key[3] = {(int32_t)x, (int32_t)y, (int32_t)z};
+        int tile = FindTile(catalog, key);
+        if (tile >= 0 && !VisitRadiusTile(catalog, tile, center, radius, visitor, user_data)) {
+          return;
+        }
+      }
+    }
+  }
+}
+
+// Results are copied out of the tiles (which may be unmapped at any time) into a StarArray
+// that owns its names and positions; free it with DeallocMainStarArray().
+typedef struct StarCopies {
+  StarArray *array;
+  size_t *name_offsets;
+  size_t names_used;
+  int failed;
+} StarCopies;
+
+static int CopyStar(void *user_data, const Star *star, double distance_sq) {
+  (void)distance_sq;
+  StarCopies *copies = user_data;
+  StarArray *array = copies->array;
+  size_t name_length = strlen(star->name) + 1;
+
+  if (array->size == array->capacity) {
+    int capacity = array->capacity ? array->capacity * 2 : 64;
+    Star *stars = realloc(array->stars, capacity * sizeof(Star));
+    if (stars != NULL) {
+      array->stars = stars;
+    }
+    Position *positions = realloc(array->position_pool, capacity * sizeof(Position));
+    if (positions != NULL) {
+      array->position_pool = positions;
+    }
+    size_t *name_offsets = realloc(copies->name_offsets, capacity * sizeof(size_t));
+    if (name_offsets != NULL) {
+      copies->name_offsets = name_offsets;
+    }
+    if (stars == NULL || positions == NULL || name_offsets == NULL) {
+      copies->failed = 1;
+      return 0;
+    }
+    array->capacity = capacity;
+    array->position_pool_size = capacity;
+  }
+  if (copies->names_used + name_length > array->name_pool_size) {
+    size_t pool_size = array->name_pool_size ? array->name_pool_size * 2 : 4096;
+    while (pool_size < copies->names_used + name_length) {
+      pool_size *= 2;
+    }
+    char *pool = realloc(array->name_pool, pool_size);
+    if (pool == NULL) {
+      copies->failed = 1;
+      return 0;
+    }
+    array->name_pool = pool;
+    array->name_pool_size = pool_size;
+  }
+
+  memcpy(array->name_pool + copies->names_used, star->name, name_length);
+  copies->name_offsets[array->size] = copies->names_used;
+  copies->names_used += name_length;
+  array->position_pool[array->size] = *star->position;
+  array->stars[array->size].lightyears = star->lightyears;
+  array->size++;
+  return 1;
+}
+
+// Points the copied stars at their pooled names and positions now that the pools stop moving
+static StarArray *FinishStarCopies(StarCopies *copies, const char *caller) {
+  StarArray *array = copies->array;
+  for (int i = 0; !copies->failed && i < array->size; i++) {
+    array->stars[i].name = array->name_pool + copies->name_offsets[i];
+    array->stars[i].position = &array->position_pool[i];
+  }
+  free(copies->name_offsets);
+  if (copies->failed) {
+    fprintf(stderr, "ERROR [%s()]: MEMORY ALLOCATION FAILED FOR RESULTS!\n", caller);
+    DeallocMainStarArray(array);
+    return NULL;
+  }
+  return array;
+}
+
+StarArray *TiledSearchRange(TiledCatalog *catalog, const Position center, double radius) {
+  StarCopies copies = {calloc(1, sizeof(StarArray)), NULL, 0, 0};
+  if (copies.array == NULL) {
+    fprintf(stderr, "ERROR [TiledSearchRange()]: MEMORY ALLOCATION FAILED FOR STAR ARRAY!\n");
+    return NULL;
+  }
+
+  TiledRadiusVisit(catalog, center, radius, CopyStar, &copies);
+  return FinishStarCopies(&copies, "TiledSearchRange");
+}
+
+// Nearest-star search state. Tiles are visited in rings of tile keys around the reference's
+// key: ring r holds the keys whose largest per-axis difference is r, and none of its stars can
+// be closer than (r - 1) * tile_size, so rings are only expanded while that bound can still
+// beat the best star found.
+typedef struct TileRingSearch {
+  TiledCatalog *catalog;
+  Position reference;
+  double center_key[3];
+  MinHeap queue;  // Tiles found in expanded rings, keyed by squared box distance
+  int *queue_index;
+  double best_distance; // Squared
+} TileRingSearch;
+
+static void QueueNearTile(TileRingSearch *search, int tile) {
+  double distance = TileBoxDistance(&search->catalog->tiles[tile], search->reference);
+  if (distance < search->best_distance) {
+    HeapPush(&search->queue, search->queue_index, tile, distance);
+  }
+}
+
+// Number of keys within the catalog's key bounds that lie at most 'ring' from the center key
+static double TileKeysWithin(const TileRingSearch *search, double ring) {
+  const TiledCatalog *catalog = search->catalog;
+  double count = 1.0;
+  for (int axis = 0; axis < 3; axis++) {
+    double first = search->center_key[axis] - ring;
+    double last = search->center_key[axis] + ring;
+    first = (first > catalog->key_low[axis]) ? first : catalog->key_low[axis];
+    last = (last < catalog->key_high[axis]) ? last : catalog->key_high[axis];
+    if (!(first <= last)) {
+      return 0.0;
+    }
+    count *= last - first + 1.0;
+  }
+  return count;
+}
+
+static void QueueTileKey(TileRingSearch *search, long x, long y, long z) {
+  const int32_t key[3] = {(int32_t)x, (int32_t)y, (int32_t)z};
+  int tile = FindTile(search->catalog, key);
+  if (tile >= 0) {
+    QueueNearTile(search, tile);
+  }
+}
+
+static void QueueTileRing(TileRingSearch *search, double ring) {
+  const TiledCatalog *catalog = search->catalog;
+  const double *center = search->center_key;
+  long low[3];
+  long high[3];
+  for (int axis = 0; axis < 3; axis++) {
+    double first = center[axis] - ring;
+    double last = center[axis] + ring;
+    low[axis] = (long)((first > catalog->key_low[axis]) ? first : catalog->key_low[axis]);
+    high[axis] = (long)((last < catalog->key_high[axis]) ? last : catalog->key_high[axis]);
+  }
+
+  for (long x = low[0]; x <= high[0]; x++) {
+    for (long y = low[1]; y <= high[1]; y++) {
+      if (fabs(x - center[0]) == ring || fabs(y - center[1]) == ring) {
+        for (long z = low[2]; z <= high[2]; z++) {
+          QueueTileKey(search, x, y, z);
+        }
+        continue;
+      }
+
+      // Inside the ring's x/y extent only its two z faces belong to it
+      const double faces[2] = {center[2] - ring, center[2] + ring};
+      for (int face = 0; face < 2; face++) {
+        if (faces[face] >= low[2] && faces[face] <= high[2]) {
+          QueueTileKey(search, x, y, (long)faces[face]);
+        }
+      }
+    }
+  }
+}
+
+// The nearest star as a one-star array (empty for an empty catalog). Tiles are searched in
+// order of their distance from reference, stopping once no queued tile or unexpanded ring can
+// hold a star closer than the best one found, with the bound carried from tile to tile.
+StarArray *TiledNearestNeighbor(TiledCatalog *catalog, const Position reference) {
+  int capacity = (catalog->tile_count > 0) ? catalog->tile_count : 1;
+  StarCopies copies = {calloc(1, sizeof(StarArray)), NULL, 0, 0};
+  TileRingSearch search = {catalog, reference, {0.0, 0.0, 0.0}, {NULL, NULL, 0, capacity}, NULL, DBL_MAX};
+  search.queue.ids = malloc(capacity * sizeof(int));
+  search.queue.keys = malloc(capacity * sizeof(double));
+  search.queue_index = malloc(capacity * sizeof(int));
+  if (copies.array == NULL || search.queue.ids == NULL || search.queue.keys == NULL || search.queue_index == NULL) {
+    fprintf(stderr, "ERROR [TiledNearestNeighbor()]: MEMORY ALLOCATION FAILED!\n");
+    free(copies.array);
+    free(search.queue.ids);
+    free(search.queue.keys);
+    free(search.queue_index);
+    return NULL;
+  }
+
+  // Rings before first_ring lie wholly outside the catalog's key bounds, rings after last_ring too
+  const double values[3] = {reference.x, reference.y, reference.z};
+  double first_ring = 0.0;
+  double last_ring = (catalog->tile_count > 0) ? 0.0 : -1.0;
+  for (int axis = 0; axis < 3; axis++) {
+    double key = floor(values[axis] / catalog->tile_size);
+    double below = catalog->key_low[axis] - key;
+    double above = key - catalog->key_high[axis];
+    search.center_key[axis] = key;
+    first_ring = (below > first_ring) ? below : first_ring;
+    first_ring = (above > first_ring) ? above : first_ring;
+    last_ring = (-below > last_ring) ? -below : last_ring;
+    last_ring = (-above > last_ring) ? -above : last_ring;
+  }
+
+  // Once enumerating keys would cost more than this many lookups, the remaining tiles are
+  // queued straight from the tile list instead
+  double lookups_left = catalog->tile_count;
+  double ring = first_ring;
+  while (!copies.failed) {
+    double ring_bound = (ring > last_ring) ? DBL_MAX : (ring > 0.0) ? (ring - 1.0) * catalog->tile_size : 0.0;
+    double ring_bound_sq = (ring_bound == DBL_MAX) ? DBL_MAX : ring_bound * ring_bound;
+
+    while (!copies.failed && search.queue.size > 0 && search.queue.keys[0] < search.best_distance &&
+           search.queue.keys[0] <= ring_bound_sq) {
+      int tile = HeapPopMin(&search.queue, search.queue_index);
+      StarSnapshot *snapshot = AcquireTile(catalog, tile);
+      if (snapshot == NULL) {
+        continue;
+      }
+      int found = NearestNeighborSearch(snapshot->tree, 0, reference, -1, &search.best_distance);
+      if (found >= 0) {
+        copies.array->size = 0;
+        copies.names_used = 0;
+        CopyStar(&copies, &snapshot->array->stars[found], search.best_distance);
+      }
+      ReleaseTile(catalog, tile);
+    }
+    if (ring > last_ring || ring_bound_sq >= search.best_distance) {
+      break;
+    }
+
+    double ring_keys = TileKeysWithin(&search, ring) - ((ring > 0.0) ? TileKeysWithin(&search, ring - 1.0) : 0.0);
+    if (ring_keys > lookups_left) {
+      for (int tile = 0; tile < catalog->tile_count; tile++) {
+        double distance = 0.0;
+        for (int axis = 0; axis < 3; axis++) {
+          double difference = fabs(catalog->tiles[tile].key[axis] - search.center_key[axis]);
+          distance = (difference > distance) ? difference : distance;
+        }
+        if (distance >= ring) {
+          QueueNearTile(&search, tile);
+        }
+      }
+      ring = last_ring + 1.0;
+      continue;
+    }
+    lookups_left -= ring_keys;
+    QueueTileRing(&search, ring);
+    ring += 1.0;
+  }
+
+  free(search.queue.ids);
+  free(search.queue.keys);
+  free(search.queue_index);
+  return FinishStarCopies(&copies, "TiledNearestNeighbor");
+}
+
+void CloseTiledCatalog(TiledCatalog *catalog) {
+  if (catalog == NULL) {
+    return;
+  }
+
+  for (int tile = 0; catalog->open != NULL && tile < catalog->tile_count; tile++) {
+    CloseSnapshot(catalog->open[tile]);
+  }
+  pthread_mutex_destroy(&catalog->lock);
+  free(catalog->directory);
+  free(catalog->tiles);
+  free(catalog->open);
+  free(catalog->pins);
+  free(catalog->lru_prev);
+  free(catalog->lru_next);
+  free(catalog->key_slots);
+  free(catalog);
+}
@@ -0,0 +1,76 @@
+#ifndef STAR_CHART_TILES_H
+#define STAR_CHART_TILES_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "star_chart_utils.h"
+#include "star_chart_snapshot.h"
+
+// Out-of-core catalog: space is cut into cubic tiles of 'tile_size' light years and every
+// non-empty tile is an ordinary snapshot (stars, KD-tree, name index) in the catalog directory.
+// TILES_INDEX_NAME lists each tile with its bounding box, so queries only map the tiles their
+// region overlaps. Built by BuildTiledCatalog() (see star_chart_tile.c), opened with
+// OpenTiledCatalog().
+#define TILES_MAGIC "STARTILE"
+#define TILES_VERSION 1
+#define TILES_INDEX_NAME "tiles.idx"
+#define TILES_DEFAULT_SIZE 500.0
+
+typedef struct TileIndexHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;  // SNAPSHOT_BYTE_ORDER as seen by the writer
+	uint32_t entry_bytes; // sizeof(TileEntry)
+	int32_t tile_count;
+	int64_t star_count;
+	double tile_size;
+} TileIndexHeader;
+
+// Tile (key[0], key[1], key[2]) covers [key * tile_size, (key + 1) * tile_size) on each axis;
+// low/high is the tighter box around the stars it actually holds.
+typedef struct TileEntry {
+	int32_t key[3];
+	int32_t star_count;
+	double low[3];
+	double high[3];
+	uint64_t bytes; // Snapshot file size
+} TileEntry;
+
+// An opened tiled catalog. Tiles are mapped on first use and the least recently used ones are
+// unmapped whenever the mapped total would pass 'budget' bytes. A tile in use by a query is
+// pinned and never evicted, so the budget can be exceeded while one query spans many tiles.
+// Safe to query from several threads at once.
+typedef struct TiledCatalog {
+	char* directory;
+	TileEntry* tiles;
+	int tile_count;
+	long star_count;
+	double tile_size;
+	int* key_slots;            // Open-addressing table from tile key to tile index + 1; 0 is empty
+	int key_slot_count;
+	int32_t key_low[3];        // Smallest and largest tile key on each axis
+	int32_t key_high[3];
+	StarSnapshot** open;       // Mapped tiles; NULL while a tile is on disk only
+	int* pins;
+	int* lru_prev;             // Mapped, unpinned tiles, most recently released first
+	int* lru_next;
+	int lru_head;              // -1 when no tile can be evicted
+	int lru_tail;
+	size_t budget;
+	size_t mapped_bytes;
+	unsigned long tile_loads;
+	unsigned long tile_evictions;
+	pthread_mutex_t lock;
+} TiledCatalog;
+
+// Called once per hit; star is only valid for the duration of the call. Return 0 to stop.
+typedef int (*TiledStarVisitor)(void* user_data, const Star* star, double distance_sq);
+
+int BuildTiledCatalog(const char* csv_path, const char* directory, double tile_size, int leaf_size);
+TiledCatalog* OpenTiledCatalog(const char* directory, size_t memory_budget);
+void TiledRadiusVisit(TiledCatalog* catalog, const Position center, double radius, TiledStarVisitor visitor, void* user_data);
+StarArray* TiledSearchRange(TiledCatalog* catalog, const Position center, double radius);
+StarArray* TiledNearestNeighbor(TiledCatalog* catalog, const Position reference);
+void CloseTiledCatalog(TiledCatalog* catalog);
+
+#endif
@@ -4,6 +4,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <float.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 // GLOBAL VARIABLES
 // Position player_position = {0.0, 0.0, 0.0}; // Sol
@@ -13,67 +24,564 @@ Position player_position = {0.01, 0.0, 0.01}; // Sol-ish
 // Position player_position = {10.28, 5.02, -3.29}; //Tau Ceti-ish
 
 // READ DATABASE FILE
-StarArray *ParseFile() {
-  FILE *file = fopen("stars.csv", "r");
-  if (file == NULL) {
-    fprintf(stderr, "ERROR [ParseFile()]: FILE FAILED TO OPEN!\n");
-    return NULL;
+// Rows are split across worker threads in line-aligned chunks of the mapped file. Every
+// chunk is parsed twice: once to count lines (upper bound on rows) and once to fill its
+// slice of the shared star/position arrays, so no row ever touches the heap on its own.
+typedef struct ParseChunk {
+  const char *begin;
+  const char *end;
+  const char *file_base;
+  char *name_pool;
+  Star *stars;
+  Position *positions;
+  unsigned int *hashes; // Slot hash of each row's name (LoadStarCatalog()); NULL to skip
+  int row_capacity;
+  int row_count;
+} ParseChunk;
+
+static int CountChunkLines(const char *begin, const char *end) {
+  int lines = 0;
+  const char *cursor = begin;
+
+  while (cursor < end) {
+    const char *newline = memchr(cursor, '\n', end - cursor);
+    lines++;
+    if (newline == NULL) {
+      break;
+    }
+    cursor = newline + 1;
+  }
+
+  return lines;
+}
+
+// Parses one catalog row held in 'line' (NUL terminated; tokenized in place). On success
+// points *name into line, fills in the converted position and returns 1; headers, blank and
+// malformed rows return 0.
+int ParseStarLine(char *line, char **name, Position *position, float *lightyears) {
+  const int max_tokens = 8;
+  char *tokens[max_tokens];
+  int token_count = 0;
+  char *save = NULL;
+
+  char *token = strtok_r(line, ",", &save);
+  while (token != NULL && token_count < max_tokens) {
+    tokens[token_count++] = token;
+    token = strtok_r(NULL, ",", &save);
+  }
+
+  if (token_count != max_tokens) {
+    return 0;
   }
 
-  int max_tokens = 8;
+  int raHours = (int)strtod(tokens[1], NULL);
+  double raMinutes = strtod(tokens[2], NULL);
+  double raSeconds = strtod(tokens[3], NULL);
+  int decDegrees = (int)strtod(tokens[4], NULL);
+  double decMinutes = strtod(tokens[5], NULL);
+  double decSeconds = strtod(tokens[6], NULL);
+  *lightyears = strtod(tokens[7], NULL);
+  *name = tokens[0];
+
+  ConvertTo3DCoords(ToDecimalRA(raHours, raMinutes, raSeconds),
+                    ToDecimalDec(decDegrees, decMinutes, decSeconds),
+                    *lightyears, &position->x, &position->y, &position->z);
+  return 1;
+}
+
+static void *ParseChunkWorker(void *arg) {
+  ParseChunk *chunk = arg;
   char line[1024];
-  StarArray *array = CreateStarArray();
+  const char *cursor = chunk->begin;
 
-  while (fgets(line, sizeof(line), file)) {
-    line[strcspn(line, "\n")] = 0; // remove newline character
+  chunk->row_count = 0;
+
+  while (cursor < chunk->end && chunk->row_count < chunk->row_capacity) {
+    const char *newline = memchr(cursor, '\n', chunk->end - cursor);
+    const char *line_end = newline ? newline : chunk->end;
+    size_t length = line_end - cursor;
+    if (length >= sizeof(line)) {
+      length = sizeof(line) - 1;
+    }
 
-    void *tokens[max_tokens];
-    int token_count = 0;
+    memcpy(line, cursor, length);
+    line[length] = 0;
+
+    char *token_name;
+    float lightyears;
+    Position *position = &chunk->positions[chunk->row_count];
+    if (ParseStarLine(line, &token_name, position, &lightyears)) {
+      // A name is never longer than the line it came from, so it is stored at the same
+      // offset in the pool as the line has in the file; chunks never overlap.
+      char *name = chunk->name_pool + (cursor - chunk->file_base);
+      size_t name_length = strlen(token_name);
+      memcpy(name, token_name, name_length + 1);
+
+      Star *new_star = &chunk->stars[chunk->row_count];
+      new_star->name = name;
+      new_star->position = NULL; // Pointed at the pool once rows are compacted
+      new_star->lightyears = lightyears;
+      if (chunk->hashes != NULL) {
+        chunk->hashes[chunk->row_count] = SlotHash(name);
+      }
 
-    char *token = strtok(line, ",");
-    while (token != NULL && token_count < max_tokens) {
-      tokens[token_count++] = token;
-      token = strtok(NULL, ",");
+      chunk->row_count++;
     }
 
-    if (token_count == max_tokens) {
-      char *name = tokens[0];
-      int raHours = (int)strtod(tokens[1], NULL);
-      double raMinutes = strtod(tokens[2], NULL);
-      double raSeconds = strtod(tokens[3], NULL);
-      int decDegrees = (int)strtod(tokens[4], NULL);
-      double decMinutes = strtod(tokens[5], NULL);
-      double decSeconds = strtod(tokens[6], NULL);
-      float lightyears = strtod(tokens[7], NULL);
+    cursor = line_end + 1;
+  }
 
-      Star new_star;
-      new_star.name = strdup(name);
-      new_star.lightyears = lightyears;
-      new_star.path_cost = FLT_MAX;
-      new_star.position = calloc(1, sizeof(Position));
-      if (new_star.position == NULL) {
-        fprintf(stderr, "ERROR [ParseFile()]: Memory allocation failed for new star allocation\n");
-        DeallocMainStarArray(array);
-        return NULL;
-      }
+  return NULL;
+}
+
+// Maps a catalog file for reading; *data is NULL for an empty file. Returns 0 on failure.
+static int MapCatalogFile(const char *path, const char **data, size_t *file_size) {
+  *data = NULL;
+  *file_size = 0;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "ERROR [MapCatalogFile()]: FILE FAILED TO OPEN!\n");
+    return 0;
+  }
+
+  struct stat file_info;
+  if (fstat(fd, &file_info) != 0) {
+    fprintf(stderr, "ERROR [MapCatalogFile()]: FAILED TO STAT FILE!\n");
+    close(fd);
+    return 0;
+  }
+
+  *file_size = (size_t)file_info.st_size;
+  if (*file_size == 0) {
+    close(fd);
+    return 1;
+  }
+
+  const char *mapping = mmap(NULL, *file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    fprintf(stderr, "ERROR [MapCatalogFile()]: FAILED TO MAP FILE!\n");
+    return 0;
+  }
+  madvise((void *)mapping, *file_size, MADV_SEQUENTIAL);
+
+  *data = mapping;
+  return 1;
+}
+
+// Cuts the file into chunk_count line-aligned chunks and sizes each one by its line count;
+// returns the total (an upper bound on the rows)
+static int SplitParseChunks(const char *data, size_t file_size, ParseChunk *chunks, int chunk_count) {
+  const char *file_end = data + file_size;
+  const char *chunk_begin = data;
+  int total_rows = 0;
+
+  for (int i = 0; i < chunk_count; i++) {
+    const char *chunk_end = data + (file_size * (i + 1)) / chunk_count;
+    if (chunk_end < chunk_begin) {
+      chunk_end = chunk_begin;
+    }
+    if (i == chunk_count - 1) {
+      chunk_end = file_end;
+    } else if (chunk_end < file_end) {
+      const char *newline = memchr(chunk_end, '\n', file_end - chunk_end);
+      chunk_end = newline ? newline + 1 : file_end;
+    }
 
-      ConvertTo3DCoords(ToDecimalRA(raHours, raMinutes, raSeconds),
-                        ToDecimalDec(decDegrees, decMinutes, decSeconds),
-                        lightyears, &new_star.position->x, &new_star.position->y, &new_star.position->z);
+    chunks[i].begin = chunk_begin;
+    chunks[i].end = chunk_end;
+    chunks[i].file_base = data;
+    chunks[i].row_capacity = CountChunkLines(chunk_begin, chunk_end);
+    total_rows += chunks[i].row_capacity;
+    chunk_begin = chunk_end;
+  }
+
+  return total_rows;
+}
+
+// Star, position and name storage for up to total_rows parsed rows
+static int AllocParsedStorage(StarArray *array, int total_rows, size_t file_size) {
+  array->stars = calloc(total_rows > 0 ? total_rows : 1, sizeof(Star));
+  array->position_pool = calloc(total_rows > 0 ? total_rows : 1, sizeof(Position));
+  array->name_pool = malloc(file_size + 1);
+  array->name_pool_size = file_size + 1;
+  array->position_pool_size = total_rows;
+  array->capacity = total_rows;
+  if (array->stars == NULL || array->position_pool == NULL || array->name_pool == NULL) {
+    fprintf(stderr, "ERROR [AllocParsedStorage()]: MEMORY ALLOCATION FAILED FOR CATALOG STORAGE!\n");
+    return 0;
+  }
+  return 1;
+}
+
+StarArray *ParseFile(const char *path) {
+  const char *data;
+  size_t file_size;
+  if (!MapCatalogFile(path, &data, &file_size)) {
+    return NULL;
+  }
+
+  StarArray *array = calloc(1, sizeof(StarArray));
+  if (array == NULL) {
+    fprintf(stderr, "ERROR [ParseFile()]: MEMORY ALLOCATION FAILED FOR STAR ARRAY!\n");
+    if (data != NULL) {
+      munmap((void *)data, file_size);
+    }
+    return NULL;
+  }
+
+  if (file_size == 0) {
+    return array;
+  }
 
-      AddStarToArray(array, &new_star);
+  // Small files are not worth a thread per core
+  int thread_count = GetThreadCount();
+  size_t min_chunk_size = 1 << 16;
+  if ((size_t)thread_count > file_size / min_chunk_size + 1) {
+    thread_count = (int)(file_size / min_chunk_size) + 1;
+  }
+
+  ParseChunk *chunks = calloc(thread_count, sizeof(ParseChunk));
+  pthread_t *threads = calloc(thread_count, sizeof(pthread_t));
+  if (chunks == NULL || threads == NULL) {
+    fprintf(stderr, "ERROR [ParseFile()]: MEMORY ALLOCATION FAILED FOR PARSE CHUNKS!\n");
+    goto fail;
+  }
+
+  int total_rows = SplitParseChunks(data, file_size, chunks, thread_count);
+  if (!AllocParsedStorage(array, total_rows, file_size)) {
+    goto fail;
+  }
+
+  int row_offset = 0;
+  for (int i = 0; i < thread_count; i++) {
+    chunks[i].name_pool = array->name_pool;
+    chunks[i].stars = array->stars + row_offset;
+    chunks[i].positions = array->position_pool + row_offset;
+    row_offset += chunks[i].row_capacity;
+  }
+
+  int started = 0;
+  for (int i = 1; i < thread_count; i++) {
+    if (pthread_create(&threads[i], NULL, ParseChunkWorker, &chunks[i]) != 0) {
+      break;
     }
+    started = i;
   }
+  ParseChunkWorker(&chunks[0]);
 
+  // Any chunk that could not get its own thread is parsed here instead
+  for (int i = started + 1; i < thread_count; i++) {
+    ParseChunkWorker(&chunks[i]);
+  }
+  for (int i = 1; i <= started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  // Close the gaps left by rows that were skipped (headers, blank or malformed lines)
+  int size = 0;
+  for (int i = 0; i < thread_count; i++) {
+    if (chunks[i].stars != array->stars + size) {
+      memmove(array->stars + size, chunks[i].stars, chunks[i].row_count * sizeof(Star));
+      memmove(array->position_pool + size, chunks[i].positions, chunks[i].row_count * sizeof(Position));
+    }
+    size += chunks[i].row_count;
+  }
+
+  array->size = size;
   OptimizeStarArraySize(array);
 
+  for (int i = 0; i < array->size; i++) {
+    array->stars[i].position = &array->position_pool[i];
+  }
+
   // printf("Number of stars in the array: %d\n", array->size);
   // printf("Allocated capacity of the array: %d\n", array->capacity);
 
-  fclose(file);
+  free(threads);
+  free(chunks);
+  munmap((void *)data, file_size);
+  return array;
+
+fail:
+  free(threads);
+  free(chunks);
+  munmap((void *)data, file_size);
+  DeallocMainStarArray(array);
+  return NULL;
+}
+
+// THREADING UTILITY FUNCTIONS
+int GetThreadCount(void) {
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return (count > 0) ? (int)count : 1;
+}
+
+typedef struct ParallelForContext {
+  ParallelTask task;
+  void *user_data;
+  int count;
+  int grain;
+  int next; // Next unclaimed item, advanced atomically
+} ParallelForContext;
+
+static void *ParallelForWorker(void *arg) {
+  ParallelForContext *ctx = arg;
+
+  while (1) {
+    int begin = __atomic_fetch_add(&ctx->next, ctx->grain, __ATOMIC_RELAXED);
+    if (begin >= ctx->count) {
+      break;
+    }
+    int end = (begin + ctx->grain < ctx->count) ? begin + ctx->grain : ctx->count;
+    ctx->task(ctx->user_data, begin, end);
+  }
+
+  return NULL;
+}
+
+// Runs task over [0, count) in blocks of 'grain' items, claimed dynamically by one thread
+// per core (the caller included). Returns once every block has been processed.
+void ParallelFor(int count, int grain, ParallelTask task, void *user_data) {
+  if (count <= 0) {
+    return;
+  }
+  if (grain < 1) {
+    grain = 1;
+  }
+
+  ParallelForContext ctx = {task, user_data, count, grain, 0};
+  int thread_count = GetThreadCount();
+  int blocks = (count + grain - 1) / grain;
+  if (thread_count > blocks) {
+    thread_count = blocks;
+  }
+
+  pthread_t threads[thread_count > 1 ? thread_count : 1];
+  int started = 0;
+  for (int i = 1; i < thread_count; i++) {
+    if (pthread_create(&threads[i], NULL, ParallelForWorker, &ctx) != 0) {
+      break;
+    }
+    started = i;
+  }
+  ParallelForWorker(&ctx);
+  for (int i = 1; i <= started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+}
+
+// ARENA ALLOCATOR
+// Blocks form a chain that is only ever appended to (or walked again after a reset); an
+// allocation that does not fit the current block moves on to the next retained block, or
+// links in a new one sized for the request. Nothing is freed until DeallocArena().
+#define ARENA_ALIGNMENT 16
+
+struct ArenaBlock {
+  ArenaBlock *next;
+  size_t size; // Usable bytes after the header
+};
+
+static size_t ArenaHeaderSize(void) {
+  return (sizeof(ArenaBlock) + 63) & ~(size_t)63;
+}
+
+static char *ArenaBlockData(ArenaBlock *block) {
+  return (char *)block + ArenaHeaderSize();
+}
+
+void InitArena(Arena *arena, size_t block_size) {
+  arena->first = NULL;
+  arena->current = NULL;
+  arena->offset = 0;
+  arena->block_size = (block_size > 0) ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+}
+
+// Returns 16-byte aligned memory that stays valid until the next ResetArena(), or NULL
+void *ArenaAlloc(Arena *arena, size_t bytes) {
+  bytes = (bytes + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+  if (bytes == 0) {
+    bytes = ARENA_ALIGNMENT;
+  }
+
+  if (arena->current != NULL && arena->offset + bytes <= arena->current->size) {
+    void *memory = ArenaBlockData(arena->current) + arena->offset;
+    arena->offset += bytes;
+    return memory;
+  }
+
+  // Reuse the next retained block if it is big enough, otherwise link a new one in here
+  ArenaBlock *next = (arena->current != NULL) ? arena->current->next : arena->first;
+  if (next == NULL || next->size < bytes) {
+    size_t size = (bytes > arena->block_size) ? bytes : arena->block_size;
+    size_t total = (ArenaHeaderSize() + size + 63) & ~(size_t)63;
+    ArenaBlock *block = aligned_alloc(64, total);
+    if (block == NULL) {
+      fprintf(stderr, "ERROR [ArenaAlloc()]: MEMORY ALLOCATION FAILED FOR ARENA BLOCK!\n");
+      return NULL;
+    }
+    STATS_ADD(bytes_allocated, total);
+    block->size = total - ArenaHeaderSize();
+    block->next = next;
+    if (arena->current != NULL) {
+      arena->current->next = block;
+    } else {
+      arena->first = block;
+    }
+    next = block;
+  }
+
+  arena->current = next;
+  arena->offset = bytes;
+  return ArenaBlockData(next);
+}
+
+void ResetArena(Arena *arena) {
+  arena->current = NULL;
+  arena->offset = 0;
+}
+
+void DeallocArena(Arena *arena) {
+  ArenaBlock *block = arena->first;
+  while (block != NULL) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  arena->first = NULL;
+  arena->current = NULL;
+  arena->offset = 0;
+}
+
+// A fixed-capacity StarArray living in the arena. It must not be grown with AddStarToArray()
+// or passed to the Dealloc*() functions; it goes away with the next ResetArena().
+StarArray *CreateArenaStarArray(Arena *arena, int capacity) {
+  StarArray *array = ArenaAlloc(arena, sizeof(StarArray));
+  Star *stars = ArenaAlloc(arena, (capacity > 0 ? capacity : 1) * sizeof(Star));
+  if (array == NULL || stars == NULL) {
+    return NULL;
+  }
+
+  memset(array, 0, sizeof(StarArray));
+  array->stars = stars;
+  array->capacity = capacity;
   return array;
 }
 
+// QUERY STATISTICS
+// Counters are thread-local, so instrumented queries on different threads never contend. A
+// query is whatever runs between QueryStatsBegin() and QueryStatsEnd(); nested brackets
+// (StarPath() calling QueryRoute(), say) fold into the outermost one. Each finished query
+// is also added to a process-wide aggregate. The public query functions bracket themselves
+// with STATS_BEGIN()/STATS_END(). Without STAR_CHART_STATS those and every STATS_ADD()
+// compile to nothing: no clock reads, no aggregate lock, and the explicit functions are empty.
+#ifdef STAR_CHART_STATS
+_Thread_local QueryStats current_query_stats;
+static _Thread_local int stats_depth;
+static _Thread_local double stats_start;
+static QueryStats aggregate_stats;
+static pthread_mutex_t aggregate_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double StatsClock(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+#endif
+
+int QueryStatsEnabled(void) {
+#ifdef STAR_CHART_STATS
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+void QueryStatsBegin(void) {
+#ifdef STAR_CHART_STATS
+  if (stats_depth++ > 0) {
+    return;
+  }
+  memset(&current_query_stats, 0, sizeof(QueryStats));
+  stats_start = StatsClock();
+#endif
+}
+
+// Closes the bracket opened by QueryStatsBegin(); out (may be NULL) receives this query's
+// counters once the outermost bracket closes
+void QueryStatsEnd(QueryStats *out) {
+#ifdef STAR_CHART_STATS
+  if (stats_depth == 0 || --stats_depth > 0) {
+    return;
+  }
+
+  QueryStats stats = current_query_stats;
+  stats.queries = 1;
+  stats.wall_time = StatsClock() - stats_start;
+  stats.max_wall_time = stats.wall_time;
+
+  pthread_mutex_lock(&aggregate_stats_lock);
+  aggregate_stats.queries++;
+  aggregate_stats.nodes_visited += stats.nodes_visited;
+  aggregate_stats.distance_evals += stats.distance_evals;
+  aggregate_stats.subtrees_pruned += stats.subtrees_pruned;
+  aggregate_stats.heap_pushes += stats.heap_pushes;
+  aggregate_stats.heap_pops += stats.heap_pops;
+  aggregate_stats.hash_probes += stats.hash_probes;
+  aggregate_stats.bytes_allocated += stats.bytes_allocated;
+  aggregate_stats.wall_time += stats.wall_time;
+  if (stats.wall_time > aggregate_stats.max_wall_time) {
+    aggregate_stats.max_wall_time = stats.wall_time;
+  }
+  pthread_mutex_unlock(&aggregate_stats_lock);
+
+  if (out != NULL) {
+    *out = stats;
+  }
+#else
+  (void)out;
+#endif
+}
+
+void GetAggregateStats(QueryStats *out) {
+#ifdef STAR_CHART_STATS
+  pthread_mutex_lock(&aggregate_stats_lock);
+  *out = aggregate_stats;
+  pthread_mutex_unlock(&aggregate_stats_lock);
+#else
+  memset(out, 0, sizeof(QueryStats));
+#endif
+}
+
+void ResetAggregateStats(void) {
+#ifdef STAR_CHART_STATS
+  pthread_mutex_lock(&aggregate_stats_lock);
+  memset(&aggregate_stats, 0, sizeof(QueryStats));
+  pthread_mutex_unlock(&aggregate_stats_lock);
+#endif
+}
+
+void DumpQueryStats(FILE *stream, const char *label, const QueryStats *stats) {
+  if (!QueryStatsEnabled()) {
+    fprintf(stream, "%s: statistics disabled; build with -DSTAR_CHART_STATS\n", label);
+    return;
+  }
+
+  fprintf(stream, "%s: %lu quer%s, %.3f ms", label, stats->queries, stats->queries == 1 ? "y" : "ies",
+          stats->wall_time * 1e3);
+  if (stats->queries > 1) {
+    fprintf(stream, " (slowest %.3f ms)", stats->max_wall_time * 1e3);
+  }
+  fprintf(stream, "\n");
+  fprintf(stream, "  nodes visited:   %lu\n", stats->nodes_visited);
+  fprintf(stream, "  distance evals:  %lu\n", stats->distance_evals);
+  fprintf(stream, "  subtrees pruned: %lu\n", stats->subtrees_pruned);
+  fprintf(stream, "  heap push/pop:   %lu / %lu\n", stats->heap_pushes, stats->heap_pops);
+  fprintf(stream, "  hash probes:     %lu\n", stats->hash_probes);
+  fprintf(stream, "  bytes allocated: %lu\n", stats->bytes_allocated);
+}
+
 // CONVERSION MATH TO DETERMINE X, Y, Z, AND NAVIGATION VECTORS
 double Sign(double value) { return (value > 0) ? 1.0 : -1.0; }
 
@@ -105,6 +613,7 @@ StarArray *CreateStarArray() {
   array->size = 0;
   array->capacity = 1024; // Initial capacity
   array->stars = calloc(array->capacity, sizeof(Star));
+  STATS_ADD(bytes_allocated, sizeof(StarArray) + array->capacity * sizeof(Star));
   if (!array->stars) {
     fprintf(stderr, "ERROR [CreateStarArray()]: MEMORY ALLOCATION FAILED FOR STARS ARRAY!\n");
     return NULL;
@@ -113,366 +622,3407 @@ StarArray *CreateStarArray() {
   return array;
 }
 
-KDNode *CreateBalancedKDTree(Star *stars, int start, int end, int depth) {
-  if (start > end)
-    return NULL;
-
-  int axis = depth % 3;
-  
-  switch (axis) {
-  case 0: qsort(stars + start, (end - start) + 1, sizeof(Star), CompareNodeX); break;
-  case 1: qsort(stars + start, (end - start) + 1, sizeof(Star), CompareNodeY); break;
-  case 2: qsort(stars + start, (end - start) + 1, sizeof(Star), CompareNodeZ); break;
-  default: return NULL; break;
-  }
-
-  int mid = (start + end) / 2;
-
-  KDNode *node = calloc(1, sizeof(KDNode));
-  if (node == NULL) {
-    fprintf(stderr, "ERROR [CreateBalancedKDTree()]: MEMORY ALLOCATION FAILED FOR KD NODE!\n");
-    return NULL;
-  }
-
-  node->star = &stars[mid];
-  node->left = NULL;
-  node->right = NULL;
-  node->star->kd_node = node;
-
-  if (start <= mid - 1) {
-    node->left = CreateBalancedKDTree(stars, start, mid - 1, depth + 1);
-  }
-
-  if (mid + 1 <= end) {
-    node->right = CreateBalancedKDTree(stars, mid + 1, end, depth + 1);
+// KD-TREE CONSTRUCTION
+// The builder never moves Star structs. It permutes the tree's id array together with its
+// coordinate arrays (so partitioning streams through memory) and finds each median with a
+// linear-time selection, which keeps the whole build O(n log n). Subtrees larger than
+// KD_PARALLEL_CUTOFF are handed to a shared task stack that every build thread drains.
+//
+// The tree is perfect: every leaf sits at tree->depth and node i has children 2i+1 and
+// 2i+2, so no child pointers are stored. Each node records the slice [begin, begin+count)
+// of ids/x/y/z that its subtree covers; a leaf bucket is scanned straight out of that slice.
+#define KD_PARALLEL_CUTOFF (1 << 14)
+
+typedef struct KDBuildTask {
+  int begin;
+  int end; // Exclusive
+  int node_index;
+} KDBuildTask;
+
+typedef struct KDBuildContext {
+  KDTree *tree;
+  double *axes[3]; // tree->x, tree->y, tree->z
+
+  int threaded; // Zero: the calling thread builds every subtree itself
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  KDBuildTask *tasks;
+  int task_count;
+  int task_capacity;
+  int pending; // Tasks queued or running
+} KDBuildContext;
+
+static inline void SwapBuildEntries(KDBuildContext *ctx, int a, int b) {
+  int id = ctx->tree->ids[a];
+  ctx->tree->ids[a] = ctx->tree->ids[b];
+  ctx->tree->ids[b] = id;
+
+  for (int axis = 0; axis < 3; axis++) {
+    double value = ctx->axes[axis][a];
+    ctx->axes[axis][a] = ctx->axes[axis][b];
+    ctx->axes[axis][b] = value;
   }
-
-  return node;
 }
 
-HashMap *CreateHashMap(StarArray *star_array, int size) {
-  HashMap *map = calloc(1, sizeof(HashMap));
-  if (map == NULL) {
-    fprintf(stderr, "ERROR [CreateHashMap()]: MEMORY ALLOCATION FAILED FOR HASHMAP!\n");
-    return NULL;
-  }
+// Rearranges [begin, end) so position k holds the element that would be there if the range
+// were sorted along axis, with nothing larger before it and nothing smaller after it.
+static void SelectKth(KDBuildContext *ctx, int begin, int end, int k, int axis) {
+  double *key = ctx->axes[axis];
+  int left = begin;
+  int right = end - 1;
+
+  while (right > left) {
+    // Median-of-three pivot value
+    int mid = left + (right - left) / 2;
+    if (key[mid] < key[left]) SwapBuildEntries(ctx, mid, left);
+    if (key[right] < key[left]) SwapBuildEntries(ctx, right, left);
+    if (key[right] < key[mid]) SwapBuildEntries(ctx, right, mid);
+    double pivot = key[mid];
+
+    // Hoare partition: both scans stop on keys equal to the pivot, so runs of equal
+    // coordinates split evenly instead of degrading to quadratic time
+    int i = left;
+    int j = right;
+    while (i <= j) {
+      while (key[i] < pivot) i++;
+      while (key[j] > pivot) j--;
+      if (i <= j) {
+        SwapBuildEntries(ctx, i++, j--);
+      }
+    }
 
-  map->size = size;
-  map->buckets = calloc(map->size, sizeof(HashEntry*));
-  if (map->buckets == NULL) {
-    fprintf(stderr, "ERROR [CreateHashMap()]: MEMORY ALLOCATION FAILED FOR HASH ENTRY!\n");
-    free(map);
-    return NULL;
+    if (k <= j) {
+      right = j;
+    } else if (k >= i) {
+      left = i;
+    } else {
+      return;
+    }
   }
-  
-  map->count = 0;
+}
 
-  for (int i = 0; i < star_array->size; i++) {
-    AddToHashMap(map, star_array->stars[i].name, &star_array->stars[i]);
+// Splitting along the axis with the widest spread keeps cells compact in clustered catalogs
+static int WidestAxis(KDBuildContext *ctx, int begin, int end) {
+  int best_axis = 0;
+  double best_spread = -1.0;
+
+  for (int axis = 0; axis < 3; axis++) {
+    const double *key = ctx->axes[axis];
+    double min = DBL_MAX;
+    double max = -DBL_MAX;
+    for (int i = begin; i < end; i++) {
+      min = (key[i] < min) ? key[i] : min;
+      max = (key[i] > max) ? key[i] : max;
+    }
+    if (max - min > best_spread) {
+      best_spread = max - min;
+      best_axis = axis;
+    }
   }
 
-  return map;
+  return best_axis;
 }
 
-// ARRAY UTILITY FUNCTIONS
-void AddStarToArray(StarArray *array, Star *star) {
-  if (array->size == array->capacity) {
-    array->capacity = (int)array->capacity * 1.5; // Double the capacity if full
-    array->stars = realloc(array->stars, array->capacity * sizeof(Star));
-
-    if (!array->stars) {
-      fprintf(stderr, "ERROR [AddStarToArray()]: MEMORY ALLOCATION FAILED DURING REALLOC!\n");
-      return;
+static int PushBuildTask(KDBuildContext *ctx, KDBuildTask task) {
+  pthread_mutex_lock(&ctx->lock);
+  if (ctx->task_count == ctx->task_capacity) {
+    int capacity = ctx->task_capacity ? ctx->task_capacity * 2 : 64;
+    KDBuildTask *tasks = realloc(ctx->tasks, capacity * sizeof(KDBuildTask));
+    if (tasks == NULL) {
+      // Out of memory for the queue: the caller builds the subtree itself instead
+      pthread_mutex_unlock(&ctx->lock);
+      fprintf(stderr, "ERROR [PushBuildTask()]: MEMORY ALLOCATION FAILED FOR BUILD TASK!\n");
+      return 0;
     }
+    ctx->tasks = tasks;
+    ctx->task_capacity = capacity;
   }
+  ctx->tasks[ctx->task_count++] = task;
+  ctx->pending++;
+  pthread_cond_signal(&ctx->ready);
+  pthread_mutex_unlock(&ctx->lock);
+  return 1;
+}
 
-  array->stars[array->size++] = *star;
+static void BuildKDSubtree(KDBuildContext *ctx, int begin, int end, int node_index) {
+  KDTree *tree = ctx->tree;
 
-  // printf("Number of stars in the array: %d\n", array->size);
-  // printf("Allocated capacity of the array: %d\n", array->capacity);
-}
+  while (1) {
+    KDTreeNode *node = &tree->nodes[node_index];
+    node->begin = begin;
+    node->count = end - begin;
 
-void OptimizeStarArraySize(StarArray *array) {
-  if (array->size < array->capacity) {
-    array->stars = realloc(array->stars, array->size * sizeof(Star));
-    if (!array->stars && array->size > 0) {
-      fprintf(stderr, "ERROR [OptimizeStarArraySize()]: MEMORY REALLOCATION FAILED DURING OPTIMIZATION!\n");
+    if (node_index >= tree->node_count / 2) {
+      // Leaf level
+      node->axis = -1;
+      node->split = 0.0;
       return;
     }
-    array->capacity = array->size;
-  }
-}
 
-void PrintStarValues(StarArray *star_array) {
-  for (size_t i = 0; i < star_array->size; i++) {
-    printf("%s: (%.2f, %.2f, %.2f)\n", star_array->stars[i].name,
-           star_array->stars[i].position->x, star_array->stars[i].position->y,
-           star_array->stars[i].position->z);
-    printf("Light years from Sol: %.3f\n", star_array->stars[i].lightyears);
-    printf("path score: %.2f\n\n", star_array->stars[i].path_cost);
-  }
-}
+    int axis = WidestAxis(ctx, begin, end);
+    int mid = begin + (end - begin) / 2;
+    if (mid < end) {
+      SelectKth(ctx, begin, end, mid, axis);
+    }
+    node->axis = axis;
+    node->split = (mid < end) ? ctx->axes[axis][mid] : 0.0;
 
-void DeallocSubStarArray(StarArray *array) {
-  if (array) {
-    free(array->stars);
-    free(array);
-  }
-}
+    int left_index = 2 * node_index + 1;
+    int right_index = 2 * node_index + 2;
 
-void DeallocMainStarArray(StarArray *array) {
-  if (array) {
-    for (int i = 0; i < array->size; i++) {
-      if (array->stars[i].name) {
-        free(array->stars[i].name);
-      }
-      if (array->stars[i].position) {
-        free(array->stars[i].position);
+    if (ctx->threaded && end - mid > KD_PARALLEL_CUTOFF) {
+      KDBuildTask task = {mid, end, right_index};
+      if (!PushBuildTask(ctx, task)) {
+        BuildKDSubtree(ctx, mid, end, right_index);
       }
+    } else {
+      BuildKDSubtree(ctx, mid, end, right_index);
     }
-    free(array->stars); // Free stars array
-    free(array);        // Free array struct
+
+    end = mid;
+    node_index = left_index;
   }
 }
 
-// KD-TREE UTILITY FUNCTIONS
-StarArray* StarSearchRange(KDNode *root, Star *center, float radius) {
-  StarArray *result = CreateStarArray();
-  // Position ghost_position = player_position;
-
-  // RadiusSearch(root, ghost_position, radius, 0, result);
+static void *KDBuildWorker(void *arg) {
+  KDBuildContext *ctx = arg;
 
-  RadiusSearch(root, center, radius, 0, result);
+  pthread_mutex_lock(&ctx->lock);
+  while (1) {
+    while (ctx->task_count == 0 && ctx->pending > 0) {
+      pthread_cond_wait(&ctx->ready, &ctx->lock);
+    }
+    if (ctx->task_count == 0) {
+      break; // Nothing queued and nothing running: the tree is complete
+    }
 
-  // float distance_from_player = 0;
+    KDBuildTask task = ctx->tasks[--ctx->task_count];
+    pthread_mutex_unlock(&ctx->lock);
 
-  // printf("\n\nStars within %.2f light years:\n", radius);
+    BuildKDSubtree(ctx, task.begin, task.end, task.node_index);
 
-  // for (int i = 0; i < result->size; i++) {
-  //   Star *star = &result->stars[i];
-  //   distance_from_player = CalculateDistance(star, &player_position);
-  //   printf("  - %s at %.2f light years\n", star->name, distance_from_player);
-  // }
+    pthread_mutex_lock(&ctx->lock);
+    if (--ctx->pending == 0) {
+      pthread_cond_broadcast(&ctx->ready);
+    }
+  }
+  pthread_mutex_unlock(&ctx->lock);
 
-  return result;
+  return NULL;
 }
 
-void RadiusSearch(KDNode *node, Star *center, float radius, int depth, StarArray *result) {
-  if (node == NULL) {
-    // Base case
-    return;
-  }
-
-  // printf("Visiting node: %s at depth %d\n", node->star->name, depth);
+static size_t AlignUp(size_t value, size_t alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
 
-  float distance = CalculateEuclideanDistance(node->star, center);
-  if (distance <= radius) {
-    AddStarToArray(result, node->star);
+// Header, nodes, boxes, sums, ids and coordinates share one 64-byte aligned allocation
+KDTree *AllocKDTree(int size, int depth) {
+  int node_count = (int)((2UL << depth) - 1);
+  size_t padded = AlignUp(size > 0 ? size : 1, 8);
+
+  size_t nodes_offset = AlignUp(sizeof(KDTree), 64);
+  size_t boxes_offset = AlignUp(nodes_offset + node_count * sizeof(KDTreeNode), 64);
+  size_t sums_offset = AlignUp(boxes_offset + node_count * sizeof(KDTreeBox), 64);
+  size_t ids_offset = AlignUp(sums_offset + node_count * sizeof(Position), 64);
+  size_t x_offset = AlignUp(ids_offset + padded * sizeof(int), 64);
+  size_t y_offset = x_offset + padded * sizeof(double);
+  size_t z_offset = y_offset + padded * sizeof(double);
+  size_t total = AlignUp(z_offset + padded * sizeof(double), 64);
+
+  char *block = aligned_alloc(64, total);
+  if (block == NULL) {
+    fprintf(stderr, "ERROR [AllocKDTree()]: MEMORY ALLOCATION FAILED FOR KD TREE!\n");
+    return NULL;
   }
 
-  int axis = depth % 3;
-  float diff = 0;
+  KDTree *tree = (KDTree *)block;
+  memset(tree, 0, sizeof(KDTree));
+  tree->nodes = (KDTreeNode *)(block + nodes_offset);
+  tree->boxes = (KDTreeBox *)(block + boxes_offset);
+  tree->sums = (Position *)(block + sums_offset);
+  tree->ids = (int *)(block + ids_offset);
+  tree->x = (double *)(block + x_offset);
+  tree->y = (double *)(block + y_offset);
+  tree->z = (double *)(block + z_offset);
+  tree->node_count = node_count;
+  tree->depth = depth;
+  tree->size = size;
+  tree->bytes = total;
+
+  return tree;
+}
 
-  
-  switch (axis) {
-  case 0:
-    diff = center->position->x - node->star->position->x; 
-    break;
-  case 1:
-    diff = center->position->y - node->star->position->y; 
-    break;
-  case 2:
-    diff = center->position->z - node->star->position->z;
-    break;
-  default:
-    break;
+typedef struct KDBoundsBuild {
+  KDTree *tree;
+  int first_leaf;
+} KDBoundsBuild;
+
+static void LeafBoundsTask(void *user_data, int begin, int end) {
+  KDBoundsBuild *build = user_data;
+  const KDTree *tree = build->tree;
+
+  for (int leaf = begin; leaf < end; leaf++) {
+    const KDTreeNode *node = &tree->nodes[build->first_leaf + leaf];
+    KDTreeBox *box = &tree->boxes[build->first_leaf + leaf];
+    const double *axes[3] = {tree->x + node->begin, tree->y + node->begin, tree->z + node->begin};
+    double sums[3];
+    for (int axis = 0; axis < 3; axis++) {
+      double low = DBL_MAX;
+      double high = -DBL_MAX;
+      double sum = 0.0;
+      for (int i = 0; i < node->count; i++) {
+        low = (axes[axis][i] < low) ? axes[axis][i] : low;
+        high = (axes[axis][i] > high) ? axes[axis][i] : high;
+        sum += axes[axis][i];
+      }
+      box->low[axis] = low;
+      box->high[axis] = high;
+      sums[axis] = sum;
+    }
+    Position *node_sum = &tree->sums[build->first_leaf + leaf];
+    node_sum->x = sums[0];
+    node_sum->y = sums[1];
+    node_sum->z = sums[2];
   }
+}
 
-  // printf("Axis: %d, Diff: %.2f, Radius: %.2f\n", axis, diff, radius);
-
-  if (diff <= 0) {
-    RadiusSearch(node->left, center, radius, depth + 1, result);
-    
-    if (fabs(diff) <= radius) {
-        RadiusSearch(node->right, center, radius, depth + 1, result);
-    }
-  } else {
-    RadiusSearch(node->right, center, radius, depth + 1, result);
-  
-    if (fabs(diff) <= radius) {
-      
-      RadiusSearch(node->left, center, radius, depth + 1, result);
+// Leaf boxes and position sums from their stars, then each inner node's from its children's
+static void ComputeKDTreeBounds(KDTree *tree) {
+  KDBoundsBuild build = {tree, tree->node_count / 2};
+  ParallelFor(tree->node_count - build.first_leaf, 4096, LeafBoundsTask, &build);
+
+  for (int node = build.first_leaf - 1; node >= 0; node--) {
+    const KDTreeBox *left = &tree->boxes[2 * node + 1];
+    const KDTreeBox *right = &tree->boxes[2 * node + 2];
+    for (int axis = 0; axis < 3; axis++) {
+      tree->boxes[node].low[axis] = (left->low[axis] < right->low[axis]) ? left->low[axis] : right->low[axis];
+      tree->boxes[node].high[axis] = (left->high[axis] > right->high[axis]) ? left->high[axis] : right->high[axis];
     }
+    tree->sums[node].x = tree->sums[2 * node + 1].x + tree->sums[2 * node + 2].x;
+    tree->sums[node].y = tree->sums[2 * node + 1].y + tree->sums[2 * node + 2].y;
+    tree->sums[node].z = tree->sums[2 * node + 1].z + tree->sums[2 * node + 2].z;
   }
 }
 
-Star* NearestNeighbor(KDNode *root, const Position reference) {
-  double current_best_distance = DBL_MAX;
-  Star *neighbor = NearestNeighborSearch(root, reference, 0, NULL, &current_best_distance);
-  
-  // printf("Closest star is %s at a distance of %.2f light years from current location.\n\n", neighbor->name, current_best_distance);
-
-  return neighbor;
+KDTree *CreateBalancedKDTree(StarArray *array, int leaf_size) {
+  return CreateKDTreeFromIds(array, NULL, array->size, leaf_size);
 }
 
-Star* NearestNeighborSearch(KDNode *node, const Position reference, int depth, Star *current_closest_star, double *current_best_distance){
-  if (node == NULL) {
-    return current_closest_star;
+// Builds a tree over just the given star ids (all of them, in order, when ids is NULL).
+KDTree *CreateKDTreeFromIds(StarArray *array, const int *ids, int size, int leaf_size) {
+  if (leaf_size < 1) {
+    leaf_size = KD_DEFAULT_LEAF_SIZE;
+  } else if (leaf_size > KD_MAX_LEAF_SIZE) {
+    leaf_size = KD_MAX_LEAF_SIZE;
   }
 
-  double distance = CalculateDistance(node->star, reference);
-  if (distance < *current_best_distance) {
-    *current_best_distance = distance;
-    current_closest_star = node->star;
+  // Halve until every leaf holds at most leaf_size stars
+  int depth = 0;
+  while (((long)size + (1L << depth) - 1) >> depth > leaf_size) {
+    depth++;
   }
 
-  int axis = depth % 3;
-  double diff = 0.0;
-
-  if (axis == 0) {
-    diff = reference.x - node->star->position->x;
+  KDTree *tree = AllocKDTree(size, depth);
+  if (tree == NULL) {
+    return NULL;
   }
-  else if (axis == 1) {
-    diff = reference.y - node->star->position->y;
+  tree->leaf_size = leaf_size;
+  tree->stars = array->stars;
+
+  if (ids == NULL) {
+    for (int i = 0; i < size; i++) {
+      tree->ids[i] = i;
+    }
   } else {
-    diff = reference.z - node->star->position->z;
+    memcpy(tree->ids, ids, size * sizeof(int));
+  }
+  for (int i = 0; i < size; i++) {
+    const Position *position = array->stars[tree->ids[i]].position;
+    tree->x[i] = position->x;
+    tree->y[i] = position->y;
+    tree->z[i] = position->z;
   }
 
-  KDNode *near_subtree = NULL;
-  KDNode *far_subtree = NULL;
-
-  if (diff <= 0) {
-    near_subtree = node->left;
-    far_subtree = node->right;
-  } else {
-    near_subtree = node->right;
-    far_subtree = node->left;
+  KDBuildContext ctx = {0};
+  ctx.tree = tree;
+  ctx.axes[0] = tree->x;
+  ctx.axes[1] = tree->y;
+  ctx.axes[2] = tree->z;
+
+  int thread_count = GetThreadCount();
+  if (thread_count == 1 || size <= KD_PARALLEL_CUTOFF) {
+    BuildKDSubtree(&ctx, 0, size, 0);
+    ComputeKDTreeBounds(tree);
+    return tree;
   }
 
-  current_closest_star = NearestNeighborSearch(near_subtree, reference, depth + 1, current_closest_star, current_best_distance);
+  ctx.threaded = 1;
+  pthread_mutex_init(&ctx.lock, NULL);
+  pthread_cond_init(&ctx.ready, NULL);
+  KDBuildTask root = {0, size, 0};
+  if (!PushBuildTask(&ctx, root)) {
+    BuildKDSubtree(&ctx, 0, size, 0);
+  }
 
-  if (fabs(diff) < *current_best_distance) {
-    current_closest_star = NearestNeighborSearch(far_subtree, reference, depth + 1, current_closest_star, current_best_distance);
+  pthread_t *threads = calloc(thread_count, sizeof(pthread_t));
+  int started = 0;
+  for (int i = 1; threads && i < thread_count; i++) {
+    if (pthread_create(&threads[i], NULL, KDBuildWorker, &ctx) != 0) {
+      break;
+    }
+    started = i;
+  }
+  KDBuildWorker(&ctx);
+  for (int i = 1; i <= started; i++) {
+    pthread_join(threads[i], NULL);
   }
 
-  return current_closest_star;
+  free(threads);
+  free(ctx.tasks);
+  pthread_cond_destroy(&ctx.ready);
+  pthread_mutex_destroy(&ctx.lock);
+
+  ComputeKDTreeBounds(tree);
+  return tree;
 }
 
-void PrintKDTree(KDNode *node) {
-  if (node == NULL) {
-    return;
+typedef struct HashBuild {
+  const Star *stars;
+  unsigned int *hashes;
+} HashBuild;
+
+static void HashNamesTask(void *user_data, int begin, int end) {
+  HashBuild *build = user_data;
+
+  for (int i = begin; i < end; i++) {
+    build->hashes[i] = SlotHash(build->stars[i].name);
   }
-  PrintKDTree(node->left);
+}
 
-  printf("%s: (%.2f, %.2f, %.2f), %.2f\n", node->star->name, node->star->position->x,
-     node->star->position->y, node->star->position->z, node->star->lightyears);
+// Bulk build: the table is sized once for every star (no resize doublings) and the names are
+// hashed in parallel before the serial insert pass
+HashMap *CreateHashMap(StarArray *star_array, int size) {
+  HashMap *map = calloc(1, sizeof(HashMap));
+  if (map == NULL) {
+    fprintf(stderr, "ERROR [CreateHashMap()]: MEMORY ALLOCATION FAILED FOR HASHMAP!\n");
+    return NULL;
+  }
+
+  if (size < star_array->size) {
+    size = star_array->size;
+  }
+
+  map->stars = star_array->stars;
+  map->size = HashMapCapacityFor(size);
+  map->count = 0;
+  map->slots = calloc(map->size, sizeof(HashEntry));
+  if (map->slots == NULL) {
+    fprintf(stderr, "ERROR [CreateHashMap()]: MEMORY ALLOCATION FAILED FOR HASH SLOTS!\n");
+    free(map);
+    return NULL;
+  }
+
+  unsigned int *hashes = malloc((star_array->size > 0 ? star_array->size : 1) * sizeof(unsigned int));
+  if (hashes == NULL) {
+    // Still correct, just hashed on this thread as each star goes in
+    for (int i = 0; i < star_array->size; i++) {
+      AddToHashMap(map, &star_array->stars[i]);
+    }
+    return map;
+  }
+
+  HashBuild build = {star_array->stars, hashes};
+  ParallelFor(star_array->size, 4096, HashNamesTask, &build);
+
+  for (int i = 0; i < star_array->size; i++) {
+    InsertHashedId(map, hashes[i], i);
+  }
+
+  free(hashes);
+  return map;
+}
+
+// PIPELINED CATALOG LOADING
+// ParseFile(), CreateBalancedKDTree() and CreateHashMap() each run to completion before the
+// next one starts. LoadStarCatalog() overlaps them instead. The file is cut into small
+// line-aligned blocks that the parse threads claim in file order, hashing each name as it is
+// parsed. The calling thread takes finished blocks in order, moves their rows to their final
+// ids and fills in the coordinate arrays, while a name thread inserts every placed row into
+// the name index. Once the last block is placed the KD-tree is built, with the name thread
+// still finishing the index alongside it.
+#define LOAD_BLOCK_BYTES (1 << 18)
+
+typedef struct CatalogLoad {
+  StarArray *array;
+  HashMap *map;
+  ParseChunk *blocks;
+  unsigned int *hashes;   // Slot hash of every row, in the same slots as the stars
+  char *parsed;           // Per block, set once a parse thread has finished it
+  int block_count;
+  int next_block;         // Next block for a parse thread to claim; advanced atomically
+  int placed;             // Rows [0, placed) are at their final ids
+  int placing_done;
+  pthread_mutex_t lock;
+  pthread_cond_t block_parsed;
+  pthread_cond_t rows_placed;
+} CatalogLoad;
+
+static void *LoadParseWorker(void *arg) {
+  CatalogLoad *load = arg;
+
+  while (1) {
+    int block = __atomic_fetch_add(&load->next_block, 1, __ATOMIC_RELAXED);
+    if (block >= load->block_count) {
+      break;
+    }
+    ParseChunkWorker(&load->blocks[block]);
+
+    pthread_mutex_lock(&load->lock);
+    load->parsed[block] = 1;
+    pthread_cond_broadcast(&load->block_parsed);
+    pthread_mutex_unlock(&load->lock);
+  }
+
+  return NULL;
+}
+
+// Inserts rows into the name index as soon as they have their final ids
+static void *LoadNameWorker(void *arg) {
+  CatalogLoad *load = arg;
+  int inserted = 0;
+
+  while (1) {
+    pthread_mutex_lock(&load->lock);
+    while (load->placed == inserted && !load->placing_done) {
+      pthread_cond_wait(&load->rows_placed, &load->lock);
+    }
+    int target = load->placed;
+    int done = load->placing_done;
+    pthread_mutex_unlock(&load->lock);
+
+    for (; inserted < target; inserted++) {
+      InsertHashedId(load->map, load->hashes[inserted], inserted);
+    }
+    if (done) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+// Takes blocks in file order as they finish parsing and closes the gaps left by skipped rows
+// (headers, blank or malformed lines). A block only ever moves down into space no later block
+// uses, and rows already handed to the name thread are never touched. Returns the row count.
+static int PlaceParsedBlocks(CatalogLoad *load) {
+  StarArray *array = load->array;
+  int size = 0;
+
+  for (int b = 0; b < load->block_count; b++) {
+    pthread_mutex_lock(&load->lock);
+    while (!load->parsed[b]) {
+      pthread_cond_wait(&load->block_parsed, &load->lock);
+    }
+    pthread_mutex_unlock(&load->lock);
+
+    const ParseChunk *block = &load->blocks[b];
+    int offset = (int)(block->stars - array->stars);
+    if (offset != size) {
+      memmove(array->stars + size, block->stars, block->row_count * sizeof(Star));
+      memmove(array->position_pool + size, block->positions, block->row_count * sizeof(Position));
+      memmove(load->hashes + size, block->hashes, block->row_count * sizeof(unsigned int));
+    }
+    for (int i = size; i < size + block->row_count; i++) {
+      array->stars[i].position = &array->position_pool[i];
+    }
+    size += block->row_count;
+
+    pthread_mutex_lock(&load->lock);
+    load->placed = size;
+    pthread_cond_signal(&load->rows_placed);
+    pthread_mutex_unlock(&load->lock);
+  }
+
+  pthread_mutex_lock(&load->lock);
+  load->placing_done = 1;
+  pthread_cond_signal(&load->rows_placed);
+  pthread_mutex_unlock(&load->lock);
+  return size;
+}
+
+// ParseFile() + CreateBalancedKDTree() + CreateHashMap() in one overlapped pass. Returns the
+// catalog with *tree and *names built over it, or NULL (and both NULL) on failure. Storage is
+// not shrunk to fit afterwards, so the array may keep a few slots for skipped rows.
+StarArray *LoadStarCatalog(const char *path, int leaf_size, KDTree **tree, HashMap **names) {
+  *tree = NULL;
+  *names = NULL;
+
+  const char *data;
+  size_t file_size;
+  if (!MapCatalogFile(path, &data, &file_size)) {
+    return NULL;
+  }
+
+  StarArray *array = calloc(1, sizeof(StarArray));
+  CatalogLoad load = {0};
+  load.block_count = (int)(file_size / LOAD_BLOCK_BYTES) + 1;
+  load.blocks = calloc(load.block_count, sizeof(ParseChunk));
+  load.parsed = calloc(load.block_count, 1);
+  int thread_count = GetThreadCount();
+  pthread_t *threads = calloc(thread_count, sizeof(pthread_t));
+  if (array == NULL || load.blocks == NULL || load.parsed == NULL || threads == NULL) {
+    fprintf(stderr, "ERROR [LoadStarCatalog()]: MEMORY ALLOCATION FAILED FOR CATALOG LOAD!\n");
+    goto fail;
+  }
+
+  int total_rows = (file_size > 0) ? SplitParseChunks(data, file_size, load.blocks, load.block_count) : 0;
+  if (!AllocParsedStorage(array, total_rows, file_size)) {
+    goto fail;
+  }
+  load.hashes = malloc((total_rows > 0 ? total_rows : 1) * sizeof(unsigned int));
+  if (load.hashes == NULL) {
+    fprintf(stderr, "ERROR [LoadStarCatalog()]: MEMORY ALLOCATION FAILED FOR CATALOG LOAD!\n");
+    goto fail;
+  }
+
+  // Sized for every row up front, so the name thread never has to resize it
+  load.map = calloc(1, sizeof(HashMap));
+  if (load.map == NULL || (load.map->slots = calloc(HashMapCapacityFor(total_rows), sizeof(HashEntry))) == NULL) {
+    fprintf(stderr, "ERROR [LoadStarCatalog()]: MEMORY ALLOCATION FAILED FOR HASHMAP!\n");
+    goto fail;
+  }
+  load.map->stars = array->stars;
+  load.map->size = HashMapCapacityFor(total_rows);
+
+  int row_offset = 0;
+  for (int i = 0; i < load.block_count; i++) {
+    load.blocks[i].name_pool = array->name_pool;
+    load.blocks[i].stars = array->stars + row_offset;
+    load.blocks[i].positions = array->position_pool + row_offset;
+    load.blocks[i].hashes = load.hashes + row_offset;
+    row_offset += load.blocks[i].row_capacity;
+  }
+  if (file_size == 0) {
+    load.block_count = 0;
+  }
+
+  load.array = array;
+  pthread_mutex_init(&load.lock, NULL);
+  pthread_cond_init(&load.block_parsed, NULL);
+  pthread_cond_init(&load.rows_placed, NULL);
+
+  int parse_started = 0;
+  while (parse_started < thread_count && pthread_create(&threads[parse_started], NULL, LoadParseWorker, &load) == 0) {
+    parse_started++;
+  }
+  pthread_t name_thread;
+  int name_started = pthread_create(&name_thread, NULL, LoadNameWorker, &load) == 0;
+
+  // Without threads every stage still runs, just one after another on this thread
+  if (parse_started == 0) {
+    LoadParseWorker(&load);
+  }
+  array->size = PlaceParsedBlocks(&load);
+  for (int i = 0; i < parse_started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  *tree = CreateKDTreeFromIds(array, NULL, array->size, leaf_size);
+
+  if (name_started) {
+    pthread_join(name_thread, NULL);
+  } else {
+    LoadNameWorker(&load);
+  }
+
+  pthread_cond_destroy(&load.rows_placed);
+  pthread_cond_destroy(&load.block_parsed);
+  pthread_mutex_destroy(&load.lock);
+  if (*tree == NULL) {
+    goto fail;
+  }
+
+  *names = load.map;
+  free(load.hashes);
+  free(load.parsed);
+  free(load.blocks);
+  free(threads);
+  if (data != NULL) {
+    munmap((void *)data, file_size);
+  }
+  return array;
+
+fail:
+  DeallocHashMap(load.map);
+  free(load.hashes);
+  free(load.parsed);
+  free(load.blocks);
+  free(threads);
+  if (data != NULL) {
+    munmap((void *)data, file_size);
+  }
+  DeallocMainStarArray(array);
+  *tree = NULL;
+  return NULL;
+}
+
+// ARRAY UTILITY FUNCTIONS
+void AddStarToArray(StarArray *array, Star *star) {
+  if (array->size == array->capacity) {
+    int capacity = (array->capacity < 16) ? 16 : (int)(array->capacity * 1.5); // Grow by half if full
+    Star *stars = realloc(array->stars, capacity * sizeof(Star));
+
+    if (!stars) {
+      fprintf(stderr, "ERROR [AddStarToArray()]: MEMORY ALLOCATION FAILED DURING REALLOC!\n");
+      return;
+    }
+    array->stars = stars;
+    STATS_ADD(bytes_allocated, (capacity - array->capacity) * sizeof(Star));
+    array->capacity = capacity;
+  }
+
+  array->stars[array->size++] = *star;
+
+  // printf("Number of stars in the array: %d\n", array->size);
+  // printf("Allocated capacity of the array: %d\n", array->capacity);
+}
+
+void OptimizeStarArraySize(StarArray *array) {
+  if (array->size < array->capacity && array->size > 0) {
+    Star *stars = realloc(array->stars, array->size * sizeof(Star));
+    if (!stars) {
+      fprintf(stderr, "ERROR [OptimizeStarArraySize()]: MEMORY REALLOCATION FAILED DURING OPTIMIZATION!\n");
+      return;
+    }
+    array->stars = stars;
+
+    // Pooled positions move with the realloc; callers re-point Star.position afterwards
+    if (array->position_pool) {
+      Position *positions = realloc(array->position_pool, array->size * sizeof(Position));
+      if (positions) {
+        array->position_pool = positions;
+        array->position_pool_size = array->size;
+      }
+    }
+    array->capacity = array->size;
+  }
+}
+
+void PrintStarValues(StarArray *star_array) {
+  for (size_t i = 0; i < star_array->size; i++) {
+    printf("%s: (%.2f, %.2f, %.2f)\n", star_array->stars[i].name,
+           star_array->stars[i].position->x, star_array->stars[i].position->y,
+           star_array->stars[i].position->z);
+    printf("Light years from Sol: %.3f\n\n", star_array->stars[i].lightyears);
+  }
+}
+
+void DeallocSubStarArray(StarArray *array) {
+  if (array) {
+    free(array->stars);
+    free(array);
+  }
+}
+
+void DeallocMainStarArray(StarArray *array) {
+  if (array) {
+    for (int i = 0; array->stars && i < array->size; i++) {
+      if (array->stars[i].name && !IsPooledName(array, array->stars[i].name)) {
+        free(array->stars[i].name);
+      }
+      if (array->stars[i].position && !IsPooledPosition(array, array->stars[i].position)) {
+        free(array->stars[i].position);
+      }
+    }
+    free(array->name_pool);     // Names parsed by ParseFile()
+    free(array->position_pool); // Positions parsed by ParseFile()
+    free(array->stars);         // Free stars array
+    free(array);                // Free array struct
+  }
+}
+
+int IsPooledName(const StarArray *array, const char *name) {
+  return array->name_pool != NULL && name >= array->name_pool &&
+         name < array->name_pool + array->name_pool_size;
+}
+
+int IsPooledPosition(const StarArray *array, const Position *position) {
+  return array->position_pool != NULL && position >= array->position_pool &&
+         position < array->position_pool + array->position_pool_size;
+}
+
+// SIMD DISTANCE KERNELS
+// All kernels take structure-of-arrays x/y/z coordinates (or any slice of them) and work on
+// squared distances; AVX handles four stars per step, SSE2 two, with a scalar tail.
+void DistanceSquaredBatch(const double *x, const double *y, const double *z, int count,
+                          const Position reference, double *out) {
+  int i = 0;
+
+#if defined(__AVX__)
+  __m256d rx = _mm256_set1_pd(reference.x);
+  __m256d ry = _mm256_set1_pd(reference.y);
+  __m256d rz = _mm256_set1_pd(reference.z);
+  for (; i + 4 <= count; i += 4) {
+    __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + i), rx);
+    __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + i), ry);
+    __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(z + i), rz);
+    __m256d d2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)),
+                               _mm256_mul_pd(dz, dz));
+    _mm256_storeu_pd(out + i, d2);
+  }
+#elif defined(__SSE2__)
+  __m128d rx = _mm_set1_pd(reference.x);
+  __m128d ry = _mm_set1_pd(reference.y);
+  __m128d rz = _mm_set1_pd(reference.z);
+  for (; i + 2 <= count; i += 2) {
+    __m128d dx = _mm_sub_pd(_mm_loadu_pd(x + i), rx);
+    __m128d dy = _mm_sub_pd(_mm_loadu_pd(y + i), ry);
+    __m128d dz = _mm_sub_pd(_mm_loadu_pd(z + i), rz);
+    __m128d d2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
+    _mm_storeu_pd(out + i, d2);
+  }
+#endif
+
+  for (; i < count; i++) {
+    double dx = x[i] - reference.x;
+    double dy = y[i] - reference.y;
+    double dz = z[i] - reference.z;
+    out[i] = (dx * dx) + (dy * dy) + (dz * dz);
+  }
+}
+
+// Returns the index of the closest point that beats *best_distance_sq (updating it), or -1
+int NearestInBatch(const double *x, const double *y, const double *z, int count,
+                   const Position reference, double *best_distance_sq) {
+  int best_index = -1;
+  double best = *best_distance_sq;
+  int i = 0;
+
+#if defined(__AVX__)
+  if (count >= 4) {
+    __m256d rx = _mm256_set1_pd(reference.x);
+    __m256d ry = _mm256_set1_pd(reference.y);
+    __m256d rz = _mm256_set1_pd(reference.z);
+    __m256d lane_best = _mm256_set1_pd(best);
+    __m256d lane_index = _mm256_set1_pd(-1.0);
+    __m256d index = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+    __m256d step = _mm256_set1_pd(4.0);
+
+    for (; i + 4 <= count; i += 4) {
+      __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + i), rx);
+      __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + i), ry);
+      __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(z + i), rz);
+      __m256d d2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)),
+                                 _mm256_mul_pd(dz, dz));
+      __m256d closer = _mm256_cmp_pd(d2, lane_best, _CMP_LT_OQ);
+      lane_best = _mm256_blendv_pd(lane_best, d2, closer);
+      lane_index = _mm256_blendv_pd(lane_index, index, closer);
+      index = _mm256_add_pd(index, step);
+    }
+
+    double lanes[4], indices[4];
+    _mm256_storeu_pd(lanes, lane_best);
+    _mm256_storeu_pd(indices, lane_index);
+    for (int lane = 0; lane < 4; lane++) {
+      if (indices[lane] >= 0 && (lanes[lane] < best || (lanes[lane] == best && (int)indices[lane] < best_index))) {
+        best = lanes[lane];
+        best_index = (int)indices[lane];
+      }
+    }
+  }
+#elif defined(__SSE2__)
+  if (count >= 2) {
+    __m128d rx = _mm_set1_pd(reference.x);
+    __m128d ry = _mm_set1_pd(reference.y);
+    __m128d rz = _mm_set1_pd(reference.z);
+    __m128d lane_best = _mm_set1_pd(best);
+    __m128d lane_index = _mm_set1_pd(-1.0);
+    __m128d index = _mm_set_pd(1.0, 0.0);
+    __m128d step = _mm_set1_pd(2.0);
+
+    for (; i + 2 <= count; i += 2) {
+      __m128d dx = _mm_sub_pd(_mm_loadu_pd(x + i), rx);
+      __m128d dy = _mm_sub_pd(_mm_loadu_pd(y + i), ry);
+      __m128d dz = _mm_sub_pd(_mm_loadu_pd(z + i), rz);
+      __m128d d2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
+      __m128d closer = _mm_cmplt_pd(d2, lane_best);
+      lane_best = _mm_or_pd(_mm_and_pd(closer, d2), _mm_andnot_pd(closer, lane_best));
+      lane_index = _mm_or_pd(_mm_and_pd(closer, index), _mm_andnot_pd(closer, lane_index));
+      index = _mm_add_pd(index, step);
+    }
+
+    double lanes[2], indices[2];
+    _mm_storeu_pd(lanes, lane_best);
+    _mm_storeu_pd(indices, lane_index);
+    for (int lane = 0; lane < 2; lane++) {
+      if (indices[lane] >= 0 && (lanes[lane] < best || (lanes[lane] == best && (int)indices[lane] < best_index))) {
+        best = lanes[lane];
+        best_index = (int)indices[lane];
+      }
+    }
+  }
+#endif
+
+  for (; i < count; i++) {
+    double dx = x[i] - reference.x;
+    double dy = y[i] - reference.y;
+    double dz = z[i] - reference.z;
+    double d2 = (dx * dx) + (dy * dy) + (dz * dz);
+    if (d2 < best) {
+      best = d2;
+      best_index = i;
+    }
+  }
+
+  *best_distance_sq = best;
+  return best_index;
+}
+
+// Writes the indices (relative to x/y/z) of every point within radius into out; returns the hit count
+int RadiusFilterBatch(const double *x, const double *y, const double *z, int count,
+                      const Position reference, double radius_sq, int *out) {
+  int hits = 0;
+  int i = 0;
+
+#if defined(__AVX__)
+  __m256d rx = _mm256_set1_pd(reference.x);
+  __m256d ry = _mm256_set1_pd(reference.y);
+  __m256d rz = _mm256_set1_pd(reference.z);
+  __m256d limit = _mm256_set1_pd(radius_sq);
+  for (; i + 4 <= count; i += 4) {
+    __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + i), rx);
+    __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + i), ry);
+    __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(z + i), rz);
+    __m256d d2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)),
+                               _mm256_mul_pd(dz, dz));
+    int mask = _mm256_movemask_pd(_mm256_cmp_pd(d2, limit, _CMP_LE_OQ));
+    while (mask) {
+      int lane = __builtin_ctz(mask);
+      out[hits++] = i + lane;
+      mask &= mask - 1;
+    }
+  }
+#elif defined(__SSE2__)
+  __m128d rx = _mm_set1_pd(reference.x);
+  __m128d ry = _mm_set1_pd(reference.y);
+  __m128d rz = _mm_set1_pd(reference.z);
+  __m128d limit = _mm_set1_pd(radius_sq);
+  for (; i + 2 <= count; i += 2) {
+    __m128d dx = _mm_sub_pd(_mm_loadu_pd(x + i), rx);
+    __m128d dy = _mm_sub_pd(_mm_loadu_pd(y + i), ry);
+    __m128d dz = _mm_sub_pd(_mm_loadu_pd(z + i), rz);
+    __m128d d2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
+    int mask = _mm_movemask_pd(_mm_cmple_pd(d2, limit));
+    if (mask & 1) {
+      out[hits++] = i;
+    }
+    if (mask & 2) {
+      out[hits++] = i + 1;
+    }
+  }
+#endif
+
+  for (; i < count; i++) {
+    double dx = x[i] - reference.x;
+    double dy = y[i] - reference.y;
+    double dz = z[i] - reference.z;
+    if ((dx * dx) + (dy * dy) + (dz * dz) <= radius_sq) {
+      out[hits++] = i;
+    }
+  }
+
+  return hits;
+}
+
+// KD-TREE UTILITY FUNCTIONS
+StarArray* StarSearchRange(KDTree *tree, Star *center, float radius) {
+  StarArray *result = CreateStarArray();
+  if (result == NULL) {
+    return NULL;
+  }
+
+  STATS_BEGIN();
+  RadiusSearch(tree, 0, center, radius, result);
+  STATS_END(NULL);
+
+  // float distance_from_player = 0;
+
+  // printf("\n\nStars within %.2f light years:\n", radius);
+
+  // for (int i = 0; i < result->size; i++) {
+  //   Star *star = &result->stars[i];
+  //   distance_from_player = CalculateDistance(star, &player_position);
+  //   printf("  - %s at %.2f light years\n", star->name, distance_from_player);
+  // }
+
+  return result;
+}
+
+void RadiusSearch(KDTree *tree, int node_index, Star *center, float radius, StarArray *result) {
+  const KDTreeNode *node = &tree->nodes[node_index];
+  if (node->count == 0) {
+    // Base case
+    return;
+  }
+  STATS_ADD(nodes_visited, 1);
+
+  if (node->axis < 0) {
+    STATS_ADD(distance_evals, node->count);
+    int hits[KD_MAX_LEAF_SIZE];
+    int hit_count = RadiusFilterBatch(tree->x + node->begin, tree->y + node->begin, tree->z + node->begin,
+                                      node->count, *center->position, (double)radius * radius, hits);
+    for (int i = 0; i < hit_count; i++) {
+      AddStarToArray(result, &tree->stars[tree->ids[node->begin + hits[i]]]);
+    }
+    return;
+  }
+
+  double diff = KDAxisValue(center->position, node->axis) - node->split;
+
+  // printf("Axis: %d, Diff: %.2f, Radius: %.2f\n", node->axis, diff, radius);
+
+  if (diff < 0) {
+    RadiusSearch(tree, 2 * node_index + 1, center, radius, result);
+
+    if (fabs(diff) <= radius) {
+      RadiusSearch(tree, 2 * node_index + 2, center, radius, result);
+    } else {
+      STATS_ADD(subtrees_pruned, 1);
+    }
+  } else {
+    RadiusSearch(tree, 2 * node_index + 2, center, radius, result);
+
+    if (fabs(diff) <= radius) {
+      RadiusSearch(tree, 2 * node_index + 1, center, radius, result);
+    } else {
+      STATS_ADD(subtrees_pruned, 1);
+    }
+  }
+}
+
+Star* NearestNeighbor(KDTree *tree, const Position reference) {
+  if (tree == NULL || tree->size == 0) {
+    return NULL;
+  }
+
+  STATS_BEGIN();
+  double current_best_distance = DBL_MAX; // Squared
+  int neighbor = NearestNeighborSearch(tree, 0, reference, -1, &current_best_distance);
+  STATS_END(NULL);
+
+  // printf("Closest star is %s at a distance of %.2f light years from current location.\n\n", neighbor->name, sqrt(current_best_distance));
+
+  return (neighbor >= 0) ? &tree->stars[neighbor] : NULL;
+}
+
+// Returns the id of the closest star found so far; distances are squared
+int NearestNeighborSearch(KDTree *tree, int node_index, const Position reference, int current_closest_star, double *current_best_distance) {
+  const KDTreeNode *node = &tree->nodes[node_index];
+  if (node->count == 0) {
+    return current_closest_star;
+  }
+  STATS_ADD(nodes_visited, 1);
+
+  if (node->axis < 0) {
+    STATS_ADD(distance_evals, node->count);
+    int best = NearestInBatch(tree->x + node->begin, tree->y + node->begin, tree->z + node->begin,
+                              node->count, reference, current_best_distance);
+    return (best >= 0) ? tree->ids[node->begin + best] : current_closest_star;
+  }
+
+  double diff = KDAxisValue(&reference, node->axis) - node->split;
+
+  int near_subtree = (diff < 0) ? 2 * node_index + 1 : 2 * node_index + 2;
+  int far_subtree = (diff < 0) ? 2 * node_index + 2 : 2 * node_index + 1;
+
+  current_closest_star = NearestNeighborSearch(tree, near_subtree, reference, current_closest_star, current_best_distance);
+
+  if (diff * diff < *current_best_distance) {
+    current_closest_star = NearestNeighborSearch(tree, far_subtree, reference, current_closest_star, current_best_distance);
+  } else {
+    STATS_ADD(subtrees_pruned, 1);
+  }
+
+  return current_closest_star;
+}
+
+// APPROXIMATE NEAREST NEIGHBOR
+// Tracks the squared distance from the reference to each subtree's box (one axis offset
+// changes per split), and only enters a far subtree if that box is closer than best / (1+eps)^2.
+// The star returned is then within (1 + epsilon) of the true nearest distance. max_nodes caps
+// the nodes entered after the first leaf, trading the guarantee for a hard latency bound.
+typedef struct ApproxSearch {
+  const KDTree *tree;
+  Position reference;
+  double shrink;   // 1 / (1 + epsilon)^2
+  long budget;     // Nodes left to enter once a leaf has been scanned
+  int best;
+  double best_sq;
+  double offsets[3];
+} ApproxSearch;
+
+static void ApproxNearestSearch(ApproxSearch *search, int node_index, double box_sq) {
+  const KDTree *tree = search->tree;
+  const KDTreeNode *node = &tree->nodes[node_index];
+  if (node->count == 0) {
+    return;
+  }
+  STATS_ADD(nodes_visited, 1);
+  // The descent to the first leaf is free, so even a budget of 1 returns a real candidate
+  if (search->best >= 0) {
+    search->budget--;
+  }
+
+  if (node->axis < 0) {
+    STATS_ADD(distance_evals, node->count);
+    int best = NearestInBatch(tree->x + node->begin, tree->y + node->begin, tree->z + node->begin,
+                              node->count, search->reference, &search->best_sq);
+    if (best >= 0) {
+      search->best = tree->ids[node->begin + best];
+    }
+    return;
+  }
+
+  double diff = KDAxisValue(&search->reference, node->axis) - node->split;
+  int near_subtree = (diff < 0) ? 2 * node_index + 1 : 2 * node_index + 2;
+  int far_subtree = (diff < 0) ? 2 * node_index + 2 : 2 * node_index + 1;
+
+  ApproxNearestSearch(search, near_subtree, box_sq);
+
+  // The far box differs from this one only along the split axis
+  double old_offset = search->offsets[node->axis];
+  double far_sq = box_sq - (old_offset * old_offset) + (diff * diff);
+  if (search->budget > 0 && far_sq < search->best_sq * search->shrink) {
+    search->offsets[node->axis] = diff;
+    ApproxNearestSearch(search, far_subtree, far_sq);
+    search->offsets[node->axis] = old_offset;
+  } else {
+    STATS_ADD(subtrees_pruned, 1);
+  }
+}
+
+// Id of a star within (1 + epsilon) of the nearest distance to reference (epsilon 0 is exact),
+// or -1 for an empty tree. max_nodes <= 0 means no cap. distance (may be NULL) receives the
+// star's distance.
+int ApproxNearestNeighborId(KDTree *tree, const Position reference, double epsilon, long max_nodes, double *distance) {
+  if (tree == NULL || tree->size == 0) {
+    return -1;
+  }
+  if (epsilon < 0.0) {
+    epsilon = 0.0;
+  }
+
+  STATS_BEGIN();
+  ApproxSearch search = {tree, reference, 1.0 / ((1.0 + epsilon) * (1.0 + epsilon)), (max_nodes > 0) ? max_nodes : LONG_MAX,
+                         -1, DBL_MAX, {0.0, 0.0, 0.0}};
+  ApproxNearestSearch(&search, 0, 0.0);
+  STATS_END(NULL);
+
+  if (distance != NULL) {
+    *distance = sqrt(search.best_sq);
+  }
+  return search.best;
+}
+
+Star* ApproxNearestNeighbor(KDTree *tree, const Position reference, double epsilon, long max_nodes) {
+  int id = ApproxNearestNeighborId(tree, reference, epsilon, max_nodes, NULL);
+  return (id >= 0) ? &tree->stars[id] : NULL;
+}
+
+// Bounded max-heap of the k best (squared distance, id) pairs seen so far; the root is the
+// current k-th best, which is also the pruning bound once the heap is full.
+typedef struct KNNHeap {
+  double *distances;
+  int *ids;
+  int size;
+  int k;
+} KNNHeap;
+
+static void KNNHeapReplaceRoot(KNNHeap *heap, double distance, int id);
+
+static void KNNHeapPush(KNNHeap *heap, double distance, int id) {
+  STATS_ADD(heap_pushes, 1);
+  if (heap->size < heap->k) {
+    int i = heap->size++;
+    while (i > 0 && heap->distances[(i - 1) / 2] < distance) {
+      heap->distances[i] = heap->distances[(i - 1) / 2];
+      heap->ids[i] = heap->ids[(i - 1) / 2];
+      i = (i - 1) / 2;
+    }
+    heap->distances[i] = distance;
+    heap->ids[i] = id;
+    return;
+  }
+
+  if (distance >= heap->distances[0]) {
+    return;
+  }
+
+  KNNHeapReplaceRoot(heap, distance, id);
+}
+
+// Replaces the root with (distance, id) and sifts it down
+static void KNNHeapReplaceRoot(KNNHeap *heap, double distance, int id) {
+  int i = 0;
+  while (1) {
+    int largest = i;
+    int left = 2 * i + 1;
+    int right = 2 * i + 2;
+    double largest_distance = distance;
+    if (left < heap->size && heap->distances[left] > largest_distance) {
+      largest = left;
+      largest_distance = heap->distances[left];
+    }
+    if (right < heap->size && heap->distances[right] > largest_distance) {
+      largest = right;
+    }
+    if (largest == i) {
+      break;
+    }
+    heap->distances[i] = heap->distances[largest];
+    heap->ids[i] = heap->ids[largest];
+    i = largest;
+  }
+  heap->distances[i] = distance;
+  heap->ids[i] = id;
+}
+
+// Heap sort in place: repeatedly move the farthest remaining entry to the back. Leaves the
+// entries nearest first and returns how many there are.
+static int SortKNNHeap(KNNHeap *heap) {
+  int found = heap->size;
+  while (heap->size > 1) {
+    double distance = heap->distances[heap->size - 1];
+    int id = heap->ids[heap->size - 1];
+    heap->distances[heap->size - 1] = heap->distances[0];
+    heap->ids[heap->size - 1] = heap->ids[0];
+    heap->size--;
+    KNNHeapReplaceRoot(heap, distance, id);
+  }
+  heap->size = found;
+  return found;
+}
+
+static void KNearestSearch(KDTree *tree, int node_index, const Position reference, KNNHeap *heap) {
+  const KDTreeNode *node = &tree->nodes[node_index];
+  if (node->count == 0) {
+    return;
+  }
+  STATS_ADD(nodes_visited, 1);
+
+  if (node->axis < 0) {
+    STATS_ADD(distance_evals, node->count);
+    double distances[KD_MAX_LEAF_SIZE];
+    DistanceSquaredBatch(tree->x + node->begin, tree->y + node->begin, tree->z + node->begin,
+                         node->count, reference, distances);
+    for (int i = 0; i < node->count; i++) {
+      KNNHeapPush(heap, distances[i], tree->ids[node->begin + i]);
+    }
+    return;
+  }
+
+  double diff = KDAxisValue(&reference, node->axis) - node->split;
+  int near_subtree = (diff < 0) ? 2 * node_index + 1 : 2 * node_index + 2;
+  int far_subtree = (diff < 0) ? 2 * node_index + 2 : 2 * node_index + 1;
+
+  KNearestSearch(tree, near_subtree, reference, heap);
+
+  if (heap->size < heap->k || diff * diff < heap->distances[0]) {
+    KNearestSearch(tree, far_subtree, reference, heap);
+  } else {
+    STATS_ADD(subtrees_pruned, 1);
+  }
+}
+
+// Writes the ids of the (up to) k closest stars, nearest first, into ids and their distances
+// into distances (may be NULL). Both buffers must hold k entries. Returns the number found.
+int KNearestNeighborIds(KDTree *tree, const Position reference, int k, int *ids, double *distances) {
+  if (tree == NULL || k <= 0 || tree->size == 0) {
+    return 0;
+  }
+
+  double stack_distances[64];
+  double *heap_distances = distances;
+  if (heap_distances == NULL) {
+    heap_distances = (k <= 64) ? stack_distances : malloc(k * sizeof(double));
+    if (heap_distances == NULL) {
+      fprintf(stderr, "ERROR [KNearestNeighborIds()]: MEMORY ALLOCATION FAILED FOR DISTANCES!\n");
+      return 0;
+    }
+  }
+
+  STATS_BEGIN();
+  KNNHeap heap = {heap_distances, ids, 0, k};
+  KNearestSearch(tree, 0, reference, &heap);
+  int found = SortKNNHeap(&heap);
+  STATS_END(NULL);
+
+  if (distances != NULL) {
+    for (int i = 0; i < found; i++) {
+      distances[i] = sqrt(distances[i]);
+    }
+  } else if (heap_distances != stack_distances) {
+    free(heap_distances);
+  }
+
+  return found;
+}
+
+// The k closest stars to position, sorted by distance (nearest first)
+StarArray *KNearestNeighbors(KDTree *tree, const Position position, int k) {
+  StarArray *result = CreateStarArray();
+  if (result == NULL || k <= 0) {
+    return result;
+  }
+
+  int *ids = malloc(k * sizeof(int));
+  if (ids == NULL) {
+    fprintf(stderr, "ERROR [KNearestNeighbors()]: MEMORY ALLOCATION FAILED FOR NEIGHBOR IDS!\n");
+    return result;
+  }
+
+  int found = KNearestNeighborIds(tree, position, k, ids, NULL);
+  for (int i = 0; i < found; i++) {
+    AddStarToArray(result, &tree->stars[ids[i]]);
+  }
+
+  free(ids);
+  return result;
+}
+
+// BATCHED NEAREST-NEIGHBOR QUERIES
+// Queries are sorted along a Morton (Z-order) curve so neighbouring positions are answered
+// one after another by the same thread. Each answer then seeds the next query's bound: the
+// distance to the previous nearest star is a valid upper bound, so most of the far side of
+// the tree is pruned before it is touched.
+#define NN_BATCH_GRAIN 256
+
+typedef struct NearestBatchContext {
+  KDTree *tree;
+  const Position *positions;
+  const unsigned long *order; // Morton code << 32 | query index, sorted
+  int *out_ids;
+} NearestBatchContext;
+
+static unsigned long SpreadMortonBits(unsigned long value) {
+  value &= 0x1fffff;
+  value = (value | value << 32) & 0x1f00000000ffffUL;
+  value = (value | value << 16) & 0x1f0000ff0000ffUL;
+  value = (value | value << 8) & 0x100f00f00f00f00fUL;
+  value = (value | value << 4) & 0x10c30c30c30c30c3UL;
+  value = (value | value << 2) & 0x1249249249249249UL;
+  return value;
+}
+
+static int CompareMortonKeys(const void *a, const void *b) {
+  unsigned long key_a = *(const unsigned long *)a;
+  unsigned long key_b = *(const unsigned long *)b;
+  return (key_a > key_b) - (key_a < key_b);
+}
+
+static void NearestBatchTask(void *user_data, int begin, int end) {
+  NearestBatchContext *ctx = user_data;
+  int previous = -1;
+
+  for (int i = begin; i < end; i++) {
+    int query = (int)(ctx->order[i] & 0xffffffffUL);
+    const Position reference = ctx->positions[query];
+    double best = DBL_MAX;
+
+    if (previous >= 0) {
+      Star *star = &ctx->tree->stars[previous];
+      double dx = star->position->x - reference.x;
+      double dy = star->position->y - reference.y;
+      double dz = star->position->z - reference.z;
+      best = (dx * dx) + (dy * dy) + (dz * dz);
+    }
+
+    previous = NearestNeighborSearch(ctx->tree, 0, reference, previous, &best);
+    ctx->out_ids[query] = previous;
+  }
+}
+
+// Writes the id of the nearest star to positions[i] into out_ids[i] (-1 for an empty tree).
+// Returns 1 on success, 0 if scratch memory could not be allocated.
+int NearestNeighborBatch(KDTree *tree, const Position *positions, int count, int *out_ids) {
+  if (count <= 0) {
+    return 1;
+  }
+  if (tree == NULL || tree->size == 0) {
+    for (int i = 0; i < count; i++) {
+      out_ids[i] = -1;
+    }
+    return 1;
+  }
+
+  unsigned long *order = malloc(count * sizeof(unsigned long));
+  if (order == NULL) {
+    fprintf(stderr, "ERROR [NearestNeighborBatch()]: MEMORY ALLOCATION FAILED FOR QUERY ORDER!\n");
+    return 0;
+  }
+
+  // Quantize each query to 10 bits per axis inside the batch's bounding box
+  double min[3] = {DBL_MAX, DBL_MAX, DBL_MAX};
+  double max[3] = {-DBL_MAX, -DBL_MAX, -DBL_MAX};
+  for (int i = 0; i < count; i++) {
+    for (int axis = 0; axis < 3; axis++) {
+      double value = KDAxisValue(&positions[i], axis);
+      min[axis] = (value < min[axis]) ? value : min[axis];
+      max[axis] = (value > max[axis]) ? value : max[axis];
+    }
+  }
+
+  double scale[3];
+  for (int axis = 0; axis < 3; axis++) {
+    double extent = max[axis] - min[axis];
+    scale[axis] = (extent > 0) ? 1023.0 / extent : 0.0;
+  }
+
+  for (int i = 0; i < count; i++) {
+    unsigned long code = 0;
+    for (int axis = 0; axis < 3; axis++) {
+      unsigned long cell = (unsigned long)((KDAxisValue(&positions[i], axis) - min[axis]) * scale[axis]);
+      code |= SpreadMortonBits(cell) << axis;
+    }
+    // 10 bits per axis keep the code in the upper half next to the 32-bit query index
+    order[i] = (code << 32) | (unsigned int)i;
+  }
+  qsort(order, count, sizeof(unsigned long), CompareMortonKeys);
+
+  NearestBatchContext ctx = {tree, positions, order, out_ids};
+  ParallelFor(count, NN_BATCH_GRAIN, NearestBatchTask, &ctx);
+
+  free(order);
+  return 1;
+}
+
+// ALLOCATION-FREE RADIUS QUERIES
+// Hits are reported as star ids plus squared distances, either to a visitor or into a
+// StarIdBuffer the caller keeps between queries; the buffer only grows when a query returns
+// more hits than any query before it, so a warmed-up query loop never touches the heap.
+void InitStarIdBuffer(StarIdBuffer *buffer) {
+  buffer->ids = NULL;
+  buffer->distances = NULL;
+  buffer->size = 0;
+  buffer->capacity = 0;
+}
+
+int ReserveStarIdBuffer(StarIdBuffer *buffer, int capacity) {
+  if (capacity <= buffer->capacity) {
+    return 1;
+  }
+
+  int new_capacity = buffer->capacity ? buffer->capacity : 64;
+  while (new_capacity < capacity) {
+    new_capacity *= 2;
+  }
+
+  int *ids = realloc(buffer->ids, new_capacity * sizeof(int));
+  if (ids == NULL) {
+    fprintf(stderr, "ERROR [ReserveStarIdBuffer()]: MEMORY ALLOCATION FAILED FOR ID BUFFER!\n");
+    return 0;
+  }
+  buffer->ids = ids;
+
+  double *distances = realloc(buffer->distances, new_capacity * sizeof(double));
+  if (distances == NULL) {
+    fprintf(stderr, "ERROR [ReserveStarIdBuffer()]: MEMORY ALLOCATION FAILED FOR DISTANCE BUFFER!\n");
+    return 0;
+  }
+  buffer->distances = distances;
+  STATS_ADD(bytes_allocated, (new_capacity - buffer->capacity) * (sizeof(int) + sizeof(double)));
+  buffer->capacity = new_capacity;
+
+  return 1;
+}
+
+void DeallocStarIdBuffer(StarIdBuffer *buffer) {
+  free(buffer->ids);
+  free(buffer->distances);
+  InitStarIdBuffer(buffer);
+}
+
+// Returns 0 once the visitor has asked to stop
+static int RadiusVisit(KDTree *tree, int node_index, const Position center, double radius,
+                       StarVisitor visitor, void *user_data) {
+  const KDTreeNode *node = &tree->nodes[node_index];
+  if (node->count == 0) {
+    return 1;
+  }
+  STATS_ADD(nodes_visited, 1);
+
+  if (node->axis < 0) {
+    STATS_ADD(distance_evals, node->count);
+    double distances[KD_MAX_LEAF_SIZE];
+    DistanceSquaredBatch(tree->x + node->begin, tree->y + node->begin, tree->z + node->begin,
+                         node->count, center, distances);
+    double radius_sq = radius * radius;
+    for (int i = 0; i < node->count; i++) {
+      if (distances[i] <= radius_sq && !visitor(user_data, tree->ids[node->begin + i], distances[i])) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+  double diff = KDAxisValue(&center, node->axis) - node->split;
+  int near_subtree = (diff < 0) ? 2 * node_index + 1 : 2 * node_index + 2;
+  int far_subtree = (diff < 0) ? 2 * node_index + 2 : 2 * node_index + 1;
+
+  if (!RadiusVisit(tree, near_subtree, center, radius, visitor, user_data)) {
+    return 0;
+  }
+  if (fabs(diff) <= radius) {
+    return RadiusVisit(tree, far_subtree, center, radius, visitor, user_data);
+  }
+  STATS_ADD(subtrees_pruned, 1);
+
+  return 1;
+}
+
+// Calls visitor(user_data, id, squared distance) for every star within radius of center,
+// in no particular order. The visitor returns 0 to end the search early.
+void RadiusSearchVisit(KDTree *tree, const Position center, double radius, StarVisitor visitor, void *user_data) {
+  if (tree == NULL || tree->size == 0) {
+    return;
+  }
+
+  STATS_BEGIN();
+  RadiusVisit(tree, 0, center, radius, visitor, user_data);
+  STATS_END(NULL);
+}
+
+static int AppendStarId(void *user_data, int id, double distance_sq) {
+  StarIdBuffer *buffer = user_data;
+
+  if (buffer->size == buffer->capacity && !ReserveStarIdBuffer(buffer, buffer->size + 1)) {
+    return 0;
+  }
+  buffer->ids[buffer->size] = id;
+  buffer->distances[buffer->size] = distance_sq;
+  buffer->size++;
+
+  return 1;
+}
+
+// Replaces the contents of result with every star within radius of center (unordered).
+// Distances are left squared. Returns the number of hits.
+int RadiusSearchIds(KDTree *tree, const Position center, double radius, StarIdBuffer *result) {
+  result->size = 0;
+  RadiusSearchVisit(tree, center, radius, AppendStarId, result);
+  return result->size;
+}
+
+// Sorts ids and distances together, ascending by distance
+void SortByDistance(int *ids, double *distances, int count) {
+  while (count > 16) {
+    double pivot = distances[count / 2];
+    int i = 0;
+    int j = count - 1;
+    while (i <= j) {
+      while (distances[i] < pivot) i++;
+      while (distances[j] > pivot) j--;
+      if (i <= j) {
+        double distance = distances[i];
+        distances[i] = distances[j];
+        distances[j] = distance;
+        int id = ids[i];
+        ids[i] = ids[j];
+        ids[j] = id;
+        i++;
+        j--;
+      }
+    }
+
+    // Recurse into the smaller side, loop on the larger one
+    if (j + 1 < count - i) {
+      SortByDistance(ids, distances, j + 1);
+      ids += i;
+      distances += i;
+      count -= i;
+    } else {
+      SortByDistance(ids + i, distances + i, count - i);
+      count = j + 1;
+    }
+  }
+
+  for (int i = 1; i < count; i++) {
+    double distance = distances[i];
+    int id = ids[i];
+    int j = i - 1;
+    while (j >= 0 && distances[j] > distance) {
+      distances[j + 1] = distances[j];
+      ids[j + 1] = ids[j];
+      j--;
+    }
+    distances[j + 1] = distance;
+    ids[j + 1] = id;
+  }
+}
+
+// Like RadiusSearchIds(), but nearest first and with distances converted to light years
+int RadiusSearchSorted(KDTree *tree, const Position center, double radius, StarIdBuffer *result) {
+  RadiusSearchIds(tree, center, radius, result);
+  SortByDistance(result->ids, result->distances, result->size);
+
+  for (int i = 0; i < result->size; i++) {
+    result->distances[i] = sqrt(result->distances[i]);
+  }
+
+  return result->size;
+}
+
+// RadiusSearchSorted() capped at the 'limit' nearest hits. Returns how many stars lie within
+// radius in all (which may exceed result->size). The total comes from CountStarsInRadius(), and
+// when it is over the limit the hits are the limit nearest neighbors, so the full hit list is
+// never gathered or sorted.
+int RadiusSearchNearest(KDTree *tree, const Position center, double radius, int limit, StarIdBuffer *result) {
+  int total = CountStarsInRadius(tree, center, radius);
+  if (total <= limit) {
+    RadiusSearchSorted(tree, center, radius, result);
+  } else if (limit > 0 && ReserveStarIdBuffer(result, limit)) {
+    result->size = KNearestNeighborIds(tree, center, limit, result->ids, result->distances);
+  } else {
+    result->size = 0;
+  }
+
+  return total;
+}
+
+// CORRIDOR QUERIES
+// Stars within 'radius' of the segment start -> end (a capsule around a route leg), found in
+// one traversal. A subtree is skipped when the segment misses its bounding box grown by radius
+// on every side, which is a cheap slab test and never skips a subtree that could hold a hit.
+typedef struct Corridor {
+  Position start;
+  double direction[3];      // end - start
+  double inverse_length_sq; // 0 when start == end
+  double radius_sq;
+  double radius;
+  StarVisitor visitor;
+  void *user_data;
+} Corridor;
+
+static void InitCorridor(Corridor *corridor, const Position start, const Position end, double radius) {
+  corridor->start = start;
+  corridor->direction[0] = end.x - start.x;
+  corridor->direction[1] = end.y - start.y;
+  corridor->direction[2] = end.z - start.z;
+  double length_sq = (corridor->direction[0] * corridor->direction[0]) +
+                     (corridor->direction[1] * corridor->direction[1]) +
+                     (corridor->direction[2] * corridor->direction[2]);
+  corridor->inverse_length_sq = (length_sq > 0.0) ? 1.0 / length_sq : 0.0;
+  corridor->radius = radius;
+  corridor->radius_sq = radius * radius;
+}
+
+// How far along the segment (0 to 1) the point closest to (x, y, z) lies
+static inline double CorridorProgress(const Corridor *corridor, double x, double y, double z) {
+  double t = (((x - corridor->start.x) * corridor->direction[0]) + ((y - corridor->start.y) * corridor->direction[1]) +
+              ((z - corridor->start.z) * corridor->direction[2])) * corridor->inverse_length_sq;
+  return (t < 0.0) ? 0.0 : (t > 1.0) ? 1.0 : t;
+}
+
+static inline double CorridorDistanceSquared(const Corridor *corridor, double x, double y, double z) {
+  double t = CorridorProgress(corridor, x, y, z);
+  double dx = x - (corridor->start.x + t * corridor->direction[0]);
+  double dy = y - (corridor->start.y + t * corridor->direction[1]);
+  double dz = z - (corridor->start.z + t * corridor->direction[2]);
+  return (dx * dx) + (dy * dy) + (dz * dz);
+}
+
+static int CorridorHitsBox(const Corridor *corridor, const KDTreeBox *box) {
+  const double origin[3] = {corridor->start.x, corridor->start.y, corridor->start.z};
+  double enter = 0.0;
+  double leave = 1.0;
+
+  for (int axis = 0; axis < 3; axis++) {
+    double low = box->low[axis] - corridor->radius;
+    double high = box->high[axis] + corridor->radius;
+    double direction = corridor->direction[axis];
+    if (direction == 0.0) {
+      if (origin[axis] < low || origin[axis] > high) {
+        return 0;
+      }
+      continue;
+    }
+
+    double t0 = (low - origin[axis]) / direction;
+    double t1 = (high - origin[axis]) / direction;
+    double near = (t0 < t1) ? t0 : t1;
+    double far = (t0 < t1) ? t1 : t0;
+    enter = (near > enter) ? near : enter;
+    leave = (far < leave) ? far : leave;
+    if (enter > leave) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+// Returns 0 once the visitor has asked to stop
+static int CorridorVisit(const KDTree *tree, int node_index, const Corridor *corridor) {
+  const KDTreeNode *node = &tree->nodes[node_index];
+  if (node->count == 0) {
+    return 1;
+  }
+  if (!CorridorHitsBox(corridor, &tree->boxes[node_index])) {
+    STATS_ADD(subtrees_pruned, 1);
+    return 1;
+  }
+  STATS_ADD(nodes_visited, 1);
+
+  if (node->axis < 0) {
+    STATS_ADD(distance_evals, node->count);
+    for (int i = node->begin; i < node->begin + node->count; i++) {
+      double distance_sq = CorridorDistanceSquared(corridor, tree->x[i], tree->y[i], tree->z[i]);
+      if (distance_sq <= corridor->radius_sq && !corridor->visitor(corridor->user_data, tree->ids[i], distance_sq)) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+  return CorridorVisit(tree, 2 * node_index + 1, corridor) && CorridorVisit(tree, 2 * node_index + 2, corridor);
+}
+
+// Calls visitor(user_data, id, squared distance from the segment) for every star within radius
+// of the segment from start to end, in no particular order. The visitor returns 0 to stop.
+void CorridorSearchVisit(KDTree *tree, const Position start, const Position end, double radius, StarVisitor visitor, void *user_data) {
+  if (tree == NULL || tree->size == 0 || radius < 0.0) {
+    return;
+  }
+
+  Corridor corridor;
+  InitCorridor(&corridor, start, end, radius);
+  corridor.visitor = visitor;
+  corridor.user_data = user_data;
+
+  STATS_BEGIN();
+  CorridorVisit(tree, 0, &corridor);
+  STATS_END(NULL);
+}
+
+// Replaces the contents of result with every star in the corridor (unordered, squared distances)
+int CorridorSearchIds(KDTree *tree, const Position start, const Position end, double radius, StarIdBuffer *result) {
+  result->size = 0;
+  CorridorSearchVisit(tree, start, end, radius, AppendStarId, result);
+  return result->size;
+}
+
+// Like CorridorSearchIds(), but ordered along the route from start to end, with distances
+// (from the segment) converted to light years
+int CorridorSearchSorted(KDTree *tree, const Position start, const Position end, double radius, StarIdBuffer *result) {
+  Corridor corridor;
+  InitCorridor(&corridor, start, end, radius);
+  CorridorSearchIds(tree, start, end, radius, result);
+
+  for (int i = 0; i < result->size; i++) {
+    const Position *position = tree->stars[result->ids[i]].position;
+    result->distances[i] = CorridorProgress(&corridor, position->x, position->y, position->z);
+  }
+  SortByDistance(result->ids, result->distances, result->size);
+  for (int i = 0; i < result->size; i++) {
+    const Position *position = tree->stars[result->ids[i]].position;
+    result->distances[i] = sqrt(CorridorDistanceSquared(&corridor, position->x, position->y, position->z));
+  }
+
+  return result->size;
+}
+
+// Stars within radius of the straight route from start to end, ordered along it
+StarArray* StarSearchCorridor(KDTree *tree, Star *start, Star *end, float radius) {
+  StarArray *result = CreateStarArray();
+  if (result == NULL) {
+    return NULL;
+  }
+
+  StarIdBuffer hits;
+  InitStarIdBuffer(&hits);
+  CorridorSearchSorted(tree, *start->position, *end->position, radius, &hits);
+  for (int i = 0; i < hits.size; i++) {
+    AddStarToArray(result, &tree->stars[hits.ids[i]]);
+  }
+  DeallocStarIdBuffer(&hits);
+
+  return result;
+}
+
+// AGGREGATE QUERIES
+// Count, centroid and nearest/farthest distance of the stars in a sphere or axis-aligned box,
+// without collecting them. A subtree whose bounding box lies wholly inside the region adds its
+// stored count and position sum in O(1); min/max distances then only descend into subtrees
+// whose boxes could still beat the current extremes.
+typedef struct AggregateSearch {
+  int is_box;
+  Position center;    // Sphere
+  double radius_sq;
+  double low[3];      // Box
+  double high[3];
+  Position reference; // Distances are measured from here
+  int with_distances;
+  int count;
+  double sum[3];
+  double min_sq;
+  double max_sq;
+  int nearest;
+  int farthest;
+} AggregateSearch;
+
+static double BoxMinDistanceSquared(const KDTreeBox *box, const Position point) {
+  const double values[3] = {point.x, point.y, point.z};
+  double distance = 0.0;
+  for (int axis = 0; axis < 3; axis++) {
+    double gap = (values[axis] < box->low[axis]) ? box->low[axis] - values[axis]
+               : (values[axis] > box->high[axis]) ? values[axis] - box->high[axis] : 0.0;
+    distance += gap * gap;
+  }
+  return distance;
+}
+
+// Squared distance to the farthest corner
+static double BoxMaxDistanceSquared(const KDTreeBox *box, const Position point) {
+  const double values[3] = {point.x, point.y, point.z};
+  double distance = 0.0;
+  for (int axis = 0; axis < 3; axis++) {
+    double low = fabs(values[axis] - box->low[axis]);
+    double high = fabs(values[axis] - box->high[axis]);
+    distance += (low > high) ? low * low : high * high;
+  }
+  return distance;
+}
+
+// -1 if the box misses the region, 1 if it lies wholly inside it, 0 if it straddles the edge
+static int ClassifyAggregateBox(const AggregateSearch *search, const KDTreeBox *box) {
+  if (!search->is_box) {
+    if (BoxMinDistanceSquared(box, search->center) > search->radius_sq) {
+      return -1;
+    }
+    return BoxMaxDistanceSquared(box, search->center) <= search->radius_sq;
+  }
+
+  int inside = 1;
+  for (int axis = 0; axis < 3; axis++) {
+    if (box->high[axis] < search->low[axis] || box->low[axis] > search->high[axis]) {
+      return -1;
+    }
+    inside = inside && box->low[axis] >= search->low[axis] && box->high[axis] <= search->high[axis];
+  }
+  return inside;
+}
+
+static int InAggregateRegion(const AggregateSearch *search, double x, double y, double z) {
+  if (search->is_box) {
+    return x >= search->low[0] && x <= search->high[0] && y >= search->low[1] && y <= search->high[1] &&
+           z >= search->low[2] && z <= search->high[2];
+  }
+  double dx = x - search->center.x;
+  double dy = y - search->center.y;
+  double dz = z - search->center.z;
+  return (dx * dx) + (dy * dy) + (dz * dz) <= search->radius_sq;
+}
+
+// 'inside' means an ancestor already lay wholly inside the region and has been counted
+static void AggregateVisit(const KDTree *tree, int node_index, AggregateSearch *search, int inside) {
+  const KDTreeNode *node = &tree->nodes[node_index];
+  if (node->count == 0) {
+    return;
+  }
+  const KDTreeBox *box = &tree->boxes[node_index];
+
+  if (!inside) {
+    int placement = ClassifyAggregateBox(search, box);
+    if (placement < 0) {
+      STATS_ADD(subtrees_pruned, 1);
+      return;
+    }
+    if (placement > 0) {
+      inside = 1;
+      search->count += node->count;
+      search->sum[0] += tree->sums[node_index].x;
+      search->sum[1] += tree->sums[node_index].y;
+      search->sum[2] += tree->sums[node_index].z;
+      if (!search->with_distances) {
+        return;
+      }
+    }
+  }
+  if (inside && BoxMinDistanceSquared(box, search->reference) >= search->min_sq &&
+      BoxMaxDistanceSquared(box, search->reference) <= search->max_sq) {
+    STATS_ADD(subtrees_pruned, 1);
+    return;
+  }
+  STATS_ADD(nodes_visited, 1);
+
+  if (node->axis >= 0) {
+    AggregateVisit(tree, 2 * node_index + 1, search, inside);
+    AggregateVisit(tree, 2 * node_index + 2, search, inside);
+    return;
+  }
+
+  STATS_ADD(distance_evals, node->count);
+  for (int i = node->begin; i < node->begin + node->count; i++) {
+    if (!inside) {
+      if (!InAggregateRegion(search, tree->x[i], tree->y[i], tree->z[i])) {
+        continue;
+      }
+      search->count++;
+      search->sum[0] += tree->x[i];
+      search->sum[1] += tree->y[i];
+      search->sum[2] += tree->z[i];
+    }
+    if (search->with_distances) {
+      double dx = tree->x[i] - search->reference.x;
+      double dy = tree->y[i] - search->reference.y;
+      double dz = tree->z[i] - search->reference.z;
+      double distance_sq = (dx * dx) + (dy * dy) + (dz * dz);
+      if (distance_sq < search->min_sq) {
+        search->min_sq = distance_sq;
+        search->nearest = tree->ids[i];
+      }
+      if (distance_sq > search->max_sq) {
+        search->max_sq = distance_sq;
+        search->farthest = tree->ids[i];
+      }
+    }
+  }
+}
+
+static int RunAggregate(const KDTree *tree, AggregateSearch *search, StarAggregate *out) {
+  search->min_sq = DBL_MAX;
+  search->max_sq = -1.0;
+  search->nearest = -1;
+  search->farthest = -1;
+
+  STATS_BEGIN();
+  if (tree != NULL && tree->size > 0) {
+    AggregateVisit(tree, 0, search, 0);
+  }
+  STATS_END(NULL);
+
+  if (out != NULL) {
+    memset(out, 0, sizeof(StarAggregate));
+    out->count = search->count;
+    if (search->count > 0) {
+      out->centroid.x = search->sum[0] / search->count;
+      out->centroid.y = search->sum[1] / search->count;
+      out->centroid.z = search->sum[2] / search->count;
+    }
+    out->nearest = search->nearest;
+    out->farthest = search->farthest;
+    if (search->nearest >= 0) {
+      out->min_distance = sqrt(search->min_sq);
+      out->max_distance = sqrt(search->max_sq);
+    }
+  }
+
+  return search->count;
+}
+
+// Summarizes the stars within radius of center; min/max distances (from center) are only
+// computed when with_distances is set. out may be NULL. Returns the count.
+int AggregateRadius(KDTree *tree, const Position center, double radius, int with_distances, StarAggregate *out) {
+  AggregateSearch search = {0};
+  search.center = center;
+  search.radius_sq = (radius > 0.0) ? radius * radius : 0.0;
+  search.reference = center;
+  search.with_distances = with_distances;
+  return RunAggregate(tree, &search, out);
+}
+
+// Summarizes the stars in the box [low, high] (inclusive); distances are from reference
+int AggregateBox(KDTree *tree, const Position low, const Position high, const Position reference, int with_distances,
+                 StarAggregate *out) {
+  AggregateSearch search = {0};
+  search.is_box = 1;
+  search.low[0] = low.x;
+  search.low[1] = low.y;
+  search.low[2] = low.z;
+  search.high[0] = high.x;
+  search.high[1] = high.y;
+  search.high[2] = high.z;
+  search.reference = reference;
+  search.with_distances = with_distances;
+  return RunAggregate(tree, &search, out);
+}
+
+int CountStarsInRadius(KDTree *tree, const Position center, double radius) {
+  return AggregateRadius(tree, center, radius, 0, NULL);
+}
+
+int CountStarsInBox(KDTree *tree, const Position low, const Position high) {
+  return AggregateBox(tree, low, high, low, 0, NULL);
+}
+
+// PAIR JOINS
+// Every pair of stars within a radius of each other, found by walking the KD-tree against
+// itself instead of running one radius search per star. A pair of nodes is dropped as soon as
+// their boxes are more than the radius apart, and leaves are compared star by star only when
+// their boxes come within range. The top of the walk is cut into node-pair tasks that the
+// threads claim through ParallelFor(). Node pairs entirely within the radius skip the distance
+// tests (and, when only counting, their stars). SelfJoinPairs() counts first, then every task
+// writes its pairs straight into its own slice of the output, so the result is the same on
+// any thread count.
+#define JOIN_TASKS_PER_THREAD 16
+
+typedef enum JoinMode {
+  JOIN_COUNT,
+  JOIN_FILL,
+  JOIN_VISIT,
+} JoinMode;
+
+typedef struct JoinTask {
+  int a;
+  int b;
+} JoinTask;
+
+typedef struct PairJoin {
+  const KDTree *tree;
+  double radius_sq;
+  JoinMode mode;
+  StarPairVisitor visitor;
+  void *user_data;
+  int stop;               // Set once the visitor returns 0; read atomically
+  JoinTask *tasks;
+  int task_count;
+  int task_capacity;
+  int task_depth;         // Node pairs this far down become tasks
+  long *task_pairs;       // Pairs found by each task, then (JOIN_FILL) where each one starts
+  StarPair *output;
+} PairJoin;
+
+typedef struct JoinCursor {
+  PairJoin *join;
+  long count;             // Pairs found so far; in JOIN_FILL the next output slot
+} JoinCursor;
+
+void InitStarPairBuffer(StarPairBuffer *buffer) {
+  buffer->pairs = NULL;
+  buffer->size = 0;
+  buffer->capacity = 0;
+}
+
+int ReserveStarPairBuffer(StarPairBuffer *buffer, long capacity) {
+  if (capacity <= buffer->capacity) {
+    return 1;
+  }
+
+  long new_capacity = buffer->capacity ? buffer->capacity : 1024;
+  while (new_capacity < capacity) {
+    new_capacity *= 2;
+  }
+
+  StarPair *pairs = realloc(buffer->pairs, new_capacity * sizeof(StarPair));
+  if (pairs == NULL) {
+    fprintf(stderr, "ERROR [ReserveStarPairBuffer()]: MEMORY ALLOCATION FAILED FOR PAIR BUFFER!\n");
+    return 0;
+  }
+  buffer->pairs = pairs;
+  buffer->capacity = new_capacity;
+
+  return 1;
+}
+
+void DeallocStarPairBuffer(StarPairBuffer *buffer) {
+  free(buffer->pairs);
+  InitStarPairBuffer(buffer);
+}
+
+static double BoxPairMinDistanceSquared(const KDTreeBox *a, const KDTreeBox *b) {
+  double sum = 0.0;
+  for (int axis = 0; axis < 3; axis++) {
+    double gap = a->low[axis] - b->high[axis];
+    double other = b->low[axis] - a->high[axis];
+    gap = (other > gap) ? other : gap;
+    if (gap > 0.0) {
+      sum += gap * gap;
+    }
+  }
+  return sum;
+}
+
+static double BoxPairMaxDistanceSquared(const KDTreeBox *a, const KDTreeBox *b) {
+  double sum = 0.0;
+  for (int axis = 0; axis < 3; axis++) {
+    double low = (a->low[axis] < b->low[axis]) ? a->low[axis] : b->low[axis];
+    double high = (a->high[axis] > b->high[axis]) ? a->high[axis] : b->high[axis];
+    sum += (high - low) * (high - low);
+  }
+  return sum;
+}
+
+// Reports one pair, smaller star id first; returns 0 to stop the join
+static int EmitStarPair(JoinCursor *cursor, int first, int second, double distance_sq) {
+  PairJoin *join = cursor->join;
+  if (first > second) {
+    int swap = first;
+    first = second;
+    second = swap;
+  }
+
+  if (join->mode == JOIN_FILL) {
+    StarPair *pair = &join->output[cursor->count];
+    pair->first = first;
+    pair->second = second;
+    pair->distance = (float)sqrt(distance_sq);
+  } else if (join->mode == JOIN_VISIT && !join->visitor(join->user_data, first, second, distance_sq)) {
+    __atomic_store_n(&join->stop, 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+  cursor->count++;
+  return 1;
+}
+
+// Star-by-star comparison of two leaves; a leaf joined with itself only pairs i with j > i
+static int JoinLeaves(JoinCursor *cursor, const KDTreeNode *a, const KDTreeNode *b) {
+  const KDTree *tree = cursor->join->tree;
+  double radius_sq = cursor->join->radius_sq;
+  int self = (a == b);
+  double distances[KD_MAX_LEAF_SIZE];
+
+  for (int i = 0; i < a->count; i++) {
+    int star = a->begin + i;
+    Position reference = {tree->x[star], tree->y[star], tree->z[star]};
+    int first = self ? i + 1 : 0;
+    int count = b->count - first;
+    if (count <= 0) {
+      break;
+    }
+    DistanceSquaredBatch(tree->x + b->begin + first, tree->y + b->begin + first, tree->z + b->begin + first,
+                         count, reference, distances);
+    for (int j = 0; j < count; j++) {
+      if (distances[j] <= radius_sq &&
+          !EmitStarPair(cursor, tree->ids[star], tree->ids[b->begin + first + j], distances[j])) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+// Reports every pair across two subtrees (or within one) without testing their distances
+static int EmitAllPairs(JoinCursor *cursor, const KDTreeNode *a, const KDTreeNode *b) {
+  const KDTree *tree = cursor->join->tree;
+  int self = (a == b);
+
+  for (int i = a->begin; i < a->begin + a->count; i++) {
+    for (int j = self ? i + 1 : b->begin; j < b->begin + b->count; j++) {
+      double dx = tree->x[i] - tree->x[j];
+      double dy = tree->y[i] - tree->y[j];
+      double dz = tree->z[i] - tree->z[j];
+      if (!EmitStarPair(cursor, tree->ids[i], tree->ids[j], dx * dx + dy * dy + dz * dz)) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+// Joins the stars under node a with those under node b (a == b: every pair within one
+// subtree). The two subtrees are always either the same or disjoint. Returns 0 to stop.
+static int JoinNodes(JoinCursor *cursor, int a, int b) {
+  PairJoin *join = cursor->join;
+  const KDTree *tree = join->tree;
+  const KDTreeNode *node_a = &tree->nodes[a];
+  const KDTreeNode *node_b = &tree->nodes[b];
+  if (node_a->count == 0 || node_b->count == 0) {
+    return 1;
+  }
+  if (join->mode == JOIN_VISIT && __atomic_load_n(&join->stop, __ATOMIC_RELAXED)) {
+    return 0;
+  }
+
+  if (a != b && BoxPairMinDistanceSquared(&tree->boxes[a], &tree->boxes[b]) > join->radius_sq) {
+    return 1;
+  }
+  // Every pair is in range. The fill pass takes the same shortcut as the count pass, so the
+  // two always agree on how many pairs each task produces.
+  if (BoxPairMaxDistanceSquared(&tree->boxes[a], &tree->boxes[b]) <= join->radius_sq) {
+    if (join->mode == JOIN_COUNT) {
+      long n = node_a->count;
+      cursor->count += (a == b) ? n * (n - 1) / 2 : n * node_b->count;
+      return 1;
+    }
+    return EmitAllPairs(cursor, node_a, node_b);
+  }
+
+  if (node_a->axis < 0 && node_b->axis < 0) {
+    return JoinLeaves(cursor, node_a, node_b);
+  }
+  if (a == b) {
+    return JoinNodes(cursor, 2 * a + 1, 2 * a + 1) && JoinNodes(cursor, 2 * a + 1, 2 * a + 2) &&
+           JoinNodes(cursor, 2 * a + 2, 2 * a + 2);
+  }
+  // Split the larger side
+  if (node_b->axis < 0 || (node_a->axis >= 0 && node_a->count >= node_b->count)) {
+    return JoinNodes(cursor, 2 * a + 1, b) && JoinNodes(cursor, 2 * a + 2, b);
+  }
+  return JoinNodes(cursor, a, 2 * b + 1) && JoinNodes(cursor, a, 2 * b + 2);
+}
+
+static int PushJoinTask(PairJoin *join, int a, int b) {
+  if (join->task_count == join->task_capacity) {
+    int capacity = join->task_capacity ? join->task_capacity * 2 : 256;
+    JoinTask *tasks = realloc(join->tasks, capacity * sizeof(JoinTask));
+    if (tasks == NULL) {
+      fprintf(stderr, "ERROR [PushJoinTask()]: MEMORY ALLOCATION FAILED FOR JOIN TASKS!\n");
+      return 0;
+    }
+    join->tasks = tasks;
+    join->task_capacity = capacity;
+  }
+  join->tasks[join->task_count].a = a;
+  join->tasks[join->task_count].b = b;
+  join->task_count++;
+  return 1;
+}
+
+// Walks both sides down a level at a time (the tree is perfect, so a and b stay at the same
+// depth) and turns the node pairs still in range at task_depth into tasks
+static int CollectJoinTasks(PairJoin *join, int a, int b, int depth) {
+  const KDTree *tree = join->tree;
+  if (tree->nodes[a].count == 0 || tree->nodes[b].count == 0) {
+    return 1;
+  }
+  if (a != b && BoxPairMinDistanceSquared(&tree->boxes[a], &tree->boxes[b]) > join->radius_sq) {
+    return 1;
+  }
+  if (depth == join->task_depth) {
+    return PushJoinTask(join, a, b);
+  }
+
+  int a_left = 2 * a + 1;
+  int a_right = 2 * a + 2;
+  if (a == b) {
+    return CollectJoinTasks(join, a_left, a_left, depth + 1) && CollectJoinTasks(join, a_left, a_right, depth + 1) &&
+           CollectJoinTasks(join, a_right, a_right, depth + 1);
+  }
+  int b_left = 2 * b + 1;
+  int b_right = 2 * b + 2;
+  return CollectJoinTasks(join, a_left, b_left, depth + 1) && CollectJoinTasks(join, a_left, b_right, depth + 1) &&
+         CollectJoinTasks(join, a_right, b_left, depth + 1) && CollectJoinTasks(join, a_right, b_right, depth + 1);
+}
+
+static void JoinTasksTask(void *user_data, int begin, int end) {
+  PairJoin *join = user_data;
+
+  for (int task = begin; task < end; task++) {
+    JoinCursor cursor = {join, (join->mode == JOIN_FILL) ? join->task_pairs[task] : 0};
+    JoinNodes(&cursor, join->tasks[task].a, join->tasks[task].b);
+    if (join->mode == JOIN_COUNT) {
+      join->task_pairs[task] = cursor.count;
+    }
+  }
+}
+
+// Sets up the join and its task list; returns 0 on allocation failure
+static int InitPairJoin(PairJoin *join, const KDTree *tree, double radius) {
+  memset(join, 0, sizeof(PairJoin));
+  join->tree = tree;
+  join->radius_sq = radius * radius;
+
+  int wanted = GetThreadCount() * JOIN_TASKS_PER_THREAD;
+  while (join->task_depth < tree->depth && (1 << join->task_depth) < wanted) {
+    join->task_depth++;
+  }
+
+  if (!CollectJoinTasks(join, 0, 0, 0)) {
+    free(join->tasks);
+    return 0;
+  }
+  join->task_pairs = calloc(join->task_count > 0 ? join->task_count : 1, sizeof(long));
+  if (join->task_pairs == NULL) {
+    fprintf(stderr, "ERROR [InitPairJoin()]: MEMORY ALLOCATION FAILED FOR JOIN TASKS!\n");
+    free(join->tasks);
+    return 0;
+  }
+  return 1;
+}
+
+static void FreePairJoin(PairJoin *join) {
+  free(join->tasks);
+  free(join->task_pairs);
+}
+
+// Number of star pairs no more than radius apart
+long CountPairsWithin(KDTree *tree, double radius) {
+  PairJoin join;
+  if (tree == NULL || tree->size == 0 || !(radius >= 0.0) || !InitPairJoin(&join, tree, radius)) {
+    return 0;
+  }
+
+  join.mode = JOIN_COUNT;
+  ParallelFor(join.task_count, 1, JoinTasksTask, &join);
+
+  long total = 0;
+  for (int task = 0; task < join.task_count; task++) {
+    total += join.task_pairs[task];
+  }
+  FreePairJoin(&join);
+  return total;
+}
+
+// Calls visitor(user_data, first, second, squared distance) for every pair of stars no more
+// than radius apart, first < second, in no particular order. The visitor runs on several
+// threads at once; once it returns 0 the join stops as soon as every thread notices.
+void SelfJoinVisit(KDTree *tree, double radius, StarPairVisitor visitor, void *user_data) {
+  PairJoin join;
+  if (tree == NULL || tree->size == 0 || !(radius >= 0.0) || !InitPairJoin(&join, tree, radius)) {
+    return;
+  }
+
+  join.mode = JOIN_VISIT;
+  join.visitor = visitor;
+  join.user_data = user_data;
+  ParallelFor(join.task_count, 1, JoinTasksTask, &join);
+  FreePairJoin(&join);
+}
+
+// Replaces the contents of result with every pair of stars no more than radius apart (first <
+// second, distances in light years). The order is fixed for a given tree and radius, whatever
+// the thread count. Returns the number of pairs, or 0 with an empty result if it does not fit.
+long SelfJoinPairs(KDTree *tree, double radius, StarPairBuffer *result) {
+  result->size = 0;
+  PairJoin join;
+  if (tree == NULL || tree->size == 0 || !(radius >= 0.0) || !InitPairJoin(&join, tree, radius)) {
+    return 0;
+  }
+
+  join.mode = JOIN_COUNT;
+  ParallelFor(join.task_count, 1, JoinTasksTask, &join);
+
+  // Pair counts -> where each task's pairs start
+  long total = 0;
+  for (int task = 0; task < join.task_count; task++) {
+    long count = join.task_pairs[task];
+    join.task_pairs[task] = total;
+    total += count;
+  }
+
+  if (ReserveStarPairBuffer(result, total)) {
+    join.mode = JOIN_FILL;
+    join.output = result->pairs;
+    ParallelFor(join.task_count, 1, JoinTasksTask, &join);
+    result->size = total;
+  }
+
+  FreePairJoin(&join);
+  return result->size;
+}
+
+// Prints leaf buckets left to right
+void PrintKDTree(KDTree *tree) {
+  int first_leaf = tree->node_count / 2;
+
+  for (int leaf = first_leaf; leaf < tree->node_count; leaf++) {
+    const KDTreeNode *node = &tree->nodes[leaf];
+    for (int i = node->begin; i < node->begin + node->count; i++) {
+      Star *star = &tree->stars[tree->ids[i]];
+      printf("%s: (%.2f, %.2f, %.2f), %.2f\n", star->name, tree->x[i], tree->y[i], tree->z[i], star->lightyears);
+    }
+  }
+}
+
+// The whole tree (header, nodes, ids, coordinates) is one allocation
+void DeallocKDTree(KDTree *tree) {
+  free(tree);
+}
+
+// DYNAMIC STAR INDEX
+// A logarithmic set of the static trees above. Every level is an ordinary KDTree built by
+// CreateKDTreeFromIds(), so queries run the same code on each non-empty level (at most
+// STAR_INDEX_LEVELS of them) and carry the best bound from one level into the next. A star
+// moves up a level at most O(log n) times over its life, so inserts cost amortized
+// O(log^2 n); deletes are O(1) plus a rebuild amortized over the deletes that triggered it.
+static long StarIndexLevelCapacity(int level) {
+  return (long)STAR_INDEX_BASE << level;
+}
+
+static int ReserveStarIndexIds(StarIndex *index, int capacity) {
+  if (capacity <= index->id_capacity) {
+    return 1;
+  }
+
+  int new_capacity = (index->id_capacity > 0) ? index->id_capacity : 64;
+  while (new_capacity < capacity) {
+    new_capacity = (new_capacity > INT_MAX / 2) ? capacity : new_capacity * 2;
+  }
+
+  signed char *level_of = realloc(index->level_of, new_capacity * sizeof(signed char));
+  if (level_of == NULL) {
+    fprintf(stderr, "ERROR [ReserveStarIndexIds()]: MEMORY ALLOCATION FAILED FOR STAR LEVELS!\n");
+    return 0;
+  }
+  index->level_of = level_of;
+
+  int *slot_of = realloc(index->slot_of, new_capacity * sizeof(int));
+  if (slot_of == NULL) {
+    fprintf(stderr, "ERROR [ReserveStarIndexIds()]: MEMORY ALLOCATION FAILED FOR STAR SLOTS!\n");
+    return 0;
+  }
+  index->slot_of = slot_of;
+
+  int *shadows = realloc(index->shadows, new_capacity * sizeof(int));
+  if (shadows == NULL) {
+    fprintf(stderr, "ERROR [ReserveStarIndexIds()]: MEMORY ALLOCATION FAILED FOR NAME CHAINS!\n");
+    return 0;
+  }
+  index->shadows = shadows;
+
+  memset(index->level_of + index->id_capacity, -1, new_capacity - index->id_capacity);
+  index->id_capacity = new_capacity;
+
+  return 1;
+}
+
+static int ReserveStarIndexScratch(StarIndex *index, int capacity) {
+  if (capacity <= index->scratch_capacity) {
+    return 1;
+  }
+
+  int new_capacity = (index->scratch_capacity > 0) ? index->scratch_capacity : STAR_INDEX_BASE;
+  while (new_capacity < capacity) {
+    new_capacity = (new_capacity > INT_MAX / 2) ? capacity : new_capacity * 2;
+  }
+
+  int *scratch = realloc(index->scratch, new_capacity * sizeof(int));
+  if (scratch == NULL) {
+    fprintf(stderr, "ERROR [ReserveStarIndexScratch()]: MEMORY ALLOCATION FAILED FOR MERGE BUFFER!\n");
+    return 0;
+  }
+  index->scratch = scratch;
+  index->scratch_capacity = new_capacity;
+
+  return 1;
+}
+
+// Appends the ids of the live stars in 'level' to out; returns how many were written
+static int CollectLiveIds(const StarIndex *index, int level, int *out) {
+  const KDTree *tree = index->levels[level];
+  int count = 0;
+
+  for (int i = 0; i < tree->size; i++) {
+    int id = tree->ids[i];
+    if (index->level_of[id] == level) {
+      out[count++] = id;
+    }
+  }
+
+  return count;
+}
+
+// Installs tree as 'level' (replacing nothing) and points every star in it at its new slot
+static void InstallStarIndexLevel(StarIndex *index, int level, KDTree *tree) {
+  index->levels[level] = tree;
+  index->dead[level] = 0;
+  if (tree == NULL) {
+    return;
+  }
+
+  for (int i = 0; i < tree->size; i++) {
+    index->level_of[tree->ids[i]] = (signed char)level;
+    index->slot_of[tree->ids[i]] = i;
+  }
+}
+
+// Records, for every star, the older star with the same name that it hides in the name index
+// (the map keeps only the latest), so a delete can hand the name back to the next live one
+static int LinkShadowedNames(StarIndex *index) {
+  StarArray *array = index->array;
+  HashMap seen = {0};
+  seen.stars = array->stars;
+  seen.size = HashMapCapacityFor(array->size);
+  seen.slots = calloc(seen.size, sizeof(HashEntry));
+  if (seen.slots == NULL) {
+    fprintf(stderr, "ERROR [LinkShadowedNames()]: MEMORY ALLOCATION FAILED FOR NAME TABLE!\n");
+    return 0;
+  }
+
+  for (int i = 0; i < array->size; i++) {
+    index->shadows[i] = InsertHashedId(&seen, SlotHash(array->stars[i].name), i);
+  }
+
+  free(seen.slots);
+  return 1;
+}
+
+// array and names are borrowed: the index appends to and removes from them, but the caller
+// still owns (and frees) both after DeallocStarIndex(). Arrays mapped from a snapshot are
+// read-only and cannot be indexed this way.
+StarIndex *CreateStarIndex(StarArray *array, HashMap *names, int leaf_size) {
+  StarIndex *index = calloc(1, sizeof(StarIndex));
+  if (index == NULL) {
+    fprintf(stderr, "ERROR [CreateStarIndex()]: MEMORY ALLOCATION FAILED FOR STAR INDEX!\n");
+    return NULL;
+  }
+  index->array = array;
+  index->names = names;
+  index->leaf_size = leaf_size;
+
+  if (!ReserveStarIndexIds(index, array->size) || !ReserveStarIndexScratch(index, array->size) ||
+      (names != NULL && !LinkShadowedNames(index))) {
+    DeallocStarIndex(index);
+    return NULL;
+  }
+
+  if (array->size > 0) {
+    int level = 0;
+    while (StarIndexLevelCapacity(level) < array->size) {
+      level++;
+    }
+
+    KDTree *tree = CreateKDTreeFromIds(array, NULL, array->size, leaf_size);
+    if (tree == NULL) {
+      DeallocStarIndex(index);
+      return NULL;
+    }
+    InstallStarIndexLevel(index, level, tree);
+  }
+  index->live_count = array->size;
+
+  return index;
+}
+
+// Trees and the name index hold the Star array pointer, which moves when the array grows
+static void RefreshStarPointers(StarIndex *index) {
+  for (int level = 0; level < STAR_INDEX_LEVELS; level++) {
+    if (index->levels[level] != NULL) {
+      index->levels[level]->stars = index->array->stars;
+    }
+  }
+  if (index->names != NULL) {
+    index->names->stars = index->array->stars;
+  }
+}
+
+// Adds a star (name is copied) and returns its id, or -1 on failure
+int StarIndexInsert(StarIndex *index, const char *name, const Position position, float lightyears) {
+  StarArray *array = index->array;
+  int id = array->size;
+
+  if (!ReserveStarIndexIds(index, id + 1) || !ReserveStarIndexScratch(index, index->live_count + 1)) {
+    return -1;
+  }
+
+  Star star = {0};
+  star.name = malloc(strlen(name) + 1);
+  star.position = malloc(sizeof(Position));
+  if (star.name == NULL || star.position == NULL) {
+    fprintf(stderr, "ERROR [StarIndexInsert()]: MEMORY ALLOCATION FAILED FOR STAR!\n");
+    free(star.name);
+    free(star.position);
+    return -1;
+  }
+  strcpy(star.name, name);
+  *star.position = position;
+  star.lightyears = lightyears;
+
+  AddStarToArray(array, &star);
+  if (array->size != id + 1) {
+    free(star.name);
+    free(star.position);
+    return -1;
+  }
+  RefreshStarPointers(index);
+
+  // Carry the new star up through the levels until one has room for everything gathered
+  int count = 0;
+  index->scratch[count++] = id;
+  int level = 0;
+  while (level < STAR_INDEX_LEVELS - 1) {
+    if (index->levels[level] != NULL) {
+      count += CollectLiveIds(index, level, index->scratch + count);
+    }
+    if (count <= StarIndexLevelCapacity(level)) {
+      break;
+    }
+    level++;
+  }
+
+  KDTree *tree = CreateKDTreeFromIds(array, index->scratch, count, index->leaf_size);
+  if (tree == NULL) {
+    // The star stays in the array, but unindexed, like a deleted one
+    return -1;
+  }
+
+  for (int merged = 0; merged <= level; merged++) {
+    DeallocKDTree(index->levels[merged]);
+    index->levels[merged] = NULL;
+    index->dead[merged] = 0;
+  }
+  InstallStarIndexLevel(index, level, tree);
+  tree->stars = array->stars;
+
+  index->shadows[id] = -1;
+  if (index->names != NULL) {
+    Star *older = GetFromHashMap(index->names, name);
+    if (older != NULL) {
+      index->shadows[id] = (int)(older - array->stars);
+    }
+    AddToHashMap(index->names, &array->stars[id]);
+  }
+  index->live_count++;
+
+  return id;
+}
+
+// Removes star id from the index and the name index. Its record stays in the array so other
+// ids are unaffected. Returns 1 if the star was live.
+int StarIndexDelete(StarIndex *index, int id) {
+  if (id < 0 || id >= index->array->size || id >= index->id_capacity || index->level_of[id] < 0) {
+    return 0;
+  }
+
+  int level = index->level_of[id];
+  KDTree *tree = index->levels[level];
+  int slot = index->slot_of[id];
+
+  tree->x[slot] = STAR_INDEX_TOMBSTONE;
+  tree->y[slot] = STAR_INDEX_TOMBSTONE;
+  tree->z[slot] = STAR_INDEX_TOMBSTONE;
+  index->level_of[id] = -1;
+  index->dead[level]++;
+  index->live_count--;
+
+  if (index->names != NULL && RemoveFromHashMap(index->names, &index->array->stars[id])) {
+    // The name now belongs to the most recent older star that still carries it, if any
+    int older = index->shadows[id];
+    while (older >= 0 && index->level_of[older] < 0) {
+      older = index->shadows[older];
+    }
+    if (older >= 0) {
+      AddToHashMap(index->names, &index->array->stars[older]);
+    }
+  }
+
+  // Once half a level is tombstones, rebuild it from the survivors
+  if (index->dead[level] * 2 > tree->size) {
+    int count = CollectLiveIds(index, level, index->scratch);
+    KDTree *rebuilt = NULL;
+    if (count > 0) {
+      rebuilt = CreateKDTreeFromIds(index->array, index->scratch, count, index->leaf_size);
+      if (rebuilt == NULL) {
+        return 1; // Still correct, just slower until the next rebuild
+      }
+    }
+    DeallocKDTree(tree);
+    InstallStarIndexLevel(index, level, rebuilt);
+  }
+
+  return 1;
+}
+
+// Returns the id of the closest live star (-1 if there are none) and, if distance is not
+// NULL, its distance in light years
+int StarIndexNearest(StarIndex *index, const Position reference, double *distance) {
+  double best_sq = STAR_INDEX_TOMBSTONE; // Squared, so any real star beats it
+  int best = -1;
+
+  for (int level = 0; level < STAR_INDEX_LEVELS; level++) {
+    KDTree *tree = index->levels[level];
+    if (tree != NULL) {
+      best = NearestNeighborSearch(tree, 0, reference, best, &best_sq);
+    }
+  }
+
+  if (distance != NULL) {
+    *distance = (best >= 0) ? sqrt(best_sq) : 0.0;
+  }
+  return best;
+}
+
+// Same contract as KNearestNeighborIds(): up to k live stars, nearest first
+int StarIndexKNearest(StarIndex *index, const Position reference, int k, int *ids, double *distances) {
+  if (k <= 0) {
+    return 0;
+  }
+
+  double stack_distances[64];
+  double *heap_distances = distances;
+  if (heap_distances == NULL) {
+    heap_distances = (k <= 64) ? stack_distances : malloc(k * sizeof(double));
+    if (heap_distances == NULL) {
+      fprintf(stderr, "ERROR [StarIndexKNearest()]: MEMORY ALLOCATION FAILED FOR DISTANCES!\n");
+      return 0;
+    }
+  }
+
+  KNNHeap heap = {heap_distances, ids, 0, k};
+  for (int level = 0; level < STAR_INDEX_LEVELS; level++) {
+    if (index->levels[level] != NULL) {
+      KNearestSearch(index->levels[level], 0, reference, &heap);
+    }
+  }
+
+  // Tombstones only survive in the heap when fewer than k live stars exist; they sort last
+  int found = SortKNNHeap(&heap);
+  while (found > 0 && heap_distances[found - 1] >= STAR_INDEX_TOMBSTONE) {
+    found--;
+  }
+
+  if (distances != NULL) {
+    for (int i = 0; i < found; i++) {
+      distances[i] = sqrt(distances[i]);
+    }
+  } else if (heap_distances != stack_distances) {
+    free(heap_distances);
+  }
+
+  return found;
+}
+
+// RadiusSearchVisit() across every level; tombstones are never within reach
+void StarIndexRadiusVisit(StarIndex *index, const Position center, double radius, StarVisitor visitor, void *user_data) {
+  for (int level = 0; level < STAR_INDEX_LEVELS; level++) {
+    KDTree *tree = index->levels[level];
+    if (tree != NULL && tree->size > 0 && !RadiusVisit(tree, 0, center, radius, visitor, user_data)) {
+      return;
+    }
+  }
+}
+
+// Same contract as RadiusSearchIds()
+int StarIndexRadiusIds(StarIndex *index, const Position center, double radius, StarIdBuffer *result) {
+  result->size = 0;
+  StarIndexRadiusVisit(index, center, radius, AppendStarId, result);
+  return result->size;
+}
+
+// Frees the levels and bookkeeping; the StarArray and HashMap belong to the caller
+void DeallocStarIndex(StarIndex *index) {
+  if (index == NULL) {
+    return;
+  }
+
+  for (int level = 0; level < STAR_INDEX_LEVELS; level++) {
+    DeallocKDTree(index->levels[level]);
+  }
+  free(index->level_of);
+  free(index->slot_of);
+  free(index->shadows);
+  free(index->scratch);
+  free(index);
+}
+
+// UNIFORM GRID INDEX
+// Space is cut into cubes of cell_size; stars are sorted by cell key so every non-empty cell
+// is one contiguous slice of ids/x/y/z, and an open-addressing table maps a cell key to its
+// slice. With cell_size equal to the query radius a radius query reads at most 27 cells
+// (fewer once cells beyond the radius are skipped), with no tree descent at all.
+#define GRID_AXIS_BITS 21
+#define GRID_EMPTY_KEY (~0UL)
+
+static inline unsigned long GridKey(long ix, long iy, long iz) {
+  return ((unsigned long)ix << (2 * GRID_AXIS_BITS)) | ((unsigned long)iy << GRID_AXIS_BITS) | (unsigned long)iz;
+}
+
+static inline unsigned long GridSlot(unsigned long key) {
+  key ^= key >> 31;
+  key *= 0x7fb5d329728ea185UL;
+  key ^= key >> 27;
+  return key;
+}
+
+// Cell index along one axis, clamped to the grid
+static inline long GridAxisCell(const StarGrid *grid, int axis, double value) {
+  double cell = floor((value - grid->origin[axis]) * grid->inverse_cell_size);
+  return (cell < 0.0) ? 0 : (cell >= grid->dims[axis]) ? grid->dims[axis] - 1 : (long)cell;
+}
+
+static const GridCell *GridLookup(const StarGrid *grid, unsigned long key) {
+  unsigned long index = GridSlot(key) & grid->table_mask;
+  while (grid->table[index].key != GRID_EMPTY_KEY) {
+    if (grid->table[index].key == key) {
+      return &grid->table[index];
+    }
+    index = (index + 1) & grid->table_mask;
+  }
+  return NULL;
+}
+
+// Squared distance from value to the slab [low, low + cell_size) along one axis
+static inline double GridAxisGap(const StarGrid *grid, int axis, long cell, double value) {
+  double low = grid->origin[axis] + cell * grid->cell_size;
+  double high = low + grid->cell_size;
+  double gap = (value < low) ? low - value : (value > high) ? value - high : 0.0;
+  return gap * gap;
+}
+
+typedef struct GridBuild {
+  const StarGrid *grid;
+  const Star *stars;
+  unsigned long *keys;
+} GridBuild;
+
+static void GridKeysTask(void *user_data, int begin, int end) {
+  GridBuild *build = user_data;
+  const StarGrid *grid = build->grid;
+
+  for (int i = begin; i < end; i++) {
+    const Position *position = build->stars[i].position;
+    build->keys[i] = GridKey(GridAxisCell(grid, 0, position->x), GridAxisCell(grid, 1, position->y),
+                             GridAxisCell(grid, 2, position->z));
+  }
+}
+
+// LSD radix sort of (key, id) pairs on the low 'bits' bits of the key, 11 bits per pass
+static int RadixSortKeys(unsigned long *keys, int *ids, int count, int bits) {
+  unsigned long *key_buffer = malloc((count > 0 ? count : 1) * sizeof(unsigned long));
+  int *id_buffer = malloc((count > 0 ? count : 1) * sizeof(int));
+  if (key_buffer == NULL || id_buffer == NULL) {
+    free(key_buffer);
+    free(id_buffer);
+    return 0;
+  }
+
+  unsigned long *from_keys = keys, *to_keys = key_buffer;
+  int *from_ids = ids, *to_ids = id_buffer;
+  for (int shift = 0; shift < bits; shift += 11) {
+    int counts[2048] = {0};
+    for (int i = 0; i < count; i++) {
+      counts[(from_keys[i] >> shift) & 2047]++;
+    }
+    int total = 0;
+    for (int digit = 0; digit < 2048; digit++) {
+      int digit_count = counts[digit];
+      counts[digit] = total;
+      total += digit_count;
+    }
+    for (int i = 0; i < count; i++) {
+      int slot = counts[(from_keys[i] >> shift) & 2047]++;
+      to_keys[slot] = from_keys[i];
+      to_ids[slot] = from_ids[i];
+    }
+
+    unsigned long *swap_keys = from_keys;
+    from_keys = to_keys;
+    to_keys = swap_keys;
+    int *swap_ids = from_ids;
+    from_ids = to_ids;
+    to_ids = swap_ids;
+  }
+
+  if (from_keys != keys) {
+    memcpy(keys, from_keys, count * sizeof(unsigned long));
+    memcpy(ids, from_ids, count * sizeof(int));
+  }
+
+  free(key_buffer);
+  free(id_buffer);
+  return 1;
+}
+
+// Grid over every star in array. cell_size should match the radius most queries use; it is
+// raised if needed so no axis has more than 2^21 cells.
+StarGrid *CreateStarGrid(StarArray *array, double cell_size) {
+  int size = array->size;
+  if (!(cell_size > 0.0)) {
+    fprintf(stderr, "ERROR [CreateStarGrid()]: CELL SIZE MUST BE POSITIVE!\n");
+    return NULL;
+  }
+
+  StarGrid *grid = calloc(1, sizeof(StarGrid));
+  if (grid == NULL) {
+    fprintf(stderr, "ERROR [CreateStarGrid()]: MEMORY ALLOCATION FAILED FOR GRID!\n");
+    return NULL;
+  }
+  grid->size = size;
+  grid->stars = array->stars;
+
+  double low[3] = {0.0, 0.0, 0.0};
+  double high[3] = {0.0, 0.0, 0.0};
+  for (int i = 0; i < size; i++) {
+    const Position *position = array->stars[i].position;
+    double values[3] = {position->x, position->y, position->z};
+    for (int axis = 0; axis < 3; axis++) {
+      if (i == 0 || values[axis] < low[axis]) {
+        low[axis] = values[axis];
+      }
+      if (i == 0 || values[axis] > high[axis]) {
+        high[axis] = values[axis];
+      }
+    }
+  }
+  for (int axis = 0; axis < 3; axis++) {
+    double cells = (high[axis] - low[axis]) / cell_size + 1.0;
+    if (cells > (double)(1L << GRID_AXIS_BITS) - 1.0) {
+      cell_size = (high[axis] - low[axis]) / ((double)(1L << GRID_AXIS_BITS) - 2.0);
+    }
+  }
+
+  grid->cell_size = cell_size;
+  grid->inverse_cell_size = 1.0 / cell_size;
+  for (int axis = 0; axis < 3; axis++) {
+    grid->origin[axis] = low[axis];
+    grid->dims[axis] = (int)((high[axis] - low[axis]) * grid->inverse_cell_size) + 1;
+  }
+  // The sort only needs the key bits up to the highest x cell
+  int key_bits = 2 * GRID_AXIS_BITS;
+  while ((1L << (key_bits - 2 * GRID_AXIS_BITS)) < grid->dims[0]) {
+    key_bits++;
+  }
+
+  size_t padded = (size + 7) & ~7;
+  grid->ids = malloc((size > 0 ? size : 1) * sizeof(int));
+  grid->x = aligned_alloc(64, (padded > 0 ? padded : 8) * sizeof(double));
+  grid->y = aligned_alloc(64, (padded > 0 ? padded : 8) * sizeof(double));
+  grid->z = aligned_alloc(64, (padded > 0 ? padded : 8) * sizeof(double));
+  unsigned long *keys = malloc((size > 0 ? size : 1) * sizeof(unsigned long));
+  if (grid->ids == NULL || grid->x == NULL || grid->y == NULL || grid->z == NULL || keys == NULL) {
+    fprintf(stderr, "ERROR [CreateStarGrid()]: MEMORY ALLOCATION FAILED FOR GRID STORAGE!\n");
+    free(keys);
+    DeallocStarGrid(grid);
+    return NULL;
+  }
+
+  for (int i = 0; i < size; i++) {
+    grid->ids[i] = i;
+  }
+  GridBuild build = {grid, array->stars, keys};
+  ParallelFor(size, 16384, GridKeysTask, &build);
+  if (!RadixSortKeys(keys, grid->ids, size, key_bits)) {
+    fprintf(stderr, "ERROR [CreateStarGrid()]: MEMORY ALLOCATION FAILED WHILE SORTING CELLS!\n");
+    free(keys);
+    DeallocStarGrid(grid);
+    return NULL;
+  }
+
+  int cell_count = 0;
+  for (int i = 0; i < size; i++) {
+    const Position *position = array->stars[grid->ids[i]].position;
+    grid->x[i] = position->x;
+    grid->y[i] = position->y;
+    grid->z[i] = position->z;
+    cell_count += (i == 0 || keys[i] != keys[i - 1]);
+  }
+
+  // Table at most half full
+  unsigned long table_size = 16;
+  while (table_size < 2UL * cell_count) {
+    table_size *= 2;
+  }
+  grid->table = malloc(table_size * sizeof(GridCell));
+  if (grid->table == NULL) {
+    fprintf(stderr, "ERROR [CreateStarGrid()]: MEMORY ALLOCATION FAILED FOR CELL TABLE!\n");
+    free(keys);
+    DeallocStarGrid(grid);
+    return NULL;
+  }
+  for (unsigned long i = 0; i < table_size; i++) {
+    grid->table[i].key = GRID_EMPTY_KEY;
+  }
+  grid->table_mask = table_size - 1;
+  grid->cell_count = cell_count;
+
+  for (int begin = 0; begin < size;) {
+    int end = begin + 1;
+    while (end < size && keys[end] == keys[begin]) {
+      end++;
+    }
+    unsigned long index = GridSlot(keys[begin]) & grid->table_mask;
+    while (grid->table[index].key != GRID_EMPTY_KEY) {
+      index = (index + 1) & grid->table_mask;
+    }
+    grid->table[index].key = keys[begin];
+    grid->table[index].begin = begin;
+    grid->table[index].count = end - begin;
+    begin = end;
+  }
+
+  free(keys);
+  return grid;
+}
+
+// Returns 0 once the visitor has asked to stop
+static int GridVisitCell(const StarGrid *grid, const GridCell *cell, const Position center, double radius_sq,
+                         StarVisitor visitor, void *user_data) {
+  double distances[256];
+  STATS_ADD(nodes_visited, 1);
+  STATS_ADD(distance_evals, cell->count);
+
+  for (int chunk = 0; chunk < cell->count; chunk += 256) {
+    int begin = cell->begin + chunk;
+    int count = (cell->count - chunk < 256) ? cell->count - chunk : 256;
+    DistanceSquaredBatch(grid->x + begin, grid->y + begin, grid->z + begin, count, center, distances);
+    for (int i = 0; i < count; i++) {
+      if (distances[i] <= radius_sq && !visitor(user_data, grid->ids[begin + i], distances[i])) {
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+// Same contract as RadiusSearchVisit()
+void GridRadiusVisit(StarGrid *grid, const Position center, double radius, StarVisitor visitor, void *user_data) {
+  if (grid == NULL || grid->size == 0 || radius < 0.0) {
+    return;
+  }
+  STATS_BEGIN();
+
+  const double point[3] = {center.x, center.y, center.z};
+  long low[3], high[3];
+  for (int axis = 0; axis < 3; axis++) {
+    low[axis] = GridAxisCell(grid, axis, point[axis] - radius);
+    high[axis] = GridAxisCell(grid, axis, point[axis] + radius);
+  }
+
+  double radius_sq = radius * radius;
+  for (long ix = low[0]; ix <= high[0]; ix++) {
+    double gap_x = GridAxisGap(grid, 0, ix, center.x);
+    if (gap_x > radius_sq) {
+      continue;
+    }
+    for (long iy = low[1]; iy <= high[1]; iy++) {
+      double gap_xy = gap_x + GridAxisGap(grid, 1, iy, center.y);
+      if (gap_xy > radius_sq) {
+        continue;
+      }
+      for (long iz = low[2]; iz <= high[2]; iz++) {
+        if (gap_xy + GridAxisGap(grid, 2, iz, center.z) > radius_sq) {
+          STATS_ADD(subtrees_pruned, 1);
+          continue;
+        }
+        const GridCell *cell = GridLookup(grid, GridKey(ix, iy, iz));
+        if (cell != NULL && !GridVisitCell(grid, cell, center, radius_sq, visitor, user_data)) {
+          STATS_END(NULL);
+          return;
+        }
+      }
+    }
+  }
+
+  STATS_END(NULL);
+}
+
+int GridRadiusSearchIds(StarGrid *grid, const Position center, double radius, StarIdBuffer *result) {
+  result->size = 0;
+  GridRadiusVisit(grid, center, radius, AppendStarId, result);
+  return result->size;
+}
+
+typedef struct GridRange {
+  StarArray *result;
+  Star *stars;
+} GridRange;
+
+static int AppendGridStar(void *user_data, int id, double distance_sq) {
+  (void)distance_sq;
+  GridRange *range = user_data;
+  AddStarToArray(range->result, &range->stars[id]);
+  return 1;
+}
+
+// Same contract as StarSearchRange()
+StarArray* GridSearchRange(StarGrid *grid, Star *center, float radius) {
+  StarArray *result = CreateStarArray();
+  if (result == NULL) {
+    return NULL;
+  }
+
+  GridRange range = {result, grid->stars};
+  GridRadiusVisit(grid, *center->position, radius, AppendGridStar, &range);
+  return result;
+}
+
+// Checks one cell against the current best (squared distance); returns the new best id
+static int GridNearestInCell(const StarGrid *grid, const GridCell *cell, const Position reference, int best, double *best_sq) {
+  STATS_ADD(nodes_visited, 1);
+  STATS_ADD(distance_evals, cell->count);
+  int found = NearestInBatch(grid->x + cell->begin, grid->y + cell->begin, grid->z + cell->begin, cell->count,
+                             reference, best_sq);
+  return (found >= 0) ? grid->ids[cell->begin + found] : best;
+}
+
+// Scans cubic shells of cells around the reference's cell, nearest first, until the next
+// shell cannot beat the best star found. Past a few shells' worth of empty lookups (a query
+// far from everything, or a very sparse grid) it falls back to a pass over the occupied cells.
+Star* GridNearestNeighbor(StarGrid *grid, const Position reference) {
+  if (grid == NULL || grid->size == 0) {
+    return NULL;
+  }
+  STATS_BEGIN();
+
+  const double point[3] = {reference.x, reference.y, reference.z};
+  long home[3];
+  long max_ring = 0;
+  for (int axis = 0; axis < 3; axis++) {
+    home[axis] = GridAxisCell(grid, axis, point[axis]);
+    long reach = (home[axis] > grid->dims[axis] - 1 - home[axis]) ? home[axis] : grid->dims[axis] - 1 - home[axis];
+    max_ring = (reach > max_ring) ? reach : max_ring;
+  }
+
+  int best = -1;
+  double best_sq = DBL_MAX;
+  long lookups = 0;
+  long lookup_budget = 4L * grid->cell_count + 64;
+
+  for (long ring = 0; ring <= max_ring; ring++) {
+    // Every cell in this ring or beyond is at least (ring - 1) whole cells away
+    double bound = (ring > 0) ? (ring - 1) * grid->cell_size : 0.0;
+    if (best >= 0 && bound * bound >= best_sq) {
+      break;
+    }
+    if (lookups > lookup_budget) {
+      for (unsigned long slot = 0; slot <= grid->table_mask; slot++) {
+        const GridCell *cell = &grid->table[slot];
+        if (cell->key == GRID_EMPTY_KEY) {
+          continue;
+        }
+        long ix = (long)(cell->key >> (2 * GRID_AXIS_BITS));
+        long iy = (long)((cell->key >> GRID_AXIS_BITS) & ((1L << GRID_AXIS_BITS) - 1));
+        long iz = (long)(cell->key & ((1L << GRID_AXIS_BITS) - 1));
+        double gap = GridAxisGap(grid, 0, ix, reference.x) + GridAxisGap(grid, 1, iy, reference.y) +
+                     GridAxisGap(grid, 2, iz, reference.z);
+        if (gap < best_sq) {
+          best = GridNearestInCell(grid, cell, reference, best, &best_sq);
+        }
+      }
+      break;
+    }
+
+    long x_low = (home[0] - ring > 0) ? home[0] - ring : 0;
+    long x_high = (home[0] + ring < grid->dims[0]) ? home[0] + ring : grid->dims[0] - 1;
+    long y_low = (home[1] - ring > 0) ? home[1] - ring : 0;
+    long y_high = (home[1] + ring < grid->dims[1]) ? home[1] + ring : grid->dims[1] - 1;
+    long z_low = (home[2] - ring > 0) ? home[2] - ring : 0;
+    long z_high = (home[2] + ring < grid->dims[2]) ? home[2] + ring : grid->dims[2] - 1;
+    for (long ix = x_low; ix <= x_high; ix++) {
+      int x_edge = (ix == home[0] - ring || ix == home[0] + ring);
+      double gap_x = GridAxisGap(grid, 0, ix, reference.x);
+      for (long iy = y_low; iy <= y_high; iy++) {
+        double gap_xy = gap_x + GridAxisGap(grid, 1, iy, reference.y);
+        if (gap_xy >= best_sq) {
+          continue;
+        }
+        // Rows through the inside of the shell only touch it at their two ends
+        int xy_edge = x_edge || iy == home[1] - ring || iy == home[1] + ring;
+        long step = (xy_edge || ring == 0) ? 1 : 2 * ring;
+        for (long iz = xy_edge ? z_low : home[2] - ring; iz <= z_high; iz += step) {
+          if (iz < 0) {
+            continue;
+          }
+          if (gap_xy + GridAxisGap(grid, 2, iz, reference.z) >= best_sq) {
+            STATS_ADD(subtrees_pruned, 1);
+            continue;
+          }
+          lookups++;
+          const GridCell *cell = GridLookup(grid, GridKey(ix, iy, iz));
+          if (cell != NULL) {
+            best = GridNearestInCell(grid, cell, reference, best, &best_sq);
+          }
+        }
+      }
+    }
+  }
+
+  STATS_END(NULL);
+  return (best >= 0) ? &grid->stars[best] : NULL;
+}
+
+void DeallocStarGrid(StarGrid *grid) {
+  if (grid == NULL) {
+    return;
+  }
+
+  free(grid->ids);
+  free(grid->x);
+  free(grid->y);
+  free(grid->z);
+  free(grid->table);
+  free(grid);
+}
+
+// SPATIAL INDEX BACKEND
+// The index behind the SpatialIndex calls is picked at build time: the KD-tree by default,
+// or the uniform grid (cells sized to the jump range) with -DSTAR_CHART_GRID_INDEX.
+const char *SpatialIndexName(void) {
+#ifdef STAR_CHART_GRID_INDEX
+  return "grid";
+#else
+  return "kd-tree";
+#endif
+}
+
+SpatialIndex *CreateSpatialIndex(StarArray *array, double jump_range) {
+#ifdef STAR_CHART_GRID_INDEX
+  return CreateStarGrid(array, jump_range);
+#else
+  (void)jump_range;
+  return CreateBalancedKDTree(array, KD_DEFAULT_LEAF_SIZE);
+#endif
+}
+
+// The index for a catalog whose KD-tree is already built: the tree itself in KD builds, so
+// nothing is copied, or a new grid in grid builds. Release it with DeallocSpatialIndexForTree().
+SpatialIndex *CreateSpatialIndexForTree(StarArray *array, KDTree *tree, double jump_range) {
+#ifdef STAR_CHART_GRID_INDEX
+  (void)tree;
+  return CreateStarGrid(array, jump_range);
+#else
+  (void)array;
+  (void)jump_range;
+  return tree;
+#endif
+}
+
+Star* SpatialNearest(SpatialIndex *index, const Position reference) {
+#ifdef STAR_CHART_GRID_INDEX
+  return GridNearestNeighbor(index, reference);
+#else
+  return NearestNeighbor(index, reference);
+#endif
+}
+
+// Same contract as NearestNeighborBatch()
+int SpatialNearestBatch(SpatialIndex *index, const Position *positions, int count, int *out_ids) {
+#ifdef STAR_CHART_GRID_INDEX
+  for (int i = 0; i < count; i++) {
+    Star *nearest = GridNearestNeighbor(index, positions[i]);
+    out_ids[i] = (nearest != NULL) ? (int)(nearest - index->stars) : -1;
+  }
+  return 1;
+#else
+  return NearestNeighborBatch(index, positions, count, out_ids);
+#endif
+}
+
+StarArray* SpatialSearchRange(SpatialIndex *index, Star *center, float radius) {
+#ifdef STAR_CHART_GRID_INDEX
+  return GridSearchRange(index, center, radius);
+#else
+  return StarSearchRange(index, center, radius);
+#endif
+}
+
+int SpatialRadiusIds(SpatialIndex *index, const Position center, double radius, StarIdBuffer *result) {
+#ifdef STAR_CHART_GRID_INDEX
+  return GridRadiusSearchIds(index, center, radius, result);
+#else
+  return RadiusSearchIds(index, center, radius, result);
+#endif
+}
+
+// Same contract as RadiusSearchSorted()
+int SpatialRadiusSorted(SpatialIndex *index, const Position center, double radius, StarIdBuffer *result) {
+#ifdef STAR_CHART_GRID_INDEX
+  GridRadiusSearchIds(index, center, radius, result);
+  SortByDistance(result->ids, result->distances, result->size);
+  for (int i = 0; i < result->size; i++) {
+    result->distances[i] = sqrt(result->distances[i]);
+  }
+  return result->size;
+#else
+  return RadiusSearchSorted(index, center, radius, result);
+#endif
+}
+
+// Same contract as RadiusSearchNearest(). The grid gathers every hit, then keeps the limit
+// nearest in a bounded heap built in place over the hit list and sorts only those.
+int SpatialRadiusNearest(SpatialIndex *index, const Position center, double radius, int limit, StarIdBuffer *result) {
+#ifdef STAR_CHART_GRID_INDEX
+  int total = GridRadiusSearchIds(index, center, radius, result);
+  if (limit <= 0) {
+    result->size = 0;
+    return total;
+  }
+
+  // Pushes only write below index i, which has already been read
+  KNNHeap heap = {result->distances, result->ids, 0, limit};
+  for (int i = 0; i < total; i++) {
+    KNNHeapPush(&heap, result->distances[i], result->ids[i]);
+  }
+  result->size = SortKNNHeap(&heap);
+  for (int i = 0; i < result->size; i++) {
+    result->distances[i] = sqrt(result->distances[i]);
+  }
+  return total;
+#else
+  return RadiusSearchNearest(index, center, radius, limit, result);
+#endif
+}
 
-  PrintKDTree(node->right);
+void DeallocSpatialIndex(SpatialIndex *index) {
+#ifdef STAR_CHART_GRID_INDEX
+  DeallocStarGrid(index);
+#else
+  DeallocKDTree(index);
+#endif
 }
 
-void DeallocKDTree(KDNode *node) {
-  if (node) {
-    DeallocKDTree(node->left);
-    DeallocKDTree(node->right);
-    free(node);
+void DeallocSpatialIndexForTree(SpatialIndex *index, KDTree *tree) {
+#ifdef STAR_CHART_GRID_INDEX
+  (void)tree;
+  DeallocStarGrid(index);
+#else
+  if (index != tree) {
+    DeallocKDTree(index);
   }
+#endif
 }
 
 // HASHMAP UTILITY FUNCTIONS
+// Open addressing with linear probing over one flat array of 8-byte slots. Each slot keeps
+// the 32-bit hash next to the star id, so a probe only touches a name (borrowed from the
+// catalog, never copied) when the full hash already matches. A zero hash marks an empty slot.
 unsigned long hash(const char *key) {
   // djb2 algorithm
   unsigned long hash = 5381;
   int c = 0;
 
-  while (c = *key++) {
+  while ((c = *key++)) {
     hash = ((hash << 5) + hash) + c;
   }
 
   return hash;
 }
 
+// djb2 leaves the low bits poorly mixed, and the table index is taken from the low bits
+unsigned int SlotHash(const char *key) {
+  unsigned long h = hash(key);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdUL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53UL;
+  h ^= h >> 33;
+
+  unsigned int slot_hash = (unsigned int)h;
+  return slot_hash ? slot_hash : 1; // Zero is reserved for empty slots
+}
+
+// Smallest power of two that keeps 'count' keys under the maximum load factor
+int HashMapCapacityFor(int count) {
+  int capacity = 16;
+  while ((double)count > capacity * HASHMAP_MAX_LOAD) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+// Inserts (or re-points) the star with this hash; the table must have a free slot. Returns the
+// id of the star whose entry was re-pointed, or -1 if the name was new.
+int InsertHashedId(HashMap *map, unsigned int slot_hash, int id) {
+  unsigned int mask = map->size - 1;
+  unsigned int index = slot_hash & mask;
+  const char *key = map->stars[id].name;
+
+  while (map->slots[index].hash != 0) {
+    HashEntry *entry = &map->slots[index];
+    if (entry->hash == slot_hash && strcmp(map->stars[entry->id].name, key) == 0) {
+      int shadowed = entry->id;
+      entry->id = id; // Later stars with the same name shadow earlier ones
+      return shadowed;
+    }
+    index = (index + 1) & mask;
+  }
+
+  map->slots[index].hash = slot_hash;
+  map->slots[index].id = id;
+  map->count++;
+  return -1;
+}
+
 void ResizeHashMap(HashMap *map) {
   int new_size = map->size * 2;
-  HashEntry **new_buckets = calloc(new_size, sizeof(HashEntry*));
-  if (new_buckets == NULL) {
+  HashEntry *new_slots = calloc(new_size, sizeof(HashEntry));
+  if (new_slots == NULL) {
     fprintf(stderr, "ERROR [ResizeHashMap()]: MEMORY ALLOCATION FAILED DURING HASH MAP RESIZE!\n");
     return;
   }
 
+  // Stored hashes mean no key is ever hashed (or even read) again
+  unsigned int mask = new_size - 1;
   for (int i = 0; i < map->size; i++) {
-    HashEntry *entry = map->buckets[i];
-    while (entry) {
-      HashEntry *next_entry = entry->next;
-      unsigned int index = hash(entry->key) % new_size;
-      
-      entry->next = new_buckets[index];
-      new_buckets[index] = entry;
-
-      // printf("  Rehashed key '%s' to new index %u\n", entry->key, index);
-
-      entry = next_entry;
+    HashEntry entry = map->slots[i];
+    if (entry.hash == 0) {
+      continue;
     }
+    unsigned int index = entry.hash & mask;
+    while (new_slots[index].hash != 0) {
+      index = (index + 1) & mask;
+    }
+    new_slots[index] = entry;
   }
-  free(map->buckets);
-  map->buckets = new_buckets;
+
+  free(map->slots);
+  map->slots = new_slots;
   map->size = new_size;
 
   // printf("Resizing complete. New size: %d\n", map->size);
 }
 
-void AddToHashMap(HashMap *map, const char *key, Star *value) {
-  // Check and resize if load factor exceeds 0.75
-  if ((float)(map->count + 1) / map->size > 0.75) {
-    // printf("Resizing hash map. Current size: %u, count: %u\n", map->size, map->count);
+// The star's name is used as the key and is borrowed, not copied; value must belong to the
+// catalog the map was created for
+void AddToHashMap(HashMap *map, Star *value) {
+  // Check and resize if load factor exceeds the maximum
+  if ((double)(map->count + 1) > map->size * HASHMAP_MAX_LOAD) {
     ResizeHashMap(map);
+    if ((double)(map->count + 1) >= map->size) {
+      fprintf(stderr, "ERROR [AddToHashMap()]: HASH MAP IS FULL!\n");
+      return;
+    }
   }
 
-  unsigned int index = hash(key) % map->size; // Compute bucket index
-  // printf("Inserting key '%s' into index %u\n", key, index);
+  InsertHashedId(map, SlotHash(value->name), (int)(value - map->stars));
+}
 
-  // Allocate new hash entry
-  HashEntry *new_entry = calloc(1, sizeof(HashEntry));
-  if (!new_entry) {
-    fprintf(stderr, "ERROR [AddToHashMap()]: MEMORY ALLOCATION FAILED DURING ADD TO HASH MAP!\n");
-    return;
+// Removes the entry for value's name if it currently resolves to value. Later entries in the
+// probe run are shifted back into the hole, so lookups never need tombstones. Returns 1 if removed.
+int RemoveFromHashMap(HashMap *map, Star *value) {
+  unsigned int mask = map->size - 1;
+  unsigned int slot_hash = SlotHash(value->name);
+  unsigned int index = slot_hash & mask;
+  int id = (int)(value - map->stars);
+
+  while (map->slots[index].hash != 0) {
+    if (map->slots[index].hash == slot_hash && map->slots[index].id == id) {
+      break;
+    }
+    index = (index + 1) & mask;
   }
-  new_entry->key = strdup(key);
-  if (!new_entry->key) {
-    fprintf(stderr, "ERROR [AddToHashMap()]: MEMORY ALLOCATION FAILED FOR KEY STRING!\n");
-    free(new_entry);
-    return;
+  if (map->slots[index].hash == 0) {
+    return 0;
   }
-  new_entry->value = value;
 
-  // Handle collisions with chaining
-  new_entry->next = map->buckets[index];
-  map->buckets[index] = new_entry;
+  unsigned int hole = index;
+  unsigned int next = (hole + 1) & mask;
+  while (map->slots[next].hash != 0) {
+    // An entry may fill the hole only if its home slot is not between the hole and itself
+    unsigned int home = map->slots[next].hash & mask;
+    if (((next - home) & mask) >= ((next - hole) & mask)) {
+      map->slots[hole] = map->slots[next];
+      hole = next;
+    }
+    next = (next + 1) & mask;
+  }
 
-  map->count++;
-  // printf("Key '%s' successfully added to hash map\n", key);
+  map->slots[hole].hash = 0;
+  map->count--;
+  return 1;
 }
 
 Star* GetFromHashMap(HashMap *map, const char *key) {
-  unsigned int index = hash(key) % map->size;
-  // printf("Hash index for key '%s': %u\n", key, index);
-
-  // printf("Traversing chain at index %u:\n", index);
-  HashEntry *entry = map->buckets[index];
-
-  while (entry) {
-    // printf("Checking key: '%s'\n", entry->key);
-
-    if (strcmp(entry->key, key) == 0) {
-      // printf("Key found! Returning value.\n");
-      return entry->value;
-    } 
-    
-    entry = entry->next;
-    
+  STATS_BEGIN();
+  unsigned int slot_hash = SlotHash(key);
+  unsigned int mask = map->size - 1;
+  unsigned int index = slot_hash & mask;
+  Star *found = NULL;
+
+  while (map->slots[index].hash != 0) {
+    STATS_ADD(hash_probes, 1);
+    const HashEntry *entry = &map->slots[index];
+    if (entry->hash == slot_hash && strcmp(map->stars[entry->id].name, key) == 0) {
+      found = &map->stars[entry->id];
+      break;
+    }
+    index = (index + 1) & mask;
   }
+  STATS_END(NULL);
 
-  // printf("Key not found. Returning NULL.\n");
-  return NULL;
+  // if (found == NULL) printf("Key not found. Returning NULL.\n");
+  return found;
 }
 
 void DeallocHashMap(HashMap *map) {
@@ -480,24 +4030,21 @@ void DeallocHashMap(HashMap *map) {
     return;
   }
 
-  for (int i = 0; i < map->size; i++) {
-    HashEntry *entry = map->buckets[i];
-    while (entry) {
-      HashEntry *temp = entry;
-      entry = entry->next;
-      free(temp->key);
-      free(temp);
-    }
-  }
-  free(map->buckets);
+  free(map->slots);
   free(map);
 }
 
 // OTHER UTILITY FUNCTIONS
+// Only StarPath() reads the player position; threaded callers give each QueryContext its own origin
 Position* SetPlayerPosition(float x, float y, float z) {
   player_position.x = x;
   player_position.y = y;
   player_position.z = z;
+  return &player_position;
+}
+
+double KDAxisValue(const Position *position, int axis) {
+  return (axis == 0) ? position->x : (axis == 1) ? position->y : position->z;
 }
 
 double CalculateDistance(const Star *star, const Position reference) {
@@ -565,138 +4112,569 @@ int CompareNodeZ(const void *a, const void *b) {
   return (StarA->position->y < StarB->position->y) ? -1 : (StarA->position->y > StarB->position->y) ? 1 : 0;
 }
 
+// JUMP GRAPH FUNCTIONS
+// For a fixed jump range the set of stars reachable in one jump never changes, so it is
+// computed once for every star and stored in compressed sparse row form: the neighbours of
+// star i are targets[offsets[i] .. offsets[i + 1]) with their lengths alongside. Building
+// takes two parallel passes over the KD-tree, one counting degrees and one filling edges
+// into the slots the prefix sum of those degrees reserves. Build one graph per ship class.
+#define JUMP_GRAPH_GRAIN 512
+
+// Jump graphs and route planners keep per-star arrays indexed by catalog id, so their tree must
+// hold every star of the catalog (ids 0..size-1), not a subset from CreateKDTreeFromIds(). A
+// tree's ids are distinct, so that holds exactly when none of them is out of range.
+static int TreeCoversCatalog(const KDTree *tree) {
+  for (int i = 0; i < tree->size; i++) {
+    if (tree->ids[i] < 0 || tree->ids[i] >= tree->size) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+typedef struct JumpGraphBuild {
+  KDTree *tree;
+  JumpGraph *graph;
+} JumpGraphBuild;
+
+typedef struct JumpGraphCursor {
+  JumpGraph *graph;
+  int source;
+  long next; // Next edge slot to fill (fill pass) or degree so far (count pass)
+} JumpGraphCursor;
+
+static int CountJumpEdge(void *user_data, int id, double distance_sq) {
+  JumpGraphCursor *cursor = user_data;
+  (void)distance_sq;
+
+  if (id != cursor->source) {
+    cursor->next++;
+  }
+  return 1;
+}
+
+static int FillJumpEdge(void *user_data, int id, double distance_sq) {
+  JumpGraphCursor *cursor = user_data;
+
+  if (id != cursor->source) {
+    cursor->graph->targets[cursor->next] = id;
+    cursor->graph->lengths[cursor->next] = (float)sqrt(distance_sq);
+    cursor->next++;
+  }
+  return 1;
+}
+
+static void CountJumpEdgesTask(void *user_data, int begin, int end) {
+  JumpGraphBuild *build = user_data;
+
+  for (int star = begin; star < end; star++) {
+    JumpGraphCursor cursor = {build->graph, star, 0};
+    RadiusSearchVisit(build->tree, *build->tree->stars[star].position, build->graph->jump_range, CountJumpEdge, &cursor);
+    build->graph->offsets[star + 1] = cursor.next;
+  }
+}
+
+static void FillJumpEdgesTask(void *user_data, int begin, int end) {
+  JumpGraphBuild *build = user_data;
+
+  for (int star = begin; star < end; star++) {
+    JumpGraphCursor cursor = {build->graph, star, build->graph->offsets[star]};
+    RadiusSearchVisit(build->tree, *build->tree->stars[star].position, build->graph->jump_range, FillJumpEdge, &cursor);
+  }
+}
+
+JumpGraph *CreateJumpGraph(KDTree *tree, double jump_range) {
+  if (!TreeCoversCatalog(tree)) {
+    fprintf(stderr, "ERROR [CreateJumpGraph()]: TREE DOES NOT COVER THE WHOLE CATALOG!\n");
+    return NULL;
+  }
+
+  JumpGraph *graph = calloc(1, sizeof(JumpGraph));
+  if (graph == NULL) {
+    fprintf(stderr, "ERROR [CreateJumpGraph()]: MEMORY ALLOCATION FAILED FOR JUMP GRAPH!\n");
+    return NULL;
+  }
+
+  graph->jump_range = jump_range;
+  graph->node_count = tree->size;
+  graph->offsets = calloc(tree->size + 1, sizeof(long));
+  if (graph->offsets == NULL) {
+    fprintf(stderr, "ERROR [CreateJumpGraph()]: MEMORY ALLOCATION FAILED FOR EDGE OFFSETS!\n");
+    DeallocJumpGraph(graph);
+    return NULL;
+  }
+
+  JumpGraphBuild build = {tree, graph};
+  ParallelFor(tree->size, JUMP_GRAPH_GRAIN, CountJumpEdgesTask, &build);
+
+  // Degrees -> offsets
+  for (int star = 0; star < tree->size; star++) {
+    graph->offsets[star + 1] += graph->offsets[star];
+  }
+  graph->edge_count = graph->offsets[tree->size];
+
+  graph->targets = malloc((graph->edge_count > 0 ? graph->edge_count : 1) * sizeof(int));
+  graph->lengths = malloc((graph->edge_count > 0 ? graph->edge_count : 1) * sizeof(float));
+  if (graph->targets == NULL || graph->lengths == NULL) {
+    fprintf(stderr, "ERROR [CreateJumpGraph()]: MEMORY ALLOCATION FAILED FOR EDGES!\n");
+    DeallocJumpGraph(graph);
+    return NULL;
+  }
+
+  ParallelFor(tree->size, JUMP_GRAPH_GRAIN, FillJumpEdgesTask, &build);
+
+  return graph;
+}
+
+void DeallocJumpGraph(JumpGraph *graph) {
+  if (graph == NULL) {
+    return;
+  }
+
+  free(graph->offsets);
+  free(graph->targets);
+  free(graph->lengths);
+  free(graph);
+}
+
 // STAR PATH FUNCTIONS
-  // In the future, replace 'radius' with player's jump distance
-  // Remove the expanding radius search (*1.5) because player's can't jump outside of jump distance
-  // Better idea: allow the expansion and with player jump distance, determine (based on count of expansions)
-  // how many jumps will need to happen to reach next star in path
   // GAME NOTE: Players can opt to jump directly to destination but solar worm holes will be quicker which would
   // incentivize using star system navigation instead of interstellar jumps
 
-StarArray* StarPath(const char *destination_key, KDNode *root, HashMap *map) {
-  // Create path and visited map
-  StarArray *star_path = CreateStarArray();
-  HashMap *visited = CreateHashMap(star_path, 1024);
+// A* over the implicit jump graph: two stars are connected when they are within max_jump of
+// each other, and edges cost their length in light years. Straight-line distance to the
+// destination is the heuristic, which is consistent, so a star is never reopened once
+// settled. All per-query state lives in the planner's side arrays, indexed by star id and
+// lazily reset with a generation stamp, so a query only touches the stars it reaches.
+RoutePlanner *CreateRoutePlanner(KDTree *tree) {
+  if (!TreeCoversCatalog(tree)) {
+    fprintf(stderr, "ERROR [CreateRoutePlanner()]: TREE DOES NOT COVER THE WHOLE CATALOG!\n");
+    return NULL;
+  }
+
+  RoutePlanner *planner = calloc(1, sizeof(RoutePlanner));
+  if (planner == NULL) {
+    fprintf(stderr, "ERROR [CreateRoutePlanner()]: MEMORY ALLOCATION FAILED FOR ROUTE PLANNER!\n");
+    return NULL;
+  }
+
+  int size = tree->size > 0 ? tree->size : 1;
+  planner->tree = tree;
+  planner->size = tree->size;
+  planner->g_score = malloc(size * sizeof(double));
+  planner->parent = malloc(size * sizeof(int));
+  planner->heap_index = malloc(size * sizeof(int));
+  planner->stamp = calloc(size, sizeof(unsigned int));
+  planner->open.ids = malloc(size * sizeof(int));
+  planner->open.keys = malloc(size * sizeof(double));
+  planner->open.capacity = size;
+  InitStarIdBuffer(&planner->neighbors);
+  STATS_ADD(bytes_allocated, sizeof(RoutePlanner) + size * (2 * sizeof(double) + 3 * sizeof(int) + sizeof(unsigned int)));
+
+  if (!planner->g_score || !planner->parent || !planner->heap_index || !planner->stamp ||
+      !planner->open.ids || !planner->open.keys) {
+    fprintf(stderr, "ERROR [CreateRoutePlanner()]: MEMORY ALLOCATION FAILED FOR PLANNER STATE!\n");
+    DeallocRoutePlanner(planner);
+    return NULL;
+  }
 
-  // Convert destination_key to star node
-  Star *destination = GetFromHashMap(map, destination_key);
+  return planner;
+}
 
-  // Determine closest star
-  Star *origin = NearestNeighbor(root, player_position);
-  origin->path_cost = CalculateEuclideanDistance(origin, destination);
+void DeallocRoutePlanner(RoutePlanner *planner) {
+  if (planner == NULL) {
+    return;
+  }
 
-  StarPathBuild(origin, destination, star_path, root, visited);
+  free(planner->g_score);
+  free(planner->parent);
+  free(planner->heap_index);
+  free(planner->stamp);
+  free(planner->open.ids);
+  free(planner->open.keys);
+  DeallocStarIdBuffer(&planner->neighbors);
+  free(planner);
+}
 
-  DeallocHashMap(visited);
-  // star_path is freed in main
-  return star_path;
+static inline double StarDistanceById(const KDTree *tree, int a, int b) {
+  STATS_ADD(distance_evals, 1);
+  const Position *pa = tree->stars[a].position;
+  const Position *pb = tree->stars[b].position;
+  double dx = pa->x - pb->x;
+  double dy = pa->y - pb->y;
+  double dz = pa->z - pb->z;
+  return sqrt((dx * dx) + (dy * dy) + (dz * dz));
 }
 
-void StarPathBuild(Star *current_star, Star *destination, StarArray *path_array, KDNode *root, HashMap *visited) {
+// First touch of a star in this query: give it a fresh, unreached state
+static inline void TouchStar(RoutePlanner *planner, int id) {
+  if (planner->stamp[id] != planner->generation) {
+    planner->stamp[id] = planner->generation;
+    planner->g_score[id] = DBL_MAX;
+    planner->parent[id] = -1;
+    planner->heap_index[id] = HEAP_NOT_QUEUED;
+  }
+}
 
-//==============================================================================================//
-// ADD TO ARRAY AND CHECK FOR BASE CASE
-//==============================================================================================//
-  AddStarToArray(path_array, current_star);
+// Everything SearchRoute() needs to know about one query besides the planner itself
+typedef struct RouteQuery {
+  const JumpGraph *graph;         // NULL: expand with radius queries
+  const LandmarkSet *landmarks;   // NULL: straight-line heuristic only
+  double max_jump;
+  int destination;
+  float landmark_to_destination[LANDMARK_MAX];
+} RouteQuery;
+
+// Lower bound on the remaining cost from id to the destination, or DBL_MAX when a landmark
+// proves the destination cannot be reached from id at all
+static inline double RouteHeuristic(const RoutePlanner *planner, const RouteQuery *query, int id) {
+  double bound = StarDistanceById(planner->tree, id, query->destination);
+  const LandmarkSet *landmarks = query->landmarks;
+  if (landmarks == NULL) {
+    return bound;
+  }
 
-// Prevent revisiting the same star
-  if (GetFromHashMap(visited, current_star->name)) {
-      printf("Star %s already visited, skipping...\n", current_star->name);
-      return;
+  const float *from_landmarks = &landmarks->distances[(long)id * landmarks->count];
+  for (int l = 0; l < landmarks->count; l++) {
+    double to_star = from_landmarks[l];
+    double to_destination = query->landmark_to_destination[l];
+    if (to_star == FLT_MAX || to_destination == FLT_MAX) {
+      if (to_star != to_destination) {
+        return DBL_MAX; // Exactly one of them shares the landmark's component
+      }
+      continue;
+    }
+
+    // Triangle inequality; the slack covers rounding in the float distance table
+    double landmark_bound = fabs(to_destination - to_star) - LANDMARK_SLACK * (to_destination + to_star);
+    bound = (landmark_bound > bound) ? landmark_bound : bound;
   }
 
-  AddToHashMap(visited, current_star->name, current_star);
+  return bound;
+}
 
-  printf("Adding %s to star_path\n\n", current_star->name);
-  printf("-=***   BUILD START   ***=-\n");
-  printf("current star: %s\ndestination star: %s\n\n", current_star->name, destination->name);
+static inline void RelaxEdge(RoutePlanner *planner, const RouteQuery *query, int current, int neighbor, double length) {
+  TouchStar(planner, neighbor);
+  if (planner->heap_index[neighbor] == HEAP_CLOSED) {
+    return;
+  }
 
-  if (GetFromHashMap(visited, destination->name)) {
-    // Base case
-    printf("\nDestination reached!\n");
-    PrintStarPath(path_array);
+  double tentative = planner->g_score[current] + length;
+  if (tentative >= planner->g_score[neighbor]) {
+    return;
+  }
+
+  double heuristic = RouteHeuristic(planner, query, neighbor);
+  if (heuristic == DBL_MAX) {
     return;
   }
 
-//==============================================================================================//
-// GET NEIGHBORS
-//==============================================================================================//
+  planner->g_score[neighbor] = tentative;
+  planner->parent[neighbor] = current;
+  double f_score = tentative + heuristic;
 
-  StarArray *neighbors = NULL;
-  float radius = CalculateEuclideanDistance(current_star, destination) * 0.5;
-    
-  do {
-    if (neighbors) {
-      DeallocSubStarArray(neighbors);
+  if (planner->heap_index[neighbor] == HEAP_NOT_QUEUED) {
+    HeapPush(&planner->open, planner->heap_index, neighbor, f_score);
+  } else {
+    HeapDecreaseKey(&planner->open, planner->heap_index, neighbor, f_score);
+  }
+}
+
+// Starts a new query: bumps the generation so every star reads as untouched
+static void ResetRoutePlanner(RoutePlanner *planner) {
+  // Wrapping the generation counter would make stale stamps look current
+  if (++planner->generation == 0) {
+    memset(planner->stamp, 0, planner->size * sizeof(unsigned int));
+    planner->generation = 1;
+  }
+  planner->open.size = 0;
+  planner->settled = 0;
+}
+
+// Neighbours come from the CSR graph when one is given, otherwise from radius queries
+static int FindRoute(RoutePlanner *planner, RouteQuery *query, int origin, StarIdBuffer *route) {
+  KDTree *tree = planner->tree;
+  MinHeap *open = &planner->open;
+  const JumpGraph *graph = query->graph;
+  int destination = query->destination;
+
+  route->size = 0;
+  planner->settled = 0;
+  if (origin < 0 || destination < 0 || origin >= planner->size || destination >= planner->size) {
+    return 0;
+  }
+
+  ResetRoutePlanner(planner);
+
+  if (query->landmarks != NULL) {
+    const LandmarkSet *landmarks = query->landmarks;
+    for (int l = 0; l < landmarks->count; l++) {
+      query->landmark_to_destination[l] = landmarks->distances[(long)destination * landmarks->count + l];
     }
-    neighbors = StarSearchRange(root, current_star, radius);
-    radius += 1;
-  } while (neighbors->size < 5);
+  }
 
-//==============================================================================================//
-// ITERATE THROUGH NEIGHBORS CHECKING FOR VISITED, CALCULATE PATH COST, UPDATE AS NECESSARY
-//==============================================================================================//
+  double heuristic = RouteHeuristic(planner, query, origin);
+  if (heuristic == DBL_MAX) {
+    return 0;
+  }
 
-  StarArray *neighbors_to_use = CreateStarArray();
+  TouchStar(planner, origin);
+  planner->g_score[origin] = 0.0;
+  HeapPush(open, planner->heap_index, origin, heuristic);
 
-  for (int i = 0; i < neighbors->size; i++) {
-    Star *neighbor = &neighbors->stars[i];
-    Star *visited_star = GetFromHashMap(visited, neighbor->name);
+  while (open->size > 0) {
+    int current = HeapPopMin(open, planner->heap_index);
+    planner->heap_index[current] = HEAP_CLOSED;
+    planner->settled++;
 
-    float new_cost = CalculateEuclideanDistance(current_star, neighbor) + 
-                     CalculateEuclideanDistance(neighbor, destination);
+    if (current == destination) {
+      break;
+    }
 
-    if (visited_star) { 
-      printf("Skipping star: %s (no better path found)\n", neighbor->name);
+    if (graph != NULL) {
+      for (long edge = graph->offsets[current]; edge < graph->offsets[current + 1]; edge++) {
+        RelaxEdge(planner, query, current, graph->targets[edge], graph->lengths[edge]);
+      }
       continue;
     }
-    
-    neighbor->path_cost = new_cost;
-    printf("Updated path cost for %s to %.2f\n", neighbor->name, new_cost);
 
-    AddStarToArray(neighbors_to_use, neighbor);
+    RadiusSearchIds(tree, *tree->stars[current].position, query->max_jump, &planner->neighbors);
+    for (int i = 0; i < planner->neighbors.size; i++) {
+      RelaxEdge(planner, query, current, planner->neighbors.ids[i], sqrt(planner->neighbors.distances[i]));
+    }
+  }
+
+  if (planner->stamp[destination] != planner->generation || planner->heap_index[destination] != HEAP_CLOSED) {
+    return 0;
+  }
+
+  // Walk parents back from the destination, then reverse into origin-first order
+  int hops = 0;
+  for (int id = destination; id >= 0; id = planner->parent[id]) {
+    hops++;
+  }
+  if (!ReserveStarIdBuffer(route, hops)) {
+    return 0;
+  }
+
+  int index = hops - 1;
+  for (int id = destination; id >= 0; id = planner->parent[id]) {
+    route->ids[index] = id;
+    route->distances[index] = planner->g_score[id];
+    index--;
+  }
+  route->size = hops;
+
+  return 1;
+}
+
+static int SearchRoute(RoutePlanner *planner, RouteQuery *query, int origin, StarIdBuffer *route) {
+  STATS_BEGIN();
+  int found = FindRoute(planner, query, origin, route);
+  STATS_END(NULL);
+  return found;
+}
+
+// Finds the shortest chain of jumps no longer than max_jump from origin to destination (star
+// ids). On success route holds the star ids from origin to destination with the cumulative
+// cost at each hop in route->distances, and 1 is returned; 0 means no such route exists.
+int PlanRoute(RoutePlanner *planner, int origin, int destination, double max_jump, StarIdBuffer *route) {
+  RouteQuery query = {NULL, NULL, max_jump, destination, {0}};
+  return SearchRoute(planner, &query, origin, route);
+}
+
+// Same as PlanRoute() with the graph's jump range, but walks the precomputed adjacency lists
+// instead of running a radius query at every expansion
+int PlanRouteOnGraph(RoutePlanner *planner, const JumpGraph *graph, int origin, int destination, StarIdBuffer *route) {
+  if (graph->node_count != planner->size) {
+    fprintf(stderr, "ERROR [PlanRouteOnGraph()]: GRAPH AND PLANNER COVER DIFFERENT CATALOGS!\n");
+    route->size = 0;
+    return 0;
+  }
+
+  RouteQuery query = {graph, NULL, graph->jump_range, destination, {0}};
+  return SearchRoute(planner, &query, origin, route);
+}
+
+// LANDMARK (ALT) FUNCTIONS
+// A handful of landmark stars store their exact graph distance to every star. For any star v
+// and destination t, |d(L, t) - d(L, v)| is a lower bound on d(v, t) (triangle inequality),
+// and usually a far tighter one than straight-line distance when the jump range forces long
+// detours. Landmarks are picked farthest-first: each new one is the star whose distance to
+// the closest existing landmark is largest, which spreads them around the edge of the graph.
+
+// Dijkstra over the whole component of source; out[v] = graph distance, FLT_MAX if unreachable
+static void GraphDistancesFrom(RoutePlanner *planner, const JumpGraph *graph, int source, float *out, int stride) {
+  ResetRoutePlanner(planner);
+
+  TouchStar(planner, source);
+  planner->g_score[source] = 0.0;
+  HeapPush(&planner->open, planner->heap_index, source, 0.0);
+
+  while (planner->open.size > 0) {
+    int current = HeapPopMin(&planner->open, planner->heap_index);
+    planner->heap_index[current] = HEAP_CLOSED;
+
+    for (long edge = graph->offsets[current]; edge < graph->offsets[current + 1]; edge++) {
+      int neighbor = graph->targets[edge];
+      TouchStar(planner, neighbor);
+      if (planner->heap_index[neighbor] == HEAP_CLOSED) {
+        continue;
+      }
+
+      double tentative = planner->g_score[current] + graph->lengths[edge];
+      if (tentative < planner->g_score[neighbor]) {
+        planner->g_score[neighbor] = tentative;
+        if (planner->heap_index[neighbor] == HEAP_NOT_QUEUED) {
+          HeapPush(&planner->open, planner->heap_index, neighbor, tentative);
+        } else {
+          HeapDecreaseKey(&planner->open, planner->heap_index, neighbor, tentative);
+        }
+      }
+    }
+  }
+
+  for (int star = 0; star < graph->node_count; star++) {
+    int reached = planner->stamp[star] == planner->generation;
+    out[(long)star * stride] = reached ? (float)planner->g_score[star] : FLT_MAX;
+  }
+}
+
+LandmarkSet *CreateLandmarks(RoutePlanner *planner, const JumpGraph *graph, int count) {
+  int size = graph->node_count;
+  if (graph->node_count != planner->size) {
+    fprintf(stderr, "ERROR [CreateLandmarks()]: GRAPH AND PLANNER COVER DIFFERENT CATALOGS!\n");
+    return NULL;
+  }
+  if (count > LANDMARK_MAX) {
+    count = LANDMARK_MAX;
+  }
+  if (count > size) {
+    count = size;
+  }
+
+  LandmarkSet *landmarks = calloc(1, sizeof(LandmarkSet));
+  float *closest = malloc((size > 0 ? size : 1) * sizeof(float));
+  if (landmarks == NULL || closest == NULL) {
+    fprintf(stderr, "ERROR [CreateLandmarks()]: MEMORY ALLOCATION FAILED FOR LANDMARKS!\n");
+    free(landmarks);
+    free(closest);
+    return NULL;
+  }
+
+  landmarks->graph = graph;
+  landmarks->count = count;
+  landmarks->landmarks = malloc((count > 0 ? count : 1) * sizeof(int));
+  landmarks->distances = malloc(((long)size * count > 0 ? (long)size * count : 1) * sizeof(float));
+  if (landmarks->landmarks == NULL || landmarks->distances == NULL) {
+    fprintf(stderr, "ERROR [CreateLandmarks()]: MEMORY ALLOCATION FAILED FOR LANDMARK DISTANCES!\n");
+    free(closest);
+    DeallocLandmarks(landmarks);
+    return NULL;
   }
 
-//==============================================================================================//
-// CREATE UPDATED ARRAY WITH NON-VISITED STARS AND BEND IT TO CONFORM TO HEAP RULES
-//==============================================================================================//
+  // Seed: the star farthest from star 0 in its component becomes the first landmark
+  int next = 0;
+  for (int l = 0; l < count; l++) {
+    if (l == 0 && size > 0) {
+      GraphDistancesFrom(planner, graph, 0, closest, 1);
+      for (int star = 0; star < size; star++) {
+        if (closest[star] != FLT_MAX && closest[star] > closest[next]) {
+          next = star;
+        }
+      }
+      for (int star = 0; star < size; star++) {
+        closest[star] = FLT_MAX;
+      }
+    }
 
-  Heapify(neighbors_to_use);
+    landmarks->landmarks[l] = next;
+    GraphDistancesFrom(planner, graph, next, &landmarks->distances[l], count);
 
-  // Print stars and costs for QA check of StarPathBuild()
-  printf("\nHeap after neighbor updates:\n");
-  for (int i = 0; i < neighbors_to_use->size; i++) {
-    printf("%s: cost = %.2f\n", neighbors_to_use->stars[i].name, neighbors_to_use->stars[i].path_cost);
+    // Track the distance from every star to its closest landmark and pick the farthest star
+    float farthest = -1.0f;
+    for (int star = 0; star < size; star++) {
+      float distance = landmarks->distances[(long)star * count + l];
+      if (distance < closest[star]) {
+        closest[star] = distance;
+      }
+      if (closest[star] != FLT_MAX && closest[star] > farthest) {
+        farthest = closest[star];
+        next = star;
+      }
+    }
   }
 
-//==============================================================================================//
-// GET MIN NODE FOR INSERTION AS NEXT STAR; WILL BE ADDED AT THE TOP; PASSED INTO RECURSIVE CALL
-//==============================================================================================//
-  Star *next_star = PopMin(neighbors_to_use);
-  
-  if (next_star == NULL) {
-    fprintf(stderr, "Dead end encountered, backtracking...\n");
-    DeallocSubStarArray(neighbors_to_use);
-    DeallocSubStarArray(neighbors);
+  free(closest);
+  return landmarks;
+}
+
+void DeallocLandmarks(LandmarkSet *landmarks) {
+  if (landmarks == NULL) {
     return;
   }
 
-  printf("*** Passing %s to StarPathBuild ***\n\n", next_star->name);
-  printf("Current star path:\n");
-  PrintStarPath(path_array);
+  free(landmarks->landmarks);
+  free(landmarks->distances);
+  free(landmarks);
+}
+
+// PlanRouteOnGraph() guided by landmark lower bounds; same routes, far fewer settled stars
+int PlanRouteWithLandmarks(RoutePlanner *planner, const LandmarkSet *landmarks, int origin, int destination, StarIdBuffer *route) {
+  const JumpGraph *graph = landmarks->graph;
+  if (graph->node_count != planner->size) {
+    fprintf(stderr, "ERROR [PlanRouteWithLandmarks()]: LANDMARKS AND PLANNER COVER DIFFERENT CATALOGS!\n");
+    route->size = 0;
+    return 0;
+  }
+
+  RouteQuery query = {graph, landmarks, graph->jump_range, destination, {0}};
+  return SearchRoute(planner, &query, origin, route);
+}
+
+// Route from the star nearest the player to destination_key, hopping at most max_jump light
+// years at a time. Returns the stars along the way, origin first (empty when unreachable).
+StarArray* StarPath(const char *destination_key, KDTree *root, HashMap *map, double max_jump) {
+  QueryContext *context = CreateQueryContext(root, map, player_position);
+  if (context == NULL) {
+    return NULL;
+  }
+
+  StarArray *star_path = StarPathFrom(context, destination_key, max_jump);
+  DeallocQueryContext(context);
+  // star_path is freed in main
+  return star_path;
+}
 
-//==============================================================================================//
-// MARK CURRENT STAR AS VISITED AFTER PROCESSING
-//==============================================================================================//
-  AddToHashMap(visited, current_star->name, current_star);
+// StarPath() from the context's origin instead of the global player position
+StarArray* StarPathFrom(QueryContext *context, const char *destination_key, double max_jump) {
+  StarArray *star_path = CreateStarArray();
+  if (star_path == NULL) {
+    return NULL;
+  }
+
+  if (GetFromHashMap(context->names, destination_key) == NULL) {
+    fprintf(stderr, "ERROR [StarPath()]: UNKNOWN DESTINATION '%s'!\n", destination_key);
+    return star_path;
+  }
+
+  STATS_BEGIN();
+  int found = QueryRoute(context, destination_key, max_jump);
+  STATS_END(&context->stats);
 
-  // RECURSIVE CALL
-  StarPathBuild(next_star, destination, path_array, root, visited);
+  if (found) {
+    const StarIdBuffer *route = &context->route;
+    for (int i = 0; i < route->size; i++) {
+      AddStarToArray(star_path, &context->tree->stars[route->ids[i]]);
+    }
+    printf("\nDestination reached!\n");
+    PrintStarPath(star_path);
+    printf("Total distance: %.2f light years (%d stars settled)\n", route->distances[route->size - 1], context->planner->settled);
+  } else {
+    printf("No route to %s within a %.2f light year jump range\n", destination_key, max_jump);
+  }
 
-  // CLEAN UP
-  free(next_star);
-  DeallocSubStarArray(neighbors_to_use);
-  DeallocSubStarArray(neighbors);
+  return star_path;
 }
 
 void PrintStarPath(StarArray *array) {
@@ -717,54 +4695,264 @@ float CalculateEuclideanDistance(Star *current, Star *goal) {
   return sqrt((dx * dx) + (dy * dy) + (dz * dz));
 }
 
-// HEAP FUNCTIONS
-void Heapify(StarArray *heap) {
-  for (int i = (heap->size / 2) - 1; i >= 0; i--) {
-    SiftDown(heap, i);
+// QUERY CONTEXT FUNCTIONS
+// Everything a query writes (origin, result buffers, A* scores and parents) lives in the
+// context, so threads sharing one catalog never write to the same memory. Results that are
+// handed back as StarArrays come out of the context's arena, which every query rewinds on
+// entry, so a warmed-up context answers queries without calling malloc at all.
+QueryContext *CreateQueryContext(KDTree *tree, HashMap *names, const Position origin) {
+  QueryContext *context = calloc(1, sizeof(QueryContext));
+  if (context == NULL) {
+    fprintf(stderr, "ERROR [CreateQueryContext()]: MEMORY ALLOCATION FAILED FOR QUERY CONTEXT!\n");
+    return NULL;
   }
+
+  context->tree = tree;
+  context->names = names;
+  context->origin = origin;
+  InitStarIdBuffer(&context->results);
+  InitStarIdBuffer(&context->route);
+  InitArena(&context->arena, ARENA_DEFAULT_BLOCK_SIZE);
+
+  return context;
+}
+
+void SetQueryOrigin(QueryContext *context, const Position origin) {
+  context->origin = origin;
+}
+
+// Routes QueryNearest(), QueryRange(), QueryRangeNearest() (and the start of QueryRoute())
+// through index, which must cover the same catalog as the context's tree; NULL goes back to
+// the tree
+void SetQueryIndex(QueryContext *context, SpatialIndex *index) {
+  context->index = index;
 }
 
-void SiftDown(StarArray* heap, int index) {
-  int smallest = index;
-  int left = 2 * index + 1;
-  int right = 2 * index + 2;
+static Star *ContextNearest(QueryContext *context) {
+  if (context->index != NULL) {
+    return SpatialNearest(context->index, context->origin);
+  }
+  return NearestNeighbor(context->tree, context->origin);
+}
 
-  if (left < heap->size && (heap->stars[left].path_cost < heap->stars[smallest].path_cost)) {
-    smallest = left;
+static int ContextRange(QueryContext *context, double radius) {
+  if (context->index != NULL) {
+    return SpatialRadiusSorted(context->index, context->origin, radius, &context->results);
   }
+  return RadiusSearchSorted(context->tree, context->origin, radius, &context->results);
+}
 
-  if (right < heap->size && (heap->stars[right].path_cost < heap->stars[smallest].path_cost)) {
-    smallest = right;
+static int ContextRangeNearest(QueryContext *context, double radius, int limit) {
+  if (context->index != NULL) {
+    return SpatialRadiusNearest(context->index, context->origin, radius, limit, &context->results);
   }
+  return RadiusSearchNearest(context->tree, context->origin, radius, limit, &context->results);
+}
+
+// The star closest to the context's origin
+Star* QueryNearest(QueryContext *context) {
+  STATS_BEGIN();
+  ResetArena(&context->arena);
+  Star *nearest = ContextNearest(context);
+  STATS_END(&context->stats);
+  return nearest;
+}
+
+// A star within (1 + epsilon) of the nearest distance, entering at most max_nodes tree nodes
+// past the first leaf (0 for no cap); see ApproxNearestNeighborId()
+Star* QueryApproxNearest(QueryContext *context, double epsilon, long max_nodes) {
+  STATS_BEGIN();
+  ResetArena(&context->arena);
+  Star *nearest = ApproxNearestNeighbor(context->tree, context->origin, epsilon, max_nodes);
+  STATS_END(&context->stats);
+  return nearest;
+}
+
+// Stars within radius of the origin, nearest first, into context->results; returns the count
+int QueryRange(QueryContext *context, double radius) {
+  STATS_BEGIN();
+  ResetArena(&context->arena);
+  int count = ContextRange(context, radius);
+  STATS_END(&context->stats);
+  return count;
+}
+
+// At most limit stars within radius of the origin, nearest first, into context->results.
+// Returns how many stars the radius holds in all, which can exceed results.size; see
+// RadiusSearchNearest()
+int QueryRangeNearest(QueryContext *context, double radius, int limit) {
+  STATS_BEGIN();
+  ResetArena(&context->arena);
+  int total = ContextRangeNearest(context, radius, limit);
+  STATS_END(&context->stats);
+  return total;
+}
+
+// Stars within radius of the straight route from the origin to destination, ordered along
+// the route, into context->results (distances from the route); returns the count
+int QueryCorridor(QueryContext *context, const Position destination, double radius) {
+  STATS_BEGIN();
+  ResetArena(&context->arena);
+  int count = CorridorSearchSorted(context->tree, context->origin, destination, radius, &context->results);
+  STATS_END(&context->stats);
+  return count;
+}
 
-  if (index != smallest) {
-    Star temp = heap->stars[index];
-    heap->stars[index] = heap->stars[smallest];
-    heap->stars[smallest] = temp;
+// Count, centroid and (with_distances) nearest/farthest star within radius of the origin
+int QueryAggregate(QueryContext *context, double radius, int with_distances, StarAggregate *out) {
+  STATS_BEGIN();
+  ResetArena(&context->arena);
+  int count = AggregateRadius(context->tree, context->origin, radius, with_distances, out);
+  STATS_END(&context->stats);
+  return count;
+}
 
-    SiftDown(heap, smallest);
+// QueryRange() as a StarArray (nearest first) that lives in the context's arena: valid until
+// the context's next query, and never to be freed or grown by the caller
+StarArray* QueryRangeStars(QueryContext *context, double radius) {
+  STATS_BEGIN();
+  ResetArena(&context->arena);
+
+  int count = ContextRange(context, radius);
+  StarArray *result = CreateArenaStarArray(&context->arena, count);
+  if (result != NULL) {
+    for (int i = 0; i < count; i++) {
+      result->stars[i] = context->tree->stars[context->results.ids[i]];
+    }
+    result->size = count;
   }
+
+  STATS_END(&context->stats);
+  return result;
 }
 
-Star* PopMin(StarArray* heap) {
-  if (heap->size <= 0) {
-    return NULL;
+// The k stars closest to the origin, nearest first, in the context's arena (see QueryRangeStars())
+StarArray* QueryKNearest(QueryContext *context, int k) {
+  STATS_BEGIN();
+  ResetArena(&context->arena);
+
+  k = (k > 0) ? k : 0;
+  StarArray *result = CreateArenaStarArray(&context->arena, k);
+  int *ids = ArenaAlloc(&context->arena, (k > 0 ? k : 1) * sizeof(int));
+  double *distances = ArenaAlloc(&context->arena, (k > 0 ? k : 1) * sizeof(double));
+  if (result != NULL && ids != NULL && distances != NULL) {
+    int found = KNearestNeighborIds(context->tree, context->origin, k, ids, distances);
+    for (int i = 0; i < found; i++) {
+      result->stars[i] = context->tree->stars[ids[i]];
+    }
+    result->size = found;
+  } else {
+    result = NULL;
   }
 
-  Star *min = calloc(1, sizeof(Star));
-  if (min == NULL) {
-    fprintf(stderr, "ERROR [PopMin()]: Memory allocation failed in PopMin()\n");
+  STATS_END(&context->stats);
+  return result;
+}
+
+// Shortest route from the star nearest the origin to destination_key into context->route
+// (see PlanRoute()). Returns 1 if one exists.
+int QueryRoute(QueryContext *context, const char *destination_key, double max_jump) {
+  context->route.size = 0;
+  STATS_BEGIN();
+  ResetArena(&context->arena);
+
+  Star *destination = GetFromHashMap(context->names, destination_key);
+  Star *origin = ContextNearest(context);
+
+  // Sized for the whole catalog, so built once and reused by every later route
+  if (context->planner == NULL && destination != NULL && origin != NULL) {
+    context->planner = CreateRoutePlanner(context->tree);
+  }
+
+  int found = 0;
+  if (destination != NULL && origin != NULL && context->planner != NULL) {
+    KDTree *tree = context->tree;
+    found = PlanRoute(context->planner, (int)(origin - tree->stars), (int)(destination - tree->stars), max_jump, &context->route);
+  }
+
+  STATS_END(&context->stats);
+  return found;
+}
+
+void DeallocQueryContext(QueryContext *context) {
+  if (context == NULL) {
+    return;
+  }
+
+  DeallocRoutePlanner(context->planner);
+  DeallocStarIdBuffer(&context->results);
+  DeallocStarIdBuffer(&context->route);
+  DeallocArena(&context->arena);
+  free(context);
+}
+
+// HEAP FUNCTIONS
+// Indexed binary min-heap: heap_index[id] tracks where each id sits so keys can be lowered
+// in place (decrease-key) instead of pushing duplicates.
+static inline void HeapPlace(MinHeap *heap, int *heap_index, int slot, int id, double key) {
+  heap->ids[slot] = id;
+  heap->keys[slot] = key;
+  heap_index[id] = slot;
+}
+
+static void SiftUp(MinHeap *heap, int *heap_index, int slot) {
+  int id = heap->ids[slot];
+  double key = heap->keys[slot];
+
+  while (slot > 0) {
+    int parent = (slot - 1) / 2;
+    if (heap->keys[parent] <= key) {
+      break;
+    }
+    HeapPlace(heap, heap_index, slot, heap->ids[parent], heap->keys[parent]);
+    slot = parent;
+  }
+  HeapPlace(heap, heap_index, slot, id, key);
+}
+
+static void SiftDown(MinHeap *heap, int *heap_index, int slot) {
+  int id = heap->ids[slot];
+  double key = heap->keys[slot];
+
+  while (1) {
+    int smallest = 2 * slot + 1;
+    if (smallest >= heap->size) {
+      break;
+    }
+    if (smallest + 1 < heap->size && heap->keys[smallest + 1] < heap->keys[smallest]) {
+      smallest++;
+    }
+    if (key <= heap->keys[smallest]) {
+      break;
+    }
+    HeapPlace(heap, heap_index, slot, heap->ids[smallest], heap->keys[smallest]);
+    slot = smallest;
   }
-  memcpy(min, heap->stars, sizeof(Star));
+  HeapPlace(heap, heap_index, slot, id, key);
+}
+
+void HeapPush(MinHeap *heap, int *heap_index, int id, double key) {
+  STATS_ADD(heap_pushes, 1);
+  int slot = heap->size++;
+  HeapPlace(heap, heap_index, slot, id, key);
+  SiftUp(heap, heap_index, slot);
+}
 
-  heap->stars[0] = heap->stars[heap->size - 1];
+int HeapPopMin(MinHeap *heap, int *heap_index) {
+  STATS_ADD(heap_pops, 1);
+  int min = heap->ids[0];
   heap->size--;
 
-  SiftDown(heap, 0);
+  if (heap->size > 0) {
+    HeapPlace(heap, heap_index, 0, heap->ids[heap->size], heap->keys[heap->size]);
+    SiftDown(heap, heap_index, 0);
+  }
 
   return min;
 }
 
-void Peek(StarArray* heap) {
-  printf("Min node: %s\n", heap->stars[0].name);
+void HeapDecreaseKey(MinHeap *heap, int *heap_index, int id, double key) {
+  int slot = heap_index[id];
+  heap->keys[slot] = key;
+  SiftUp(heap, heap_index, slot);
 }
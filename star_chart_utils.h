@@ -1,10 +1,14 @@
 #ifndef STAR_CHART_UTILS_H
 #define STAR_CHART_UTILS_H
 
+#include <stddef.h>
+#include <stdio.h>
+
 #define PI 3.14159265358979323846
 
-// Forward declaration of KDNode; driven by StarPath (StarSearchRange)
-typedef struct KDNode KDNode;
+// Longest single jump (light years) StarPath() is allowed to plan
+#define DEFAULT_JUMP_RANGE 10.0
+
 typedef struct Position Position;
 
 // Consider updating to include a 'Position *pos' element instead of the x, y, and z
@@ -12,22 +16,57 @@ typedef struct Position Position;
 typedef struct Star {
 	char* name;
 	Position *position;
-	KDNode* kd_node;
 	float lightyears;
-	float path_cost; // For star path
 } Star;
 
 typedef struct StarArray {
 	Star* stars;
 	int size;
 	int capacity;
+	// Owned by arrays built with ParseFile(); NULL for arrays built with AddStarToArray()
+	char* name_pool;
+	size_t name_pool_size;
+	Position* position_pool;
+	int position_pool_size;
 } StarArray;
 
-typedef struct KDNode {
-	Star* star;
-	struct KDNode* left;
-	struct KDNode* right;
-} KDNode;
+// Stars per KD-tree leaf bucket when CreateBalancedKDTree() is passed 0
+#define KD_DEFAULT_LEAF_SIZE 8
+#define KD_MAX_LEAF_SIZE 256
+
+// Leaves have axis == -1; inner nodes split at 'split' along 'axis' (left <= split <= right).
+// begin/count give the slice of KDTree.ids (and x/y/z) covered by the node's subtree.
+typedef struct KDTreeNode {
+	double split;
+	int begin;
+	int count;
+	int axis;
+} KDTreeNode;
+
+// Bounding box of the stars under a node; empty nodes have low > high
+typedef struct KDTreeBox {
+	double low[3];
+	double high[3];
+} KDTreeBox;
+
+// Array-backed KD-tree: node i has children 2i+1 and 2i+2 and all leaves are at 'depth'.
+// Everything below lives in the same allocation as the struct itself. Boxes and sums describe
+// the stars as built (StarIndex tombstones are not subtracted).
+typedef struct KDTree {
+	KDTreeNode* nodes;
+	KDTreeBox* boxes; // One per node
+	Position* sums;   // Sum of the star positions under each node
+	int node_count;
+	int depth;
+	int leaf_size;
+	int size;
+	int* ids;   // Star ids in leaf order
+	double* x;  // Coordinates in leaf order
+	double* y;
+	double* z;
+	Star* stars; // Catalog the ids index into
+	size_t bytes;
+} KDTree;
 
 // Update this to double to match the Star struct position values
 // Wait, Star Struct has x, y, z values... why doesn't it just have
@@ -38,36 +77,251 @@ typedef struct Position {
 	double z;
 } Position;
 
+// Name index slot: hash == 0 marks an empty slot
 typedef struct HashEntry {
-	char* key;
-	Star* value;
-	struct HashEntry* next; // For chaining
+	unsigned int hash;
+	int id;
 } HashEntry;
 
+// Open-addressing name index; keys are the catalog's own Star.name strings
 typedef struct HashMap {
-	HashEntry** buckets;
-	int size;
+	HashEntry* slots;
+	Star* stars; // Catalog the ids index into
+	int size;    // Slot count, always a power of two
 	int count;
 } HashMap;
 
+#define HASHMAP_MAX_LOAD 0.7
+
+// Smallest level of a StarIndex holds this many stars; level k holds up to BASE << k
+#define STAR_INDEX_BASE 64
+#define STAR_INDEX_LEVELS 26
+// Deleted stars are moved this far out in their level's tree so no query ever reaches them
+#define STAR_INDEX_TOMBSTONE 1e150
+
+// Updatable spatial index over a growing StarArray: a set of static KD-trees of doubling size
+// (levels[k] is NULL or holds at most STAR_INDEX_BASE << k stars). Inserts merge the small
+// levels into the next one that has room; deletes leave a tombstone and rebuild a level once
+// half of it is dead. Star ids never change, but Star pointers move when the array grows.
+typedef struct StarIndex {
+	StarArray* array;
+	HashMap* names;  // Kept in sync with inserts and deletes; may be NULL
+	KDTree* levels[STAR_INDEX_LEVELS];
+	int dead[STAR_INDEX_LEVELS];
+	signed char* level_of; // Level holding each star id, -1 once deleted
+	int* shadows;          // Older star with the same name that each id hides in names, or -1
+	int* slot_of;          // Leaf-order slot of each star id within its level
+	int id_capacity;
+	int* scratch;          // Merge buffer
+	int scratch_capacity;
+	int leaf_size;
+	int live_count;
+} StarIndex;
+
+// One occupied grid cell: its stars are StarGrid slots [begin, begin + count)
+typedef struct GridCell {
+	unsigned long key;
+	int begin;
+	int count;
+} GridCell;
+
+// Static uniform grid over a StarArray, an alternative to the KD-tree for fixed-radius queries.
+// Stars are stored contiguously per cell (sorted by cell key); 'table' is an open-addressing
+// hash from cell key to cell.
+typedef struct StarGrid {
+	double cell_size;
+	double inverse_cell_size;
+	double origin[3];  // Low corner of cell (0, 0, 0)
+	int dims[3];       // Cells per axis
+	int size;
+	int cell_count;    // Occupied cells
+	unsigned long table_mask;
+	GridCell* table;
+	int* ids;          // Star id of each slot, cell by cell
+	double* x;         // Coordinates in slot order
+	double* y;
+	double* z;
+	Star* stars;       // Borrowed from the StarArray
+} StarGrid;
+
+// Index used by the SpatialIndex functions, chosen at build time
+#ifdef STAR_CHART_GRID_INDEX
+typedef StarGrid SpatialIndex;
+#else
+typedef KDTree SpatialIndex;
+#endif
+
+// Work counters for one query (or, from GetAggregateStats(), every query so far). Only
+// collected when built with -DSTAR_CHART_STATS; otherwise every field, timing included, stays zero.
+typedef struct QueryStats {
+	unsigned long queries;
+	unsigned long nodes_visited;   // KD-tree nodes entered
+	unsigned long distance_evals;  // Star distances computed
+	unsigned long subtrees_pruned; // Far subtrees skipped by the distance bound
+	unsigned long heap_pushes;
+	unsigned long heap_pops;
+	unsigned long hash_probes;     // Name index slots inspected
+	unsigned long bytes_allocated;
+	double wall_time;              // Seconds
+	double max_wall_time;          // Slowest single query (aggregates only)
+} QueryStats;
+
+#ifdef STAR_CHART_STATS
+extern _Thread_local QueryStats current_query_stats;
+#define STATS_ADD(field, amount) (current_query_stats.field += (amount))
+#define STATS_BEGIN() QueryStatsBegin()
+#define STATS_END(out) QueryStatsEnd(out)
+#else
+#define STATS_ADD(field, amount) ((void)0)
+#define STATS_BEGIN() ((void)0)
+#define STATS_END(out) ((void)0)
+#endif
+
+// Summary of the stars in a query region
+typedef struct StarAggregate {
+	int count;
+	Position centroid;   // Mean position; (0, 0, 0) when count is 0
+	double min_distance; // From the query's reference point; only with distances requested
+	double max_distance;
+	int nearest;         // Star ids at min/max distance, -1 when not computed or count is 0
+	int farthest;
+} StarAggregate;
+
+// Caller-owned, reusable result buffer for id-based queries
+typedef struct StarIdBuffer {
+	int* ids;
+	double* distances;
+	int size;
+	int capacity;
+} StarIdBuffer;
+
+// Called once per hit with the star id and its squared distance; return 0 to stop the search
+typedef int (*StarVisitor)(void* user_data, int id, double distance_sq);
+
+// Two stars within range of each other (see SelfJoinPairs()); first < second
+typedef struct StarPair {
+	int first;
+	int second;
+	float distance; // Light years
+} StarPair;
+
+typedef struct StarPairBuffer {
+	StarPair* pairs;
+	long size;
+	long capacity;
+} StarPairBuffer;
+
+// Called once per pair (first < second) with their squared distance, possibly from several
+// threads at once; return 0 to stop the join
+typedef int (*StarPairVisitor)(void* user_data, int first, int second, double distance_sq);
+
+// Processes items [begin, end) of a ParallelFor() range
+typedef void (*ParallelTask)(void* user_data, int begin, int end);
+
+// Indexed binary min-heap of star ids; see HeapPush()/HeapDecreaseKey()
 typedef struct MinHeap {
-	Star* elements;
+	int* ids;
+	double* keys;
 	int size;
 	int capacity;
 } MinHeap;
 
-// typedef struct HeapNode {
-// 	Star* star;
-// 	float g_cost;
-// 	float h_cost;
-// } HeapNode;
+// Jump network for one jump range in compressed sparse row form: the stars one jump away
+// from star i are targets[offsets[i] .. offsets[i + 1]), at distance lengths[...]
+typedef struct JumpGraph {
+	double jump_range;
+	int node_count;
+	long edge_count;
+	long* offsets;
+	int* targets;
+	float* lengths;
+} JumpGraph;
+
+#define LANDMARK_MAX 32
+// Relative error allowance for the float landmark distance table
+#define LANDMARK_SLACK 1e-6
+
+// ALT preprocessing for one jump graph: distances[v * count + l] is the graph distance from
+// landmarks[l] to star v (FLT_MAX when v is in another component)
+typedef struct LandmarkSet {
+	const JumpGraph* graph;
+	int count;
+	int* landmarks;
+	float* distances;
+} LandmarkSet;
+
+#define HEAP_NOT_QUEUED -1
+#define HEAP_CLOSED -2
+
+// Reusable A* state for one KD-tree. Every per-query array is indexed by star id and is only
+// valid where stamp[id] == generation, so starting a new query does not touch the others.
+typedef struct RoutePlanner {
+	KDTree* tree;
+	int size;
+	double* g_score;
+	int* parent;
+	int* heap_index; // Slot in 'open', or HEAP_NOT_QUEUED / HEAP_CLOSED
+	unsigned int* stamp;
+	unsigned int generation;
+	MinHeap open;
+	StarIdBuffer neighbors;
+	int settled; // Stars expanded by the last query
+} RoutePlanner;
+
+#define ARENA_DEFAULT_BLOCK_SIZE (64 * 1024)
+
+typedef struct ArenaBlock ArenaBlock;
+
+// Bump allocator for query-scoped memory. ResetArena() rewinds to the first block in O(1) and
+// keeps every block for reuse, so a long-running query loop settles at a fixed footprint.
+typedef struct Arena {
+	ArenaBlock* first;
+	ArenaBlock* current;
+	size_t offset;     // Bytes used in 'current'
+	size_t block_size; // Minimum size of a new block
+} Arena;
+
+// Per-thread query state over a shared catalog. The catalog, KD-tree and HashMap are only
+// ever read, so any number of contexts (one per thread) can query the same ones at once.
+typedef struct QueryContext {
+	KDTree* tree;
+	SpatialIndex* index;   // Answers the nearest and radius queries when set; see SetQueryIndex()
+	HashMap* names;
+	Position origin;
+	RoutePlanner* planner; // Created by the first QueryRoute()
+	StarIdBuffer results;  // Hits of the last QueryRange(), nearest first
+	StarIdBuffer route;    // Stars of the last QueryRoute(), origin first
+	QueryStats stats;      // Counters of the last query made through this context
+	Arena arena;           // Scratch and results of the current query; reset by the next one
+} QueryContext;
 
 
 // GLOBAL VARIABLE
 extern Position player_position;
 
 // READ DATABASE FILE
-StarArray* ParseFile();
+StarArray* ParseFile(const char* path);
+int ParseStarLine(char* line, char** name, Position* position, float* lightyears);
+StarArray* LoadStarCatalog(const char* path, int leaf_size, KDTree** tree, HashMap** names);
+
+// THREADING UTILITY FUNCTIONS
+int GetThreadCount(void);
+void ParallelFor(int count, int grain, ParallelTask task, void* user_data);
+
+// ARENA ALLOCATOR
+void InitArena(Arena* arena, size_t block_size);
+void* ArenaAlloc(Arena* arena, size_t bytes);
+void ResetArena(Arena* arena);
+void DeallocArena(Arena* arena);
+StarArray* CreateArenaStarArray(Arena* arena, int capacity);
+
+// QUERY STATISTICS
+int QueryStatsEnabled(void);
+void QueryStatsBegin(void);
+void QueryStatsEnd(QueryStats* out);
+void GetAggregateStats(QueryStats* out);
+void ResetAggregateStats(void);
+void DumpQueryStats(FILE* stream, const char* label, const QueryStats* stats);
 
 // CONVERSION MATH TO DETERMINE X, Y, Z, AND NAVIGATION VECTORS
 double Sign(double value);
@@ -77,7 +331,9 @@ void ConvertTo3DCoords(double A, double B, double C, double* x, double* y, doubl
 
 // DATA STRUCTURE CREATION
 StarArray* CreateStarArray();
-KDNode* CreateBalancedKDTree(Star* stars, int start, int end, int depth);
+KDTree* CreateBalancedKDTree(StarArray* array, int leaf_size);
+KDTree* CreateKDTreeFromIds(StarArray* array, const int* ids, int size, int leaf_size);
+KDTree* AllocKDTree(int size, int depth);
 HashMap* CreateHashMap(StarArray* star_array, int size);
 
 // ARRAY UTILITY FUNCTIONS
@@ -86,42 +342,150 @@ void OptimizeStarArraySize(StarArray* array);
 void PrintStarValues(StarArray* array);
 void DeallocSubStarArray(StarArray* array);
 void DeallocMainStarArray(StarArray* array);
+int IsPooledName(const StarArray* array, const char* name);
+int IsPooledPosition(const StarArray* array, const Position* position);
+
+// SIMD DISTANCE KERNELS
+void DistanceSquaredBatch(const double* x, const double* y, const double* z, int count, const Position reference, double* out);
+int NearestInBatch(const double* x, const double* y, const double* z, int count, const Position reference, double* best_distance_sq);
+int RadiusFilterBatch(const double* x, const double* y, const double* z, int count, const Position reference, double radius_sq, int* out);
 
 // KD-TREE UTILITY FUNCTIONS
-StarArray* StarSearchRange(KDNode* root, Star *center, float radius);
-void RadiusSearch(KDNode* node, Star *center, float radius, int depth, StarArray* result);
-Star* NearestNeighbor(KDNode* root, const Position reference);
-Star* NearestNeighborSearch(KDNode* root, const Position reference, int depth, Star* current_closest_star, double* current_best_distance);
-void PrintKDTree(KDNode* node);
-void DeallocKDTree(KDNode* node);
+StarArray* StarSearchRange(KDTree* tree, Star *center, float radius);
+void RadiusSearch(KDTree* tree, int node_index, Star *center, float radius, StarArray* result);
+Star* NearestNeighbor(KDTree* tree, const Position reference);
+int NearestNeighborSearch(KDTree* tree, int node_index, const Position reference, int current_closest_star, double* current_best_distance);
+StarArray* KNearestNeighbors(KDTree* tree, const Position position, int k);
+int KNearestNeighborIds(KDTree* tree, const Position reference, int k, int* ids, double* distances);
+
+// APPROXIMATE NEAREST NEIGHBOR
+int ApproxNearestNeighborId(KDTree* tree, const Position reference, double epsilon, long max_nodes, double* distance);
+Star* ApproxNearestNeighbor(KDTree* tree, const Position reference, double epsilon, long max_nodes);
+
+// BATCHED NEAREST-NEIGHBOR QUERIES
+int NearestNeighborBatch(KDTree* tree, const Position* positions, int count, int* out_ids);
+
+// ALLOCATION-FREE RADIUS QUERIES
+void InitStarIdBuffer(StarIdBuffer* buffer);
+int ReserveStarIdBuffer(StarIdBuffer* buffer, int capacity);
+void DeallocStarIdBuffer(StarIdBuffer* buffer);
+void RadiusSearchVisit(KDTree* tree, const Position center, double radius, StarVisitor visitor, void* user_data);
+int RadiusSearchIds(KDTree* tree, const Position center, double radius, StarIdBuffer* result);
+int RadiusSearchSorted(KDTree* tree, const Position center, double radius, StarIdBuffer* result);
+int RadiusSearchNearest(KDTree* tree, const Position center, double radius, int limit, StarIdBuffer* result);
+void SortByDistance(int* ids, double* distances, int count);
+
+// CORRIDOR QUERIES
+void CorridorSearchVisit(KDTree* tree, const Position start, const Position end, double radius, StarVisitor visitor, void* user_data);
+int CorridorSearchIds(KDTree* tree, const Position start, const Position end, double radius, StarIdBuffer* result);
+int CorridorSearchSorted(KDTree* tree, const Position start, const Position end, double radius, StarIdBuffer* result);
+StarArray* StarSearchCorridor(KDTree* tree, Star* start, Star* end, float radius);
+
+// AGGREGATE QUERIES
+int AggregateRadius(KDTree* tree, const Position center, double radius, int with_distances, StarAggregate* out);
+int AggregateBox(KDTree* tree, const Position low, const Position high, const Position reference, int with_distances, StarAggregate* out);
+int CountStarsInRadius(KDTree* tree, const Position center, double radius);
+int CountStarsInBox(KDTree* tree, const Position low, const Position high);
+
+// PAIR JOINS
+void InitStarPairBuffer(StarPairBuffer* buffer);
+int ReserveStarPairBuffer(StarPairBuffer* buffer, long capacity);
+void DeallocStarPairBuffer(StarPairBuffer* buffer);
+long CountPairsWithin(KDTree* tree, double radius);
+void SelfJoinVisit(KDTree* tree, double radius, StarPairVisitor visitor, void* user_data);
+long SelfJoinPairs(KDTree* tree, double radius, StarPairBuffer* result);
+
+void PrintKDTree(KDTree* tree);
+void DeallocKDTree(KDTree* tree);
+
+// DYNAMIC STAR INDEX
+StarIndex* CreateStarIndex(StarArray* array, HashMap* names, int leaf_size);
+int StarIndexInsert(StarIndex* index, const char* name, const Position position, float lightyears);
+int StarIndexDelete(StarIndex* index, int id);
+int StarIndexNearest(StarIndex* index, const Position reference, double* distance);
+int StarIndexKNearest(StarIndex* index, const Position reference, int k, int* ids, double* distances);
+void StarIndexRadiusVisit(StarIndex* index, const Position center, double radius, StarVisitor visitor, void* user_data);
+int StarIndexRadiusIds(StarIndex* index, const Position center, double radius, StarIdBuffer* result);
+void DeallocStarIndex(StarIndex* index);
+
+// UNIFORM GRID INDEX
+StarGrid* CreateStarGrid(StarArray* array, double cell_size);
+void GridRadiusVisit(StarGrid* grid, const Position center, double radius, StarVisitor visitor, void* user_data);
+int GridRadiusSearchIds(StarGrid* grid, const Position center, double radius, StarIdBuffer* result);
+StarArray* GridSearchRange(StarGrid* grid, Star* center, float radius);
+Star* GridNearestNeighbor(StarGrid* grid, const Position reference);
+void DeallocStarGrid(StarGrid* grid);
+
+// SPATIAL INDEX BACKEND
+const char* SpatialIndexName(void);
+SpatialIndex* CreateSpatialIndex(StarArray* array, double jump_range);
+SpatialIndex* CreateSpatialIndexForTree(StarArray* array, KDTree* tree, double jump_range);
+Star* SpatialNearest(SpatialIndex* index, const Position reference);
+int SpatialNearestBatch(SpatialIndex* index, const Position* positions, int count, int* out_ids);
+StarArray* SpatialSearchRange(SpatialIndex* index, Star* center, float radius);
+int SpatialRadiusIds(SpatialIndex* index, const Position center, double radius, StarIdBuffer* result);
+int SpatialRadiusSorted(SpatialIndex* index, const Position center, double radius, StarIdBuffer* result);
+int SpatialRadiusNearest(SpatialIndex* index, const Position center, double radius, int limit, StarIdBuffer* result);
+void DeallocSpatialIndex(SpatialIndex* index);
+void DeallocSpatialIndexForTree(SpatialIndex* index, KDTree* tree);
 
 // HASHMAP UTILITY FUNCTIONS
 unsigned long hash(const char* key);
+unsigned int SlotHash(const char* key);
+int HashMapCapacityFor(int count);
+int InsertHashedId(HashMap* map, unsigned int slot_hash, int id);
 void ResizeHashMap(HashMap* map);
-void AddToHashMap(HashMap* map, const char* key, Star* value);
+void AddToHashMap(HashMap* map, Star* value);
 Star* GetFromHashMap(HashMap* map, const char* key);
+int RemoveFromHashMap(HashMap* map, Star* value);
 void DeallocHashMap(HashMap* map);
 
 // OTHER UTILITY FUNCTIONS
 Position* SetPlayerPosition(float x, float y, float z);
+double KDAxisValue(const Position* position, int axis);
 double CalculateDistance(const Star* star, const Position reference);
 int CompareNodeX(const void* a, const void* b);
 int CompareNodeY(const void* a, const void* b);
 int CompareNodeZ(const void* a, const void* b);
 
 
+// JUMP GRAPH FUNCTIONS
+// The tree must cover the whole catalog (star ids 0..size-1), as CreateBalancedKDTree() builds;
+// subset trees from CreateKDTreeFromIds() are rejected. The same holds for CreateRoutePlanner().
+JumpGraph* CreateJumpGraph(KDTree* tree, double jump_range);
+void DeallocJumpGraph(JumpGraph* graph);
+
 // STAR PATH FUNCTIONS
-StarArray* StarPath(const char* destination_key, KDNode* root, HashMap* map);
-void StarPathBuild(Star* origin, Star* destination, StarArray* array, KDNode* root, HashMap *visited);
+RoutePlanner* CreateRoutePlanner(KDTree* tree);
+void DeallocRoutePlanner(RoutePlanner* planner);
+int PlanRoute(RoutePlanner* planner, int origin, int destination, double max_jump, StarIdBuffer* route);
+int PlanRouteOnGraph(RoutePlanner* planner, const JumpGraph* graph, int origin, int destination, StarIdBuffer* route);
+LandmarkSet* CreateLandmarks(RoutePlanner* planner, const JumpGraph* graph, int count);
+void DeallocLandmarks(LandmarkSet* landmarks);
+int PlanRouteWithLandmarks(RoutePlanner* planner, const LandmarkSet* landmarks, int origin, int destination, StarIdBuffer* route);
+StarArray* StarPath(const char* destination_key, KDTree* root, HashMap* map, double max_jump);
+StarArray* StarPathFrom(QueryContext* context, const char* destination_key, double max_jump);
 void PrintStarPath(StarArray* array);
 float CalculateEuclideanDistance(Star* current, Star* goal);
 
+// QUERY CONTEXT FUNCTIONS
+QueryContext* CreateQueryContext(KDTree* tree, HashMap* names, const Position origin);
+void SetQueryOrigin(QueryContext* context, const Position origin);
+void SetQueryIndex(QueryContext* context, SpatialIndex* index);
+Star* QueryNearest(QueryContext* context);
+Star* QueryApproxNearest(QueryContext* context, double epsilon, long max_nodes);
+int QueryRange(QueryContext* context, double radius);
+int QueryRangeNearest(QueryContext* context, double radius, int limit);
+int QueryCorridor(QueryContext* context, const Position destination, double radius);
+int QueryAggregate(QueryContext* context, double radius, int with_distances, StarAggregate* out);
+StarArray* QueryRangeStars(QueryContext* context, double radius);
+StarArray* QueryKNearest(QueryContext* context, int k);
+int QueryRoute(QueryContext* context, const char* destination_key, double max_jump);
+void DeallocQueryContext(QueryContext* context);
+
 // HEAP FUNCTIONS
-void Heapify(StarArray* heap);
-void SiftDown(StarArray* heap, int index);
-Star* PopMin(StarArray* heap);
-void Peek(StarArray* heap);
-// void AddToHeap(StarArray* heap, Star* node);
-// void SiftUp(StarArray* heap);
+void HeapPush(MinHeap* heap, int* heap_index, int id, double key);
+int HeapPopMin(MinHeap* heap, int* heap_index);
+void HeapDecreaseKey(MinHeap* heap, int* heap_index, int id, double key);
 
 #endif
\ No newline at end of file